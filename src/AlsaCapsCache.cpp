@@ -0,0 +1,369 @@
+/*
+ *  Alsa capability cache
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "AlsaCapsCache.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <tuple>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using std::getline;
+using std::ifstream;
+using std::istringstream;
+using std::lock_guard;
+using std::mutex;
+using std::ofstream;
+using std::ostringstream;
+using std::string;
+using std::thread;
+
+using SoundItf::PcmParamRanges;
+using SoundItf::StreamType;
+
+namespace Alsa {
+
+namespace {
+
+std::tuple<uint64_t, unsigned int, unsigned int, unsigned int, unsigned int,
+		   unsigned int, unsigned int, unsigned int, unsigned int>
+tieRanges(const PcmParamRanges& ranges)
+{
+	return std::make_tuple(ranges.formats,
+						   ranges.rates.min, ranges.rates.max,
+						   ranges.channels.min, ranges.channels.max,
+						   ranges.buffer.min, ranges.buffer.max,
+						   ranges.period.min, ranges.period.max);
+}
+
+void writeRanges(ostringstream& stream, const PcmParamRanges& ranges)
+{
+	stream << ranges.formats << " "
+		   << ranges.rates.min << " " << ranges.rates.max << " "
+		   << ranges.channels.min << " " << ranges.channels.max << " "
+		   << ranges.buffer.min << " " << ranges.buffer.max << " "
+		   << ranges.period.min << " " << ranges.period.max << " ";
+}
+
+bool readRanges(istringstream& stream, PcmParamRanges& ranges)
+{
+	return static_cast<bool>(stream >> ranges.formats
+								  >> ranges.rates.min >> ranges.rates.max
+								  >> ranges.channels.min >> ranges.channels.max
+								  >> ranges.buffer.min >> ranges.buffer.max
+								  >> ranges.period.min >> ranges.period.max);
+}
+
+}
+
+/*******************************************************************************
+ * CapsCache
+ ******************************************************************************/
+
+const char* CapsCache::cWatchDir = "/dev/snd";
+const char* CapsCache::cCardsFile = "/proc/asound/cards";
+const char* CapsCache::cFileHeader = "snd_be caps 1";
+
+string CapsCache::sFileName;
+
+bool CapsCache::Key::operator<(const Key& rhs) const
+{
+	return std::tie(deviceName, type) < std::tie(rhs.deviceName, rhs.type) ||
+		   (std::tie(deviceName, type) == std::tie(rhs.deviceName, rhs.type) &&
+			tieRanges(req) < tieRanges(rhs.req));
+}
+
+CapsCache::CapsCache() :
+	mGeneration(0),
+	mNumHits(0),
+	mNumMisses(0),
+	mInotifyFd(-1),
+	mEventFd(-1),
+	mLog("AlsaCapsCache")
+{
+	load();
+	startWatch();
+
+	LOG(mLog, DEBUG) << "Create caps cache, entries: " << mEntries.size();
+}
+
+CapsCache::~CapsCache()
+{
+	stopWatch();
+
+	LOG(mLog, DEBUG) << "Delete caps cache, hits: " << mNumHits
+					 << ", misses: " << mNumMisses;
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+CapsCache& CapsCache::getInstance()
+{
+	static CapsCache sCache;
+
+	return sCache;
+}
+
+bool CapsCache::find(const string& deviceName, StreamType type,
+					 const PcmParamRanges& req, PcmParamRanges& resp)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	auto it = mEntries.find({deviceName, type, req});
+
+	if (it == mEntries.end())
+	{
+		mNumMisses++;
+
+		return false;
+	}
+
+	mNumHits++;
+
+	resp = it->second;
+
+	return true;
+}
+
+void CapsCache::insert(uint64_t generation, const string& deviceName,
+					   StreamType type, const PcmParamRanges& req,
+					   const PcmParamRanges& resp)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (generation != mGeneration)
+	{
+		DLOG(mLog, DEBUG) << "Drop stale caps of device: " << deviceName;
+
+		return;
+	}
+
+	mEntries[{deviceName, type, req}] = resp;
+
+	save();
+}
+
+void CapsCache::clear()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	LOG(mLog, DEBUG) << "Clear caps cache, entries: " << mEntries.size();
+
+	mEntries.clear();
+	mGeneration++;
+
+	save();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void CapsCache::startWatch()
+{
+	if ((mInotifyFd = inotify_init1(IN_CLOEXEC)) < 0 ||
+		(mEventFd = eventfd(0, EFD_CLOEXEC)) < 0 ||
+		inotify_add_watch(mInotifyFd, cWatchDir, IN_CREATE | IN_DELETE) < 0)
+	{
+		LOG(mLog, WARNING) << "Can't watch " << cWatchDir << ": "
+						   << strerror(errno)
+						   << ". Caps are not updated on hotplug";
+
+		stopWatch();
+
+		return;
+	}
+
+	mThread = thread(&CapsCache::watch, this);
+}
+
+void CapsCache::stopWatch()
+{
+	if (mThread.joinable())
+	{
+		uint64_t value = 1;
+
+		if (::write(mEventFd, &value, sizeof(value)) < 0)
+		{
+			LOG(mLog, ERROR) << "Can't wake up watch thread";
+		}
+
+		mThread.join();
+	}
+
+	for (auto fd : {mInotifyFd, mEventFd})
+	{
+		if (fd >= 0)
+		{
+			::close(fd);
+		}
+	}
+
+	mInotifyFd = mEventFd = -1;
+}
+
+void CapsCache::watch()
+{
+	pollfd fds[] = {{mInotifyFd, POLLIN, 0}, {mEventFd, POLLIN, 0}};
+
+	while(true)
+	{
+		if (poll(fds, 2, -1) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			LOG(mLog, ERROR) << "Watch failed: " << strerror(errno);
+
+			break;
+		}
+
+		if (fds[1].revents)
+		{
+			break;
+		}
+
+		if (fds[0].revents)
+		{
+			// the events themselves are not needed: any change clears all
+			char events[4096];
+
+			if (::read(mInotifyFd, events, sizeof(events)) < 0)
+			{
+				DLOG(mLog, DEBUG) << "Spurious wakeup";
+
+				continue;
+			}
+
+			LOG(mLog, INFO) << "Sound devices changed";
+
+			clear();
+		}
+	}
+}
+
+void CapsCache::load()
+{
+	if (sFileName.empty())
+	{
+		return;
+	}
+
+	ifstream file(sFileName);
+	string line;
+
+	if (!getline(file, line) || line != cFileHeader ||
+		!getline(file, line) || line != getFingerprint())
+	{
+		LOG(mLog, DEBUG) << "Ignore caps file: " << sFileName;
+
+		return;
+	}
+
+	while(getline(file, line))
+	{
+		istringstream stream(line);
+		int type;
+		Key key;
+		PcmParamRanges resp;
+
+		if (!(stream >> type) || !readRanges(stream, key.req) ||
+			!readRanges(stream, resp) || !getline(stream >> std::ws,
+												  key.deviceName))
+		{
+			LOG(mLog, WARNING) << "Wrong caps file entry: " << line;
+
+			mEntries.clear();
+
+			return;
+		}
+
+		key.type = type ? StreamType::CAPTURE : StreamType::PLAYBACK;
+
+		mEntries[key] = resp;
+	}
+}
+
+void CapsCache::save()
+{
+	if (sFileName.empty())
+	{
+		return;
+	}
+
+	ostringstream stream;
+
+	stream << cFileHeader << "\n" << getFingerprint() << "\n";
+
+	for (auto& entry : mEntries)
+	{
+		stream << (entry.first.type == StreamType::CAPTURE) << " ";
+
+		writeRanges(stream, entry.first.req);
+		writeRanges(stream, entry.second);
+
+		stream << entry.first.deviceName << "\n";
+	}
+
+	// replace the file atomically to not leave a partial one on crash
+	auto tmpName = sFileName + ".tmp";
+
+	ofstream file(tmpName, std::ios::trunc);
+
+	file << stream.str();
+	file.close();
+
+	if (!file || rename(tmpName.c_str(), sFileName.c_str()) < 0)
+	{
+		LOG(mLog, ERROR) << "Can't save caps file: " << sFileName;
+	}
+}
+
+string CapsCache::getFingerprint()
+{
+	ifstream file(cCardsFile);
+	ostringstream stream;
+
+	stream << file.rdbuf();
+
+	// FNV-1a hash is stable between runs unlike std::hash
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (auto c : stream.str())
+	{
+		hash ^= static_cast<uint8_t>(c);
+		hash *= 1099511628211ULL;
+	}
+
+	return "cards " + std::to_string(hash);
+}
+
+}
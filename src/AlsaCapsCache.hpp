@@ -0,0 +1,155 @@
+/*
+ *  Alsa capability cache
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_ALSACAPSCACHE_HPP_
+#define SRC_ALSACAPSCACHE_HPP_
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <xen/be/Log.hpp>
+
+#include "SoundItf.hpp"
+
+namespace Alsa {
+
+/***************************************************************************//**
+ * Caches refined HW ranges of alsa devices.
+ *
+ * Refining ranges requires opening the device, so queries of the frontends
+ * are answered from the cache when the same request was already refined for
+ * the same device and stream type. One cache is shared by all streams of the
+ * process. It is cleared when a device node is added to or removed from
+ * /dev/snd. If the file name is set, the cache is loaded from the file on
+ * creation and saved to it on each change. The file is ignored if the sound
+ * cards listed by the kernel were changed since it was saved.
+ * @ingroup alsa
+ ******************************************************************************/
+class CapsCache
+{
+public:
+
+	/**
+	 * Returns the cache shared by all streams of the process.
+	 */
+	static CapsCache& getInstance();
+
+	/**
+	 * Sets the file to persist the cache. Should be called before the first
+	 * getInstance.
+	 * @param fileName file name, empty - don't persist
+	 */
+	static void setFileName(const std::string& fileName) { sFileName = fileName; }
+
+	~CapsCache();
+
+	/**
+	 * Returns current generation of the cache. Should be taken before the
+	 * device is queried and passed to insert.
+	 */
+	uint64_t getGeneration() const { return mGeneration; }
+
+	/**
+	 * Finds refined ranges of the request.
+	 * @param deviceName alsa pcm device name
+	 * @param type       stream type
+	 * @param req        requested ranges
+	 * @param resp       refined ranges
+	 * @return true if found
+	 */
+	bool find(const std::string& deviceName, SoundItf::StreamType type,
+			  const SoundItf::PcmParamRanges& req,
+			  SoundItf::PcmParamRanges& resp);
+
+	/**
+	 * Stores refined ranges of the request. Doesn't store them if the cache
+	 * was cleared since the generation was taken.
+	 * @param generation generation taken before the query
+	 * @param deviceName alsa pcm device name
+	 * @param type       stream type
+	 * @param req        requested ranges
+	 * @param resp       refined ranges
+	 */
+	void insert(uint64_t generation, const std::string& deviceName,
+				SoundItf::StreamType type,
+				const SoundItf::PcmParamRanges& req,
+				const SoundItf::PcmParamRanges& resp);
+
+	/**
+	 * Removes all entries.
+	 */
+	void clear();
+
+	/**
+	 * Returns number of queries answered from the cache.
+	 */
+	uint64_t getNumHits() const { return mNumHits; }
+
+	/**
+	 * Returns number of queries which were not found in the cache.
+	 */
+	uint64_t getNumMisses() const { return mNumMisses; }
+
+private:
+
+	static const char* cWatchDir;
+	static const char* cCardsFile;
+	static const char* cFileHeader;
+
+	static std::string sFileName;
+
+	struct Key
+	{
+		std::string deviceName;
+		SoundItf::StreamType type;
+		SoundItf::PcmParamRanges req;
+
+		bool operator<(const Key& rhs) const;
+	};
+
+	std::map<Key, SoundItf::PcmParamRanges> mEntries;
+	std::atomic<uint64_t> mGeneration;
+	std::atomic<uint64_t> mNumHits;
+	std::atomic<uint64_t> mNumMisses;
+	std::mutex mMutex;
+
+	int mInotifyFd;
+	int mEventFd;
+	std::thread mThread;
+
+	XenBackend::Log mLog;
+
+	CapsCache();
+
+	void startWatch();
+	void stopWatch();
+	void watch();
+
+	void load();
+	void save();
+	static std::string getFingerprint();
+};
+
+}
+
+#endif /* SRC_ALSACAPSCACHE_HPP_ */
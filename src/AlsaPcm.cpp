@@ -20,10 +20,17 @@
 
 #include "AlsaPcm.hpp"
 
+#include <algorithm>
+#include <cstring>
+
 #include <xen/io/sndif.h>
 
 using std::bind;
 using std::chrono::milliseconds;
+using std::lock_guard;
+using std::min;
+using std::mutex;
+using std::unique_lock;
 using std::string;
 using std::to_string;
 
@@ -36,14 +43,24 @@ namespace Alsa {
  * AlsaPcm
  ******************************************************************************/
 
+milliseconds AlsaPcm::sStandbyTime(0);
+const milliseconds AlsaPcm::cDrainMargin(100);
+
 AlsaPcm::AlsaPcm(StreamType type, const std::string& deviceName) :
 	mHandle(nullptr),
+	mAccess(SND_PCM_ACCESS_RW_INTERLEAVED),
 	mDeviceName(deviceName),
 	mType(type),
-	mTimer(bind(&AlsaPcm::getTimeStamp, this), true),
+	mTimer(bind(&AlsaPcm::getTimeStamp, this)),
 	mLog("AlsaPcm"),
 	mHwQueryHandle(nullptr),
-	mHwQueryParams(nullptr)
+	mHwQueryParams(nullptr),
+	mOpened(false),
+	mStandby(false),
+	mDraining(false),
+	mDrainStandby(false),
+	mStandbyTimer(bind(&AlsaPcm::standbyExpired, this)),
+	mDrainTimer(bind(&AlsaPcm::drainCbk, this))
 {
 	if (mDeviceName.empty())
 	{
@@ -57,7 +74,13 @@ AlsaPcm::~AlsaPcm()
 {
 	LOG(mLog, DEBUG) << "Delete pcm device: " << mDeviceName;
 
-	close();
+	release(false);
+
+	// waits for the drain in progress
+	releaseStandby();
+
+	mDrainTimer.stop();
+	mStandbyTimer.stop();
 }
 
 /*******************************************************************************
@@ -66,6 +89,20 @@ AlsaPcm::~AlsaPcm()
 
 void AlsaPcm::queryHwRanges(SoundItf::PcmParamRanges& req, SoundItf::PcmParamRanges& resp)
 {
+	auto& capsCache = CapsCache::getInstance();
+
+	if (capsCache.find(mDeviceName, mType, req, resp))
+	{
+		DLOG(mLog, DEBUG) << "Query pcm device " << mDeviceName
+						  << " for HW parameters, cached";
+
+		return;
+	}
+
+	// the request is modified by refining, keep it for the cache key
+	auto cacheReq = req;
+	auto generation = capsCache.getGeneration();
+
 	snd_pcm_hw_params_t* hwParams;
 
 	queryOpen();
@@ -83,6 +120,8 @@ void AlsaPcm::queryHwRanges(SoundItf::PcmParamRanges& req, SoundItf::PcmParamRan
 	queryHwParamChannels(hwParams, req, resp);
 	queryHwParamBuffer(hwParams, req, resp);
 	queryHwParamPeriod(hwParams, req, resp);
+
+	capsCache.insert(generation, mDeviceName, mType, cacheReq, resp);
 }
 
 void AlsaPcm::open(const PcmParams& params)
@@ -98,6 +137,11 @@ void AlsaPcm::open(const PcmParams& params)
 
 		queryClose();
 
+		if (reuseStandby(params))
+		{
+			return;
+		}
+
 		if ((ret = snd_pcm_open(&mHandle, mDeviceName.c_str(),
 							    streamType, 0)) < 0)
 		{
@@ -112,16 +156,23 @@ void AlsaPcm::open(const PcmParams& params)
 			throw Exception("Can't prepare audio interface for use", -ret);
 		}
 
+		mRequestedParams = params;
+
 		mFrameWritten = 0;
 		mFrameUnderrun = 0;
 
 		mTimerPeriodMs = milliseconds(
 			(snd_pcm_bytes_to_frames(mHandle, mParams.periodSize) * 1000) /
 			mParams.rate);
+
+		lock_guard<mutex> lock(mCloseMutex);
+
+		mOpened = true;
 	}
 	catch(const std::exception& e)
 	{
-		close();
+		// don't keep partially configured device in standby
+		release(false);
 
 		throw;
 	}
@@ -129,20 +180,7 @@ void AlsaPcm::open(const PcmParams& params)
 
 void AlsaPcm::close()
 {
-	queryClose();
-
-	if (mHandle)
-	{
-		DLOG(mLog, DEBUG) << "Close pcm device: " << mDeviceName;
-
-		snd_pcm_drain(mHandle);
-
-		mTimer.stop();
-
-		snd_pcm_close(mHandle);
-	}
-
-	mHandle = nullptr;
+	release(sStandbyTime.count() > 0);
 }
 
 void AlsaPcm::read(uint8_t* buffer, size_t size)
@@ -150,22 +188,28 @@ void AlsaPcm::read(uint8_t* buffer, size_t size)
 	DLOG(mLog, DEBUG) << "Read from pcm device: " << mDeviceName
 					  << ", size: " << size;
 
-	if (!mHandle)
 	{
-		throw Exception("Alsa device is not opened: " + mDeviceName, EFAULT);
+		// the transfer itself is not locked: stop releases it
+		lock_guard<mutex> lock(mCloseMutex);
+
+		checkOpened();
 	}
 
 	auto numFrames = snd_pcm_bytes_to_frames(mHandle, size);
 
 	while(numFrames > 0)
 	{
-		if (auto status = snd_pcm_readi(mHandle, buffer, numFrames))
+		if (auto status = mAccess == SND_PCM_ACCESS_MMAP_INTERLEAVED ?
+						  readMmap(buffer, numFrames) :
+						  snd_pcm_readi(mHandle, buffer, numFrames))
 		{
 			if (status == -EPIPE)
 			{
 				LOG(mLog, WARNING) << "Device: " << mDeviceName
 								   << ", message: " << snd_strerror(status);
 
+				mMetrics.xruns->inc();
+
 				snd_pcm_prepare(mHandle);
 			}
 			else if (status < 0)
@@ -175,8 +219,12 @@ void AlsaPcm::read(uint8_t* buffer, size_t size)
 			}
 			else
 			{
+				auto numBytes = snd_pcm_frames_to_bytes(mHandle, status);
+
 				numFrames -= status;
-				buffer = &buffer[snd_pcm_frames_to_bytes(mHandle, status)];
+				buffer = &buffer[numBytes];
+
+				mMetrics.capturedBytes->inc(numBytes);
 			}
 		}
 	}
@@ -184,9 +232,11 @@ void AlsaPcm::read(uint8_t* buffer, size_t size)
 
 void AlsaPcm::write(uint8_t* buffer, size_t size)
 {
-	if (!mHandle)
 	{
-		throw Exception("Alsa device is not opened: " + mDeviceName, EFAULT);
+		// the transfer itself is not locked: stop releases it
+		lock_guard<mutex> lock(mCloseMutex);
+
+		checkOpened();
 	}
 
 	auto numFrames = snd_pcm_bytes_to_frames(mHandle, size);
@@ -195,7 +245,9 @@ void AlsaPcm::write(uint8_t* buffer, size_t size)
 
 	while(numFrames > 0)
 	{
-		if (auto status = snd_pcm_writei(mHandle, buffer, numFrames))
+		if (auto status = mAccess == SND_PCM_ACCESS_MMAP_INTERLEAVED ?
+						  writeMmap(buffer, numFrames) :
+						  snd_pcm_writei(mHandle, buffer, numFrames))
 		{
 			DLOG(mLog, DEBUG) << "Write to pcm device: " << mDeviceName
 							  << ", size: " << status;
@@ -214,6 +266,8 @@ void AlsaPcm::write(uint8_t* buffer, size_t size)
 
 				mFrameUnderrun = mFrameWritten;
 
+				mMetrics.xruns->inc();
+
 				restartAfterError = true;
 			}
 			else if (status < 0)
@@ -223,10 +277,14 @@ void AlsaPcm::write(uint8_t* buffer, size_t size)
 			}
 			else
 			{
+				auto numBytes = snd_pcm_frames_to_bytes(mHandle, status);
+
 				numFrames -= status;
-				buffer = &buffer[snd_pcm_frames_to_bytes(mHandle, status)];
+				buffer = &buffer[numBytes];
 				mFrameWritten += status;
 
+				mMetrics.writtenBytes->inc(numBytes);
+
 				if (snd_pcm_state(mHandle) != SND_PCM_STATE_RUNNING &&
 					restartAfterError)
 				{
@@ -247,11 +305,9 @@ void AlsaPcm::start()
 {
 	LOG(mLog, DEBUG) << "Start";
 
-	if (!mHandle)
-	{
-		throw Exception("Alsa device is not opened: " +
-						 mDeviceName , EFAULT);
-	}
+	lock_guard<mutex> lock(mCloseMutex);
+
+	checkOpened();
 
 	int ret = 0;
 
@@ -267,11 +323,9 @@ void AlsaPcm::stop()
 {
 	LOG(mLog, DEBUG) << "Stop";
 
-	if (!mHandle)
-	{
-		throw Exception("Alsa device is not opened: " +
-						 mDeviceName, EFAULT);
-	}
+	lock_guard<mutex> lock(mCloseMutex);
+
+	checkOpened();
 
 	int ret = 0;
 
@@ -292,11 +346,9 @@ void AlsaPcm::pause()
 {
 	LOG(mLog, DEBUG) << "Pause";
 
-	if (!mHandle)
-	{
-		throw Exception("Alsa device is not opened: " +
-						 mDeviceName, EFAULT);
-	}
+	lock_guard<mutex> lock(mCloseMutex);
+
+	checkOpened();
 
 	int ret = 0;
 
@@ -312,11 +364,9 @@ void AlsaPcm::resume()
 {
 	LOG(mLog, DEBUG) << "Resume";
 
-	if (!mHandle)
-	{
-		throw Exception("Alsa device is not opened: " +
-						 mDeviceName, EFAULT);
-	}
+	lock_guard<mutex> lock(mCloseMutex);
+
+	checkOpened();
 
 	int ret = 0;
 
@@ -332,6 +382,220 @@ void AlsaPcm::resume()
  * Private
  ******************************************************************************/
 
+void AlsaPcm::release(bool standby)
+{
+	queryClose();
+
+	lock_guard<mutex> lock(mCloseMutex);
+
+	mOpened = false;
+
+	// already closed to standby or being drained
+	if (mStandby || mDraining)
+	{
+		return;
+	}
+
+	if (mHandle)
+	{
+		DLOG(mLog, DEBUG) << "Close pcm device: " << mDeviceName;
+
+		mTimer.stop();
+
+		if (mType == StreamType::PLAYBACK)
+		{
+			if (startDrain())
+			{
+				mDrainStandby = standby;
+
+				return;
+			}
+		}
+		else
+		{
+			snd_pcm_drain(mHandle);
+		}
+
+		closeDrained(standby);
+	}
+}
+
+void AlsaPcm::checkOpened()
+{
+	// the handle outlives close while it drains or stays in standby
+	if (!mOpened)
+	{
+		throw Exception("Alsa device is not opened: " + mDeviceName, EFAULT);
+	}
+}
+
+bool AlsaPcm::startDrain()
+{
+	// non blocking drain returns at once and plays out the buffer in
+	// background, the drain timer polls for the end
+	snd_pcm_nonblock(mHandle, 1);
+
+	if (snd_pcm_drain(mHandle) != -EAGAIN)
+	{
+		snd_pcm_nonblock(mHandle, 0);
+
+		return false;
+	}
+
+	auto bufferMs = snd_pcm_bytes_to_frames(mHandle, mParams.bufferSize) *
+					1000 / mParams.rate;
+
+	mDrainDeadline = std::chrono::steady_clock::now() +
+					 milliseconds(bufferMs) + cDrainMargin;
+	mDraining = true;
+
+	mDrainTimer.start(mTimerPeriodMs);
+
+	DLOG(mLog, DEBUG) << "Drain pcm device: " << mDeviceName;
+
+	return true;
+}
+
+void AlsaPcm::drainCbk()
+{
+	lock_guard<mutex> lock(mCloseMutex);
+
+	if (!mDraining)
+	{
+		return;
+	}
+
+	if (snd_pcm_state(mHandle) == SND_PCM_STATE_DRAINING)
+	{
+		if (std::chrono::steady_clock::now() < mDrainDeadline)
+		{
+			return;
+		}
+
+		LOG(mLog, WARNING) << "Drain timeout, drop pcm device: "
+						   << mDeviceName;
+
+		snd_pcm_drop(mHandle);
+	}
+
+	DLOG(mLog, DEBUG) << "Drained pcm device: " << mDeviceName;
+
+	mDrainTimer.stop(false);
+
+	snd_pcm_nonblock(mHandle, 0);
+
+	mDraining = false;
+
+	closeDrained(mDrainStandby);
+
+	mDrainCondVar.notify_all();
+}
+
+void AlsaPcm::waitDrain(unique_lock<mutex>& lock)
+{
+	mDrainCondVar.wait(lock, [this] { return !mDraining; });
+}
+
+void AlsaPcm::closeDrained(bool standby)
+{
+	if (standby && snd_pcm_prepare(mHandle) >= 0)
+	{
+		DLOG(mLog, DEBUG) << "Keep pcm device in standby: " << mDeviceName
+						  << ", time: " << sStandbyTime.count() << " ms";
+
+		mStandby = true;
+		mStandbyTimer.start(sStandbyTime);
+
+		return;
+	}
+
+	snd_pcm_close(mHandle);
+
+	mHandle = nullptr;
+}
+
+bool AlsaPcm::reuseStandby(const PcmParams& params)
+{
+	unique_lock<mutex> lock(mCloseMutex);
+
+	waitDrain(lock);
+
+	if (!mStandby)
+	{
+		return false;
+	}
+
+	mStandbyTimer.stop(false);
+	mStandby = false;
+
+	if (params.format == mRequestedParams.format &&
+		params.rate == mRequestedParams.rate &&
+		params.numChannels == mRequestedParams.numChannels &&
+		params.bufferSize == mRequestedParams.bufferSize &&
+		params.periodSize == mRequestedParams.periodSize)
+	{
+		int ret = 0;
+
+		if ((ret = snd_pcm_drop(mHandle)) >= 0 &&
+			(ret = snd_pcm_prepare(mHandle)) >= 0)
+		{
+			DLOG(mLog, DEBUG) << "Reuse pcm device from standby: "
+							  << mDeviceName;
+
+			mOpened = true;
+
+			mFrameWritten = 0;
+			mFrameUnderrun = 0;
+
+			return true;
+		}
+
+		LOG(mLog, WARNING) << "Can't reuse pcm device " << mDeviceName
+						   << ": " << snd_strerror(ret);
+	}
+
+	DLOG(mLog, DEBUG) << "Close pcm device from standby: " << mDeviceName;
+
+	snd_pcm_close(mHandle);
+
+	mHandle = nullptr;
+
+	return false;
+}
+
+void AlsaPcm::releaseStandby()
+{
+	unique_lock<mutex> lock(mCloseMutex);
+
+	waitDrain(lock);
+
+	closeStandby();
+}
+
+void AlsaPcm::standbyExpired()
+{
+	// called on the scheduler thread which ends the drain: must not wait it
+	lock_guard<mutex> lock(mCloseMutex);
+
+	closeStandby();
+}
+
+void AlsaPcm::closeStandby()
+{
+	// the timer is one shot
+	mStandbyTimer.stop(false);
+
+	if (mStandby)
+	{
+		DLOG(mLog, DEBUG) << "Close pcm device from standby: " << mDeviceName;
+
+		snd_pcm_close(mHandle);
+
+		mHandle = nullptr;
+		mStandby = false;
+	}
+}
+
 void AlsaPcm::setHwParams(const PcmParams& params)
 {
 	LOG(mLog, DEBUG) << "Format: "
@@ -354,11 +618,7 @@ void AlsaPcm::setHwParams(const PcmParams& params)
 		throw Exception("Can't fill hw params " + mDeviceName, -ret);
 	}
 
-	if ((ret = snd_pcm_hw_params_set_access(
-			mHandle, hwParams, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
-	{
-		throw Exception("Can't set access " + mDeviceName, -ret);
-	}
+	setAccess(hwParams);
 
 	snd_pcm_format_t format = convertPcmFormat(params.format);
 
@@ -447,6 +707,37 @@ void AlsaPcm::setHwParams(const PcmParams& params)
 		LOG(mLog, DEBUG) << "Playback supports audio link synchronized timestamps";
 }
 
+void AlsaPcm::setAccess(snd_pcm_hw_params_t* hwParams)
+{
+	int ret = 0;
+
+	/*
+	 * mmap access lets us copy directly between the shared buffer and the
+	 * device ring: it saves the intermediate copy done inside alsa-lib
+	 */
+	if (snd_pcm_hw_params_test_access(mHandle, hwParams,
+									  SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0 &&
+		snd_pcm_hw_params_set_access(mHandle, hwParams,
+									 SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0)
+	{
+		mAccess = SND_PCM_ACCESS_MMAP_INTERLEAVED;
+
+		LOG(mLog, DEBUG) << "Use mmap access: " << mDeviceName;
+
+		return;
+	}
+
+	if ((ret = snd_pcm_hw_params_set_access(
+			mHandle, hwParams, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
+	{
+		throw Exception("Can't set access " + mDeviceName, -ret);
+	}
+
+	mAccess = SND_PCM_ACCESS_RW_INTERLEAVED;
+
+	LOG(mLog, DEBUG) << "Use rw access: " << mDeviceName;
+}
+
 void AlsaPcm::setSwParams()
 {
 	snd_pcm_sw_params_t* swParams = nullptr;
@@ -487,6 +778,85 @@ void AlsaPcm::setSwParams()
 	}
 }
 
+snd_pcm_sframes_t AlsaPcm::writeMmap(const uint8_t* buffer,
+									 snd_pcm_uframes_t numFrames)
+{
+	auto avail = waitMmap();
+
+	if (avail <= 0)
+	{
+		return avail;
+	}
+
+	const snd_pcm_channel_area_t* areas;
+	snd_pcm_uframes_t offset;
+	snd_pcm_uframes_t frames = min(static_cast<snd_pcm_uframes_t>(avail),
+								   numFrames);
+	int ret = 0;
+
+	if ((ret = snd_pcm_mmap_begin(mHandle, &areas, &offset, &frames)) < 0)
+	{
+		return ret;
+	}
+
+	// interleaved access: all channels share the first area
+	auto dst = static_cast<uint8_t*>(areas[0].addr) +
+			   (areas[0].first + offset * areas[0].step) / 8;
+
+	memcpy(dst, buffer, snd_pcm_frames_to_bytes(mHandle, frames));
+
+	return snd_pcm_mmap_commit(mHandle, offset, frames);
+}
+
+snd_pcm_sframes_t AlsaPcm::readMmap(uint8_t* buffer,
+									snd_pcm_uframes_t numFrames)
+{
+	auto avail = waitMmap();
+
+	if (avail <= 0)
+	{
+		return avail;
+	}
+
+	const snd_pcm_channel_area_t* areas;
+	snd_pcm_uframes_t offset;
+	snd_pcm_uframes_t frames = min(static_cast<snd_pcm_uframes_t>(avail),
+								   numFrames);
+	int ret = 0;
+
+	if ((ret = snd_pcm_mmap_begin(mHandle, &areas, &offset, &frames)) < 0)
+	{
+		return ret;
+	}
+
+	auto src = static_cast<const uint8_t*>(areas[0].addr) +
+			   (areas[0].first + offset * areas[0].step) / 8;
+
+	memcpy(buffer, src, snd_pcm_frames_to_bytes(mHandle, frames));
+
+	return snd_pcm_mmap_commit(mHandle, offset, frames);
+}
+
+snd_pcm_sframes_t AlsaPcm::waitMmap()
+{
+	auto avail = snd_pcm_avail_update(mHandle);
+
+	if (avail != 0)
+	{
+		return avail;
+	}
+
+	// no room (or no data) in the device ring: block as readi/writei do
+	int ret = 0;
+
+	if ((ret = snd_pcm_wait(mHandle, -1)) < 0)
+	{
+		return ret;
+	}
+
+	return snd_pcm_avail_update(mHandle);
+}
+
 void AlsaPcm::getTimeStamp()
 {
 	snd_pcm_status_t* status;
@@ -585,6 +955,9 @@ void AlsaPcm::queryOpen()
 
 		if (!mHwQueryHandle)
 		{
+			// the device may be opened exclusively
+			releaseStandby();
+
 			DLOG(mLog, DEBUG) << "Opening pcm device for queries: " << mDeviceName;
 
 			if ((ret = snd_pcm_open(&mHwQueryHandle, mDeviceName.c_str(),
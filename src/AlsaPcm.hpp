@@ -21,13 +21,19 @@
 #ifndef SRC_ALSAPCM_HPP_
 #define SRC_ALSAPCM_HPP_
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
 #include <alsa/asoundlib.h>
 
 #include <xen/be/Exception.hpp>
 #include <xen/be/Log.hpp>
 #include <xen/be/Utils.hpp>
 
+#include "AlsaCapsCache.hpp"
 #include "SoundItf.hpp"
+#include "TimerScheduler.hpp"
 
 namespace Alsa {
 
@@ -67,6 +73,16 @@ public:
 					 const std::string& deviceName = "default");
 	~AlsaPcm();
 
+	/**
+	 * Sets how long the device is kept prepared after close. If the next open
+	 * requests the same parameters, the device is reused.
+	 * @param time standby time, 0 - close the device immediately
+	 */
+	static void setStandbyTime(std::chrono::milliseconds time)
+	{
+		sStandbyTime = time;
+	}
+
 	/**
 	 * Queries the device for HW intervals and masks.
 	 * @req HW parameters that the frontend wants to set
@@ -128,6 +144,15 @@ public:
 		mProgressCbk = cbk;
 	}
 
+	/**
+	 * Publishes the device metrics with the labels of the stream.
+	 * @param labels metric labels
+	 */
+	void setMetricLabels(const Metrics::Labels& labels) override
+	{
+		mMetrics.publish(labels);
+	}
+
 private:
 
 	const snd_pcm_uframes_t cDefaultPeriodFrames = 4096;
@@ -141,24 +166,60 @@ private:
 
 	static PcmFormat sPcmFormat[];
 
+	static const std::chrono::milliseconds cDrainMargin;
+
+	static std::chrono::milliseconds sStandbyTime;
+
 	snd_pcm_t* mHandle;
+	snd_pcm_access_t mAccess;
 	std::string mDeviceName;
 	SoundItf::StreamType mType;
-	XenBackend::Timer mTimer;
+	ScheduledTimer mTimer;
 	std::chrono::milliseconds mTimerPeriodMs;
 	XenBackend::Log mLog;
 
 	SoundItf::PcmParams mParams;
 
 	SoundItf::ProgressCbk mProgressCbk;
+	Metrics::PcmMetrics mMetrics;
 	snd_pcm_uframes_t mFrameWritten;
 	snd_pcm_uframes_t mFrameUnderrun;
 
 	snd_pcm_t* mHwQueryHandle;
 	snd_pcm_hw_params_t* mHwQueryParams;
 
+	// parameters the device was opened with before adjusting
+	SoundItf::PcmParams mRequestedParams;
+
+	// close state, guarded by the close mutex
+	bool mOpened;
+	bool mStandby;
+	bool mDraining;
+	bool mDrainStandby;
+	std::chrono::steady_clock::time_point mDrainDeadline;
+	std::mutex mCloseMutex;
+	std::condition_variable mDrainCondVar;
+	ScheduledTimer mStandbyTimer;
+	ScheduledTimer mDrainTimer;
+
+	void checkOpened();
+	void release(bool standby);
+	bool startDrain();
+	void drainCbk();
+	void waitDrain(std::unique_lock<std::mutex>& lock);
+	void closeDrained(bool standby);
+	bool reuseStandby(const SoundItf::PcmParams& params);
+	void releaseStandby();
+	void standbyExpired();
+	void closeStandby();
+
 	void setHwParams(const SoundItf::PcmParams& params);
+	void setAccess(snd_pcm_hw_params_t* hwParams);
 	void setSwParams();
+	snd_pcm_sframes_t writeMmap(const uint8_t* buffer,
+								snd_pcm_uframes_t numFrames);
+	snd_pcm_sframes_t readMmap(uint8_t* buffer, snd_pcm_uframes_t numFrames);
+	snd_pcm_sframes_t waitMmap();
 	void getTimeStamp();
 	snd_pcm_format_t convertPcmFormat(uint8_t format);
 
@@ -0,0 +1,202 @@
+/*
+ *  Benchmarks
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "Bench.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <numeric>
+
+#include <xen/be/Log.hpp>
+
+#include <xen/io/sndif.h>
+
+using std::accumulate;
+using std::cout;
+using std::endl;
+using std::exception;
+using std::min;
+using std::string;
+
+using XenBackend::Log;
+using XenBackend::XenGnttabBuffer;
+
+namespace Bench {
+
+namespace {
+
+const size_t cNumGrefsPerPage =
+		(XC_PAGE_SIZE - offsetof(xensnd_page_directory, gref)) /
+		sizeof(grant_ref_t);
+
+}
+
+void setupDirectory(domid_t domId, grant_ref_t directoryRef,
+					grant_ref_t bufferRef, uint32_t size, grant_ref_t nextRef)
+{
+	size_t numRefs = (size + XC_PAGE_SIZE - 1) / XC_PAGE_SIZE;
+	size_t numDirectories = (numRefs + cNumGrefsPerPage - 1) / cNumGrefsPerPage;
+
+	if (!nextRef)
+	{
+		nextRef = directoryRef + 1;
+	}
+
+	for (size_t i = 0; i < numDirectories; i++)
+	{
+		XenGnttabBuffer page(domId, i ? nextRef + i - 1 : directoryRef);
+
+		auto directory = static_cast<xensnd_page_directory*>(page.get());
+
+		directory->gref_dir_next_page = i + 1 < numDirectories ?
+										nextRef + i : 0;
+
+		size_t count = min(numRefs, cNumGrefsPerPage);
+
+		for (size_t j = 0; j < count; j++)
+		{
+			directory->gref[j] = bufferRef++;
+		}
+
+		numRefs -= count;
+	}
+}
+
+/*******************************************************************************
+ * Stats
+ ******************************************************************************/
+
+void Stats::merge(const Stats& other)
+{
+	mSamples.insert(mSamples.end(), other.mSamples.begin(),
+					other.mSamples.end());
+
+	mSorted = false;
+}
+
+double Stats::min()
+{
+	sort();
+
+	return mSamples.empty() ? 0 : mSamples.front();
+}
+
+double Stats::avg() const
+{
+	if (mSamples.empty())
+	{
+		return 0;
+	}
+
+	return accumulate(mSamples.begin(), mSamples.end(), 0.0) /
+		   mSamples.size();
+}
+
+double Stats::percentile(double p)
+{
+	sort();
+
+	if (mSamples.empty())
+	{
+		return 0;
+	}
+
+	size_t index = static_cast<size_t>(p * (mSamples.size() - 1) / 100.0 + 0.5);
+
+	return mSamples[std::min(index, mSamples.size() - 1)];
+}
+
+void Stats::sort()
+{
+	if (!mSorted)
+	{
+		std::sort(mSamples.begin(), mSamples.end());
+
+		mSorted = true;
+	}
+}
+
+}
+
+/*******************************************************************************
+ *
+ ******************************************************************************/
+
+struct Suite
+{
+	const char* name;
+	const char* description;
+	int (*run)(int argc, char* argv[]);
+};
+
+static Suite sSuites[] =
+{
+	{"open", "OPEN latency against buffer size", Bench::benchOpen},
+	{"resampler", "resampler ns/frame per quality", Bench::benchResampler},
+	{"stream", "request throughput and latency of streams",
+	 Bench::benchStream},
+};
+
+void usage(const char* name)
+{
+	cout << "Usage: " << name << " <suite> [options]" << endl;
+	cout << "\t-v -- verbose level in format: "
+		 << "<module>:<level>;<module:<level>" << endl;
+	cout << "Suites:" << endl;
+
+	for (auto& suite : sSuites)
+	{
+		cout << "\t" << suite.name << " -- " << suite.description << endl;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		usage(argv[0]);
+
+		return -1;
+	}
+
+	Log::setLogMask("*:Error");
+
+	try
+	{
+		for (auto& suite : sSuites)
+		{
+			if (string(argv[1]) == suite.name)
+			{
+				return suite.run(argc - 1, &argv[1]);
+			}
+		}
+	}
+	catch(const exception& e)
+	{
+		LOG("Bench", ERROR) << e.what();
+
+		return -1;
+	}
+
+	usage(argv[0]);
+
+	return -1;
+}
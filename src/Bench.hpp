@@ -0,0 +1,134 @@
+/*
+ *  Benchmarks
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_BENCH_HPP_
+#define SRC_BENCH_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <xen/be/XenGnttab.hpp>
+
+namespace Bench {
+
+/***************************************************************************//**
+ * @defgroup bench
+ * Benchmark related classes.
+ ******************************************************************************/
+
+/**
+ * Returns monotonic time in nanoseconds.
+ * @ingroup bench
+ */
+inline uint64_t now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/***************************************************************************//**
+ * Collects samples and calculates statistics.
+ * @ingroup bench
+ ******************************************************************************/
+class Stats
+{
+public:
+
+	/**
+	 * Adds sample.
+	 * @param value sample value
+	 */
+	void add(double value) { mSamples.push_back(value); mSorted = false; }
+
+	/**
+	 * Adds samples of other stats.
+	 * @param other stats to add
+	 */
+	void merge(const Stats& other);
+
+	/**
+	 * Returns number of samples.
+	 */
+	size_t count() const { return mSamples.size(); }
+
+	/**
+	 * Returns min sample.
+	 */
+	double min();
+
+	/**
+	 * Returns average of samples.
+	 */
+	double avg() const;
+
+	/**
+	 * Returns percentile.
+	 * @param p percentile in range 0..100
+	 */
+	double percentile(double p);
+
+private:
+
+	std::vector<double> mSamples;
+	bool mSorted = false;
+
+	void sort();
+};
+
+/**
+ * Writes the page directory of the shared buffer through the grant mappings
+ * as the frontend does.
+ * @ingroup bench
+ * @param domId        frontend domain id
+ * @param directoryRef reference of the first directory page
+ * @param bufferRef    reference of the first buffer page, next pages use
+ *                     following references
+ * @param size         buffer size
+ * @param nextRef      reference of the second directory page, next pages use
+ *                     following references; 0 - directoryRef + 1
+ */
+void setupDirectory(domid_t domId, grant_ref_t directoryRef,
+					grant_ref_t bufferRef, uint32_t size,
+					grant_ref_t nextRef = 0);
+
+/**
+ * Benchmarks OPEN latency against buffer size.
+ * @ingroup bench
+ */
+int benchOpen(int argc, char* argv[]);
+
+/**
+ * Benchmarks resampler time per frame for each quality.
+ * @ingroup bench
+ */
+int benchResampler(int argc, char* argv[]);
+
+/**
+ * Benchmarks request throughput and latency of streams driven through the
+ * stream rings.
+ * @ingroup bench
+ */
+int benchStream(int argc, char* argv[]);
+
+}
+
+#endif /* SRC_BENCH_HPP_ */
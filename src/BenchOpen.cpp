@@ -0,0 +1,171 @@
+/*
+ *  OPEN latency benchmark
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "Bench.hpp"
+
+#include <iomanip>
+#include <iostream>
+
+#include <getopt.h>
+
+#include <xen/be/Log.hpp>
+
+#include "BufferCache.hpp"
+
+using std::cout;
+using std::endl;
+using std::setw;
+using std::string;
+using std::vector;
+
+using XenBackend::Log;
+
+namespace Bench {
+
+/*******************************************************************************
+ * OPEN benchmark
+ *
+ * Measures mapping of the shared buffer done on OPEN: the page directory walk
+ * and the buffer map. "first" is the first OPEN of a buffer, which walks the
+ * directory page by page. "reopen" is reopen of the same buffer with the
+ * default configuration (no cached buffers): the remembered directory chain
+ * is mapped with one batched map and the buffer is mapped again. "cached" is
+ * reopen served by the buffer cache (-g 1). "changed" is reopen with the
+ * default configuration after the frontend has rebuilt the directory chain
+ * behind the same first directory page: the remembered chain doesn't match
+ * and the directory is walked again. Buffers of up to 4 MiB have one
+ * directory page, so the chain matters for larger buffers only.
+ *
+ * The page directory is written through the grant mappings, so the benchmark
+ * is intended to run with libxenbemock (WITH_MOCKBELIB).
+ ******************************************************************************/
+
+namespace {
+
+const grant_ref_t cDirectoryRefBase = 0x100000;
+const grant_ref_t cChangedDirectoryRefBase = 0x200000;
+const grant_ref_t cBufferRefBase = 0x1000000;
+
+void measureFirst(domid_t domId, uint32_t size, int iterations, Stats& stats)
+{
+	for (int i = 0; i < iterations; i++)
+	{
+		BufferCache cache(domId);
+
+		auto start = now();
+
+		auto buffer = cache.get(cDirectoryRefBase, size);
+
+		stats.add((now() - start) / 1000.0);
+	}
+}
+
+void measure(BufferCache& cache, uint32_t size, int iterations, Stats& stats,
+			 domid_t changeDomId = 0)
+{
+	for (int i = 0; i < iterations; i++)
+	{
+		if (changeDomId)
+		{
+			// alternate the follow-up directory pages
+			setupDirectory(changeDomId, cDirectoryRefBase, cBufferRefBase, size,
+						   i % 2 ? 0 : cChangedDirectoryRefBase);
+		}
+
+		auto start = now();
+
+		auto buffer = cache.get(cDirectoryRefBase, size);
+
+		stats.add((now() - start) / 1000.0);
+	}
+}
+
+}
+
+int benchOpen(int argc, char* argv[])
+{
+	domid_t domId = 1;
+	int iterations = 100;
+	int opt = -1;
+
+	while((opt = getopt(argc, argv, "d:n:v:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'd':
+			domId = std::stoi(optarg);
+			break;
+		case 'n':
+			iterations = std::stoi(optarg);
+			break;
+		case 'v':
+			Log::setLogMask(optarg);
+			break;
+		default:
+			cout << "Options: -d <frontend dom id> -n <iterations>" << endl;
+			return -1;
+		}
+	}
+
+	cout << setw(10) << "size, KiB"
+		 << setw(15) << "first avg, us" << setw(15) << "first p99, us"
+		 << setw(16) << "reopen avg, us" << setw(16) << "reopen p99, us"
+		 << setw(16) << "cached avg, us" << setw(16) << "cached p99, us"
+		 << setw(17) << "changed avg, us" << setw(17) << "changed p99, us"
+		 << endl;
+
+	for (uint32_t size = 4096; size <= 16 * 1024 * 1024; size *= 4)
+	{
+		setupDirectory(domId, cDirectoryRefBase, cBufferRefBase, size);
+
+		Stats first, reopen, cached, changed;
+
+		measureFirst(domId, size, iterations, first);
+
+		// default configuration: no cached buffers
+		BufferCache defaultCache(domId);
+
+		defaultCache.get(cDirectoryRefBase, size);
+
+		measure(defaultCache, size, iterations, reopen);
+
+		BufferCache bufferCache(domId, 1);
+
+		bufferCache.get(cDirectoryRefBase, size);
+
+		measure(bufferCache, size, iterations, cached);
+
+		measure(defaultCache, size, iterations, changed, domId);
+
+		setupDirectory(domId, cDirectoryRefBase, cBufferRefBase, size);
+
+		cout << std::fixed << std::setprecision(1)
+			 << setw(10) << size / 1024
+			 << setw(15) << first.avg() << setw(15) << first.percentile(99)
+			 << setw(16) << reopen.avg() << setw(16) << reopen.percentile(99)
+			 << setw(16) << cached.avg() << setw(16) << cached.percentile(99)
+			 << setw(17) << changed.avg() << setw(17) << changed.percentile(99)
+			 << endl;
+	}
+
+	return 0;
+}
+
+}
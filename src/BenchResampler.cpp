@@ -0,0 +1,154 @@
+/*
+ *  Resampler benchmark
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "Bench.hpp"
+
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+#include <getopt.h>
+
+#include "Resampler.hpp"
+
+using std::cout;
+using std::endl;
+using std::setw;
+using std::vector;
+
+using Dsp::Resampler;
+
+namespace Bench {
+
+/*******************************************************************************
+ * Resampler benchmark
+ *
+ * Resamples one second of a sine wave in period sized chunks and reports
+ * time per output frame for each quality.
+ ******************************************************************************/
+
+namespace {
+
+const uint32_t cRates[][2] =
+{
+	{44100, 48000},
+	{48000, 44100},
+	{16000, 48000},
+	{48000, 16000},
+};
+
+const Resampler::Quality cQualities[] =
+{
+	Resampler::Quality::FAST,
+	Resampler::Quality::MEDIUM,
+	Resampler::Quality::BEST,
+};
+
+}
+
+int benchResampler(int argc, char* argv[])
+{
+	int iterations = 20;
+	int numChannels = 2;
+	size_t periodFrames = 1024;
+	int opt = -1;
+
+	while((opt = getopt(argc, argv, "n:c:p:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'n':
+			iterations = std::stoi(optarg);
+			break;
+		case 'c':
+			numChannels = std::stoi(optarg);
+			break;
+		case 'p':
+			periodFrames = std::stoi(optarg);
+			break;
+		default:
+			cout << "Options: -n <iterations> -c <channels> "
+				 << "-p <period frames>" << endl;
+			return -1;
+		}
+	}
+
+	cout << "isa: " << Dsp::getKernels().isa
+		 << ", channels: " << numChannels << endl;
+
+	cout << setw(16) << "rate, Hz" << setw(10) << "quality"
+		 << setw(8) << "taps"
+		 << setw(14) << "min, ns/fr" << setw(14) << "avg, ns/fr"
+		 << endl;
+
+	for (auto& rates : cRates)
+	{
+		vector<float> input(rates[0] * numChannels);
+
+		for (uint32_t i = 0; i < rates[0]; i++)
+		{
+			for (int channel = 0; channel < numChannels; channel++)
+			{
+				input[i * numChannels + channel] =
+						0.5f * sin(2.0 * M_PI * 1000.0 * i / rates[0]);
+			}
+		}
+
+		for (auto quality : cQualities)
+		{
+			Resampler resampler(rates[0], rates[1], numChannels, quality);
+			vector<float> output;
+			Stats stats;
+
+			output.reserve(rates[1] * numChannels * 2);
+
+			for (int i = 0; i < iterations; i++)
+			{
+				output.clear();
+
+				auto start = now();
+
+				for (size_t pos = 0; pos < rates[0]; pos += periodFrames)
+				{
+					size_t count = std::min<size_t>(periodFrames,
+													rates[0] - pos);
+
+					resampler.process(&input[pos * numChannels], count,
+									  output);
+				}
+
+				stats.add(static_cast<double>(now() - start) /
+						  (output.size() / numChannels));
+			}
+
+			cout << std::fixed << std::setprecision(1)
+				 << setw(16) << (std::to_string(rates[0]) + "->" +
+								 std::to_string(rates[1]))
+				 << setw(10) << Resampler::getQualityName(quality)
+				 << setw(8) << resampler.getNumTaps()
+				 << setw(14) << stats.min() << setw(14) << stats.avg()
+				 << endl;
+		}
+	}
+
+	return 0;
+}
+
+}
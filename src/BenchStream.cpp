@@ -0,0 +1,543 @@
+/*
+ *  Stream benchmark
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "Bench.hpp"
+
+#include <iostream>
+
+#include <xen/be/Log.hpp>
+
+using std::cout;
+using std::endl;
+
+#ifdef WITH_MOCKBELIB
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <thread>
+
+#include <getopt.h>
+#include <time.h>
+
+#include <XenEvtchnMock.hpp>
+
+#include <xen/be/Exception.hpp>
+
+#include "NullPcm.hpp"
+#include "StreamRingBuffer.hpp"
+
+using std::atomic_bool;
+using std::map;
+using std::setw;
+using std::string;
+using std::thread;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
+
+using XenBackend::Exception;
+using XenBackend::Log;
+using XenBackend::XenGnttabBuffer;
+
+using SoundItf::StreamType;
+
+namespace Bench {
+
+/*******************************************************************************
+ * Stream benchmark
+ *
+ * Plays the frontend side of N frontends with M streams each. Requests are put
+ * into the stream rings and processed by StreamRingBuffer and CommandHandler
+ * on the ring threads as in the backend. Each stream repeats OPEN,
+ * TRIGGER START, WRITE (playback) or READ (capture) requests of one period,
+ * TRIGGER STOP and CLOSE. Latency is measured from putting the request into
+ * the ring until the response is seen by the frontend.
+ *
+ * The null pcm device either consumes and produces data at once ("null") or at
+ * the rate of the stream ("clock"). In the latter case each frontend sends one
+ * period per period time as a real frontend does.
+ *
+ * The grant mappings and event channels are provided by libxenbemock.
+ ******************************************************************************/
+
+namespace {
+
+const grant_ref_t cRingRefBase = 0x10000;
+const grant_ref_t cDirectoryRefBase = 0x100000;
+const grant_ref_t cBufferRefBase = 0x1000000;
+const evtchn_port_t cPortBase = 16;
+
+// grant references reserved for each stream
+const grant_ref_t cNumDirectoryRefs = 0x100;
+const grant_ref_t cNumBufferRefs = 0x10000;
+
+const uint32_t cRate = 48000;
+const uint8_t cNumChannels = 2;
+const uint32_t cFrameSize = 4;
+const uint32_t cNumPeriods = 4;
+
+const uint8_t cOperations[] =
+{
+	XENSND_OP_OPEN,
+	XENSND_OP_TRIGGER,
+	XENSND_OP_WRITE,
+	XENSND_OP_READ,
+	XENSND_OP_CLOSE,
+};
+
+const char* getOperationName(uint8_t operation)
+{
+	switch(operation)
+	{
+	case XENSND_OP_OPEN:
+		return "OPEN";
+	case XENSND_OP_TRIGGER:
+		return "TRIGGER";
+	case XENSND_OP_WRITE:
+		return "WRITE";
+	case XENSND_OP_READ:
+		return "READ";
+	case XENSND_OP_CLOSE:
+		return "CLOSE";
+	default:
+		return "UNKNOWN";
+	}
+}
+
+double getClockTime(clockid_t clock)
+{
+	timespec time {};
+
+	clock_gettime(clock, &time);
+
+	return time.tv_sec + time.tv_nsec / 1000000000.0;
+}
+
+/***************************************************************************//**
+ * Frontend side of one stream.
+ * @ingroup bench
+ ******************************************************************************/
+class StreamClient
+{
+public:
+
+	/**
+	 * @param bufferCache buffer cache of the frontend
+	 * @param type        stream type
+	 * @param domId       frontend domain id
+	 * @param index       index of the stream in the benchmark
+	 * @param periodSize  period size in bytes
+	 * @param realTime    send one period per period time
+	 */
+	StreamClient(BufferCachePtr bufferCache, StreamType type, domid_t domId,
+				 int index, uint32_t periodSize, bool realTime) :
+		mType(type),
+		mDomId(domId),
+		mPeriodSize(periodSize),
+		mRealTime(realTime),
+		mReqPort(cPortBase + 2 * index),
+		mDirectoryRef(cDirectoryRefBase + index * cNumDirectoryRefs),
+		mReqId(0),
+		mCpuTime(0)
+	{
+		grant_ref_t reqRef = cRingRefBase + 2 * index;
+		grant_ref_t evtRef = reqRef + 1;
+
+		setupDirectory(mDomId, mDirectoryRef,
+					   cBufferRefBase + index * cNumBufferRefs,
+					   mPeriodSize * cNumPeriods);
+
+		// the frontend initializes the rings before the backend binds them
+		mReqPage.reset(new XenGnttabBuffer(mDomId, reqRef));
+
+		auto sring = static_cast<xen_sndif_sring*>(mReqPage->get());
+
+		SHARED_RING_INIT(sring);
+		FRONT_RING_INIT(&mRing, sring, XC_PAGE_SIZE);
+
+		mEvtPage.reset(new XenGnttabBuffer(mDomId, evtRef));
+
+		memset(mEvtPage->get(), 0, XC_PAGE_SIZE);
+
+		string id = "bench" + to_string(index);
+
+		mEvtRingBuffer.reset(new EventRingBuffer(
+				mDomId, mReqPort + 1, evtRef, XENSND_IN_RING_OFFS,
+				XENSND_IN_RING_SIZE));
+
+		mReqRingBuffer.reset(new StreamRingBuffer(
+				id, SoundItf::PcmDevicePtr(new Null::NullPcm(type, realTime)),
+				mEvtRingBuffer, bufferCache, type,
+				{to_string(mDomId), "0", id}, mDomId, mReqPort, reqRef));
+
+		// each ring opens its own event channel handle
+		mEvtchn = XenEvtchnMock::getLastInstance();
+
+		mEvtRingBuffer->start();
+		mReqRingBuffer->start();
+	}
+
+	~StreamClient()
+	{
+		mReqRingBuffer->stop();
+		mEvtRingBuffer->stop();
+	}
+
+	/**
+	 * Runs the stream on the calling thread.
+	 * @param numCycles   number of OPEN/CLOSE cycles
+	 * @param numRequests number of WRITE or READ requests per cycle
+	 */
+	void run(int numCycles, int numRequests)
+	{
+		for (int i = 0; i < numCycles; i++)
+		{
+			runCycle(numRequests);
+		}
+
+		mCpuTime = getClockTime(CLOCK_THREAD_CPUTIME_ID);
+	}
+
+	/**
+	 * Returns latency of each operation in us.
+	 */
+	const map<uint8_t, Stats>& getLatencies() const { return mLatencies; }
+
+	/**
+	 * Returns CPU time of the frontend thread in seconds.
+	 */
+	double getCpuTime() const { return mCpuTime; }
+
+private:
+
+	StreamType mType;
+	domid_t mDomId;
+	uint32_t mPeriodSize;
+	bool mRealTime;
+	evtchn_port_t mReqPort;
+	grant_ref_t mDirectoryRef;
+	uint16_t mReqId;
+	double mCpuTime;
+
+	unique_ptr<XenGnttabBuffer> mReqPage;
+	unique_ptr<XenGnttabBuffer> mEvtPage;
+	xen_sndif_front_ring mRing;
+
+	EventRingBufferPtr mEvtRingBuffer;
+	unique_ptr<StreamRingBuffer> mReqRingBuffer;
+	XenEvtchnMock* mEvtchn;
+
+	map<uint8_t, Stats> mLatencies;
+
+	void runCycle(int numRequests)
+	{
+		xensnd_req req {};
+
+		req.operation = XENSND_OP_OPEN;
+		req.op.open.pcm_rate = cRate;
+		req.op.open.pcm_format = XENSND_PCM_FORMAT_S16_LE;
+		req.op.open.pcm_channels = cNumChannels;
+		req.op.open.buffer_sz = mPeriodSize * cNumPeriods;
+		req.op.open.period_sz = mPeriodSize;
+		req.op.open.gref_directory = mDirectoryRef;
+
+		send(req);
+
+		sendTrigger(XENSND_OP_TRIGGER_START);
+
+		auto period = duration_cast<steady_clock::duration>(
+				duration<double>(static_cast<double>(mPeriodSize) /
+								 (cRate * cFrameSize)));
+		auto next = steady_clock::now();
+
+		// capture data is read once the period is captured
+		if (mType == StreamType::CAPTURE)
+		{
+			next += period;
+		}
+
+		for (int i = 0; i < numRequests; i++)
+		{
+			if (mRealTime)
+			{
+				std::this_thread::sleep_until(next);
+
+				next += period;
+			}
+
+			req = {};
+
+			req.operation = mType == StreamType::PLAYBACK ?
+							XENSND_OP_WRITE : XENSND_OP_READ;
+			req.op.rw.offset = (i % cNumPeriods) * mPeriodSize;
+			req.op.rw.length = mPeriodSize;
+
+			send(req);
+		}
+
+		sendTrigger(XENSND_OP_TRIGGER_STOP);
+
+		req = {};
+
+		req.operation = XENSND_OP_CLOSE;
+
+		send(req);
+	}
+
+	void sendTrigger(uint8_t type)
+	{
+		xensnd_req req {};
+
+		req.operation = XENSND_OP_TRIGGER;
+		req.op.trigger.type = type;
+
+		send(req);
+	}
+
+	void send(xensnd_req& req)
+	{
+		int notify;
+
+		req.id = mReqId++;
+
+		auto start = now();
+
+		*RING_GET_REQUEST(&mRing, mRing.req_prod_pvt) = req;
+
+		mRing.req_prod_pvt++;
+
+		RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&mRing, notify);
+
+		if (notify)
+		{
+			mEvtchn->signalPort(mReqPort);
+		}
+
+		while(!RING_HAS_UNCONSUMED_RESPONSES(&mRing))
+		{
+			std::this_thread::yield();
+		}
+
+		xen_rmb();
+
+		auto rsp = *RING_GET_RESPONSE(&mRing, mRing.rsp_cons);
+
+		mRing.rsp_cons++;
+
+		mLatencies[req.operation].add((now() - start) / 1000.0);
+
+		// drain position events as the frontend does
+		auto evtPage = static_cast<xensnd_event_page*>(mEvtPage->get());
+
+		evtPage->in_cons = evtPage->in_prod;
+
+		if (rsp.status)
+		{
+			throw Exception(string("Request failed: ") +
+							getOperationName(req.operation), -rsp.status);
+		}
+	}
+};
+
+}
+
+int benchStream(int argc, char* argv[])
+{
+	domid_t domId = 1;
+	int numFrontends = 1;
+	int numPlayback = 2;
+	int numCapture = 2;
+	int numCycles = 10;
+	int numRequests = 100;
+	uint32_t periodFrames = 480;
+	bool realTime = false;
+	int opt = -1;
+
+	while((opt = getopt(argc, argv, "d:f:s:c:n:r:p:t:v:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'd':
+			domId = std::stoi(optarg);
+			break;
+		case 'f':
+			numFrontends = std::stoi(optarg);
+			break;
+		case 's':
+			numPlayback = std::stoi(optarg);
+			break;
+		case 'c':
+			numCapture = std::stoi(optarg);
+			break;
+		case 'n':
+			numCycles = std::stoi(optarg);
+			break;
+		case 'r':
+			numRequests = std::stoi(optarg);
+			break;
+		case 'p':
+			periodFrames = std::stoul(optarg);
+			break;
+		case 't':
+			if (string(optarg) != "null" && string(optarg) != "clock")
+			{
+				cout << "Unknown pcm device: " << optarg << endl;
+				return -1;
+			}
+
+			realTime = string(optarg) == "clock";
+			break;
+		case 'v':
+			Log::setLogMask(optarg);
+			break;
+		default:
+			cout << "Options: -d <first frontend dom id> -f <frontends> "
+				 << "-s <playback streams> -c <capture streams> "
+				 << "-n <cycles> -r <requests per cycle> "
+				 << "-p <period in frames> -t <null|clock>" << endl;
+			return -1;
+		}
+	}
+
+	vector<unique_ptr<StreamClient>> clients;
+
+	for (int i = 0; i < numFrontends; i++)
+	{
+		BufferCachePtr bufferCache(new BufferCache(domId + i));
+
+		for (int j = 0; j < numPlayback + numCapture; j++)
+		{
+			clients.emplace_back(new StreamClient(
+					bufferCache,
+					j < numPlayback ? StreamType::PLAYBACK : StreamType::CAPTURE,
+					domId + i, clients.size(), periodFrames * cFrameSize,
+					realTime));
+		}
+	}
+
+	atomic_bool failed(false);
+	vector<thread> threads;
+
+	auto cpuStart = getClockTime(CLOCK_PROCESS_CPUTIME_ID);
+	auto start = now();
+
+	for (auto& client : clients)
+	{
+		threads.emplace_back([&client, &failed, numCycles, numRequests]()
+		{
+			try
+			{
+				client->run(numCycles, numRequests);
+			}
+			catch(const std::exception& e)
+			{
+				LOG("Bench", ERROR) << e.what();
+
+				failed = true;
+			}
+		});
+	}
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	double elapsed = (now() - start) / 1000000000.0;
+	double cpuTime = getClockTime(CLOCK_PROCESS_CPUTIME_ID) - cpuStart;
+
+	if (failed)
+	{
+		return -1;
+	}
+
+	map<uint8_t, Stats> latencies;
+
+	for (auto& client : clients)
+	{
+		// the frontend threads are not part of the backend load
+		cpuTime -= client->getCpuTime();
+
+		for (auto& latency : client->getLatencies())
+		{
+			latencies[latency.first].merge(latency.second);
+		}
+	}
+
+	size_t numTotal = 0;
+
+	cout << setw(10) << "request" << setw(10) << "count"
+		 << setw(12) << "p50, us" << setw(12) << "p99, us"
+		 << setw(12) << "p99.9, us" << setw(12) << "max, us" << endl;
+
+	for (auto operation : cOperations)
+	{
+		auto& stats = latencies[operation];
+
+		if (!stats.count())
+		{
+			continue;
+		}
+
+		numTotal += stats.count();
+
+		cout << std::fixed << std::setprecision(1)
+			 << setw(10) << getOperationName(operation)
+			 << setw(10) << stats.count()
+			 << setw(12) << stats.percentile(50)
+			 << setw(12) << stats.percentile(99)
+			 << setw(12) << stats.percentile(99.9)
+			 << setw(12) << stats.percentile(100) << endl;
+	}
+
+	cout << std::fixed << std::setprecision(1)
+		 << "streams: " << clients.size()
+		 << ", requests/s: " << numTotal / elapsed
+		 << ", backend CPU per stream: "
+		 << std::max(cpuTime, 0.0) * 100.0 / elapsed / clients.size() << " %"
+		 << endl;
+
+	return 0;
+}
+
+}
+
+#else
+
+namespace Bench {
+
+int benchStream(int argc, char* argv[])
+{
+	cout << "Stream benchmark requires WITH_MOCKBELIB" << endl;
+
+	return -1;
+}
+
+}
+
+#endif
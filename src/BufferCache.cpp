@@ -0,0 +1,278 @@
+/*
+ *  Grant buffer cache
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "BufferCache.hpp"
+
+#include <algorithm>
+
+#include <sys/mman.h>
+
+#include <xen/io/sndif.h>
+
+#include "RealTime.hpp"
+
+using std::lock_guard;
+using std::min;
+using std::mutex;
+using std::unique_ptr;
+using std::vector;
+
+using XenBackend::XenGnttabBuffer;
+
+/*******************************************************************************
+ * BufferCache
+ ******************************************************************************/
+
+const size_t BufferCache::cNumGrefsPerPage =
+		(XC_PAGE_SIZE - offsetof(xensnd_page_directory, gref)) /
+		sizeof(grant_ref_t);
+
+const size_t BufferCache::cMaxChains = 64;
+
+BufferCache::BufferCache(domid_t domId, size_t maxEntries) :
+	mDomId(domId),
+	mMaxEntries(maxEntries),
+	mLog("BufferCache")
+{
+	LOG(mLog, DEBUG) << "Create buffer cache, dom: " << mDomId
+					 << ", max entries: " << mMaxEntries;
+}
+
+BufferCache::~BufferCache()
+{
+	invalidate();
+
+	LOG(mLog, DEBUG) << "Delete buffer cache, dom: " << mDomId;
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+GnttabBufferPtr BufferCache::get(grant_ref_t directory, uint32_t size)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	Entry newEntry {(static_cast<uint64_t>(directory) << 32) | size};
+
+	auto chain = mChains.find(newEntry.key);
+
+	if (chain != mChains.end() &&
+		getBufferRefsBatched(size, chain->second, newEntry.refs))
+	{
+		auto it = mIndex.find(newEntry.key);
+
+		if (it != mIndex.end())
+		{
+			auto entry = it->second;
+
+			if (entry->refs == newEntry.refs)
+			{
+				DLOG(mLog, DEBUG) << "Cache hit, directory: " << directory
+								  << ", size: " << size;
+
+				mEntries.splice(mEntries.begin(), mEntries, entry);
+
+				return entry->buffer;
+			}
+
+			DLOG(mLog, DEBUG) << "Buffer changed, directory: " << directory;
+		}
+	}
+	else
+	{
+		vector<grant_ref_t> directories;
+
+		getBufferRefs(directory, size, directories, newEntry.refs);
+
+		rememberChain(newEntry.key, std::move(directories));
+	}
+
+	erase(newEntry.key);
+
+	newEntry.buffer.reset(new XenGnttabBuffer(mDomId, newEntry.refs.data(),
+											  newEntry.refs.size(),
+											  PROT_READ | PROT_WRITE));
+
+	RealTime::prefault(newEntry.buffer->get(), newEntry.buffer->size());
+
+	auto buffer = newEntry.buffer;
+
+	if (mMaxEntries)
+	{
+		insert(std::move(newEntry));
+	}
+
+	return buffer;
+}
+
+void BufferCache::invalidate()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (!mEntries.empty())
+	{
+		LOG(mLog, DEBUG) << "Invalidate, dom: " << mDomId
+						 << ", entries: " << mEntries.size();
+	}
+
+	mIndex.clear();
+	mEntries.clear();
+	mChains.clear();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void BufferCache::getBufferRefs(grant_ref_t startDirectory, uint32_t size,
+								vector<grant_ref_t>& directories,
+								vector<grant_ref_t>& refs)
+{
+	directories.clear();
+	refs.clear();
+
+	size_t requestedNumGrefs = (size + XC_PAGE_SIZE - 1) / XC_PAGE_SIZE;
+
+	DLOG(mLog, DEBUG) << "Get buffer refs, directory: " << startDirectory
+					  << ", size: " << size
+					  << ", in grefs: " << requestedNumGrefs;
+
+	refs.reserve(requestedNumGrefs);
+
+	while(startDirectory != 0)
+	{
+		XenGnttabBuffer pageBuffer(mDomId, startDirectory, PROT_READ);
+
+		xensnd_page_directory* pageDirectory =
+				static_cast<xensnd_page_directory*>(pageBuffer.get());
+
+		size_t numGrefs = min(requestedNumGrefs, cNumGrefsPerPage);
+
+		DLOG(mLog, DEBUG) << "Gref address: " << pageDirectory->gref
+						  << ", numGrefs " << numGrefs;
+
+		directories.push_back(startDirectory);
+
+		refs.insert(refs.end(), pageDirectory->gref,
+					pageDirectory->gref + numGrefs);
+
+		requestedNumGrefs -= numGrefs;
+
+		startDirectory = pageDirectory->gref_dir_next_page;
+	}
+
+	DLOG(mLog, DEBUG) << "Get buffer refs, num refs: " << refs.size();
+}
+
+bool BufferCache::getBufferRefsBatched(uint32_t size,
+									   const vector<grant_ref_t>& directories,
+									   vector<grant_ref_t>& refs)
+{
+	refs.clear();
+
+	if (directories.empty())
+	{
+		return false;
+	}
+
+	size_t requestedNumGrefs = (size + XC_PAGE_SIZE - 1) / XC_PAGE_SIZE;
+
+	refs.reserve(requestedNumGrefs);
+
+	unique_ptr<XenGnttabBuffer> pageBuffer;
+
+	// the frontend may have revoked or reused the follow-up directory pages
+	try
+	{
+		pageBuffer.reset(new XenGnttabBuffer(mDomId, directories.data(),
+											 directories.size(), PROT_READ));
+	}
+	catch(const std::exception& e)
+	{
+		DLOG(mLog, DEBUG) << "Can't map directory chain: " << e.what();
+
+		return false;
+	}
+
+	for (size_t i = 0; i < directories.size(); i++)
+	{
+		auto pageDirectory = reinterpret_cast<xensnd_page_directory*>(
+				static_cast<uint8_t*>(pageBuffer->get()) + i * XC_PAGE_SIZE);
+
+		grant_ref_t expectedNext = i + 1 < directories.size() ?
+								   directories[i + 1] : 0;
+
+		// the frontend has rebuilt the directory: walk it again
+		if (pageDirectory->gref_dir_next_page != expectedNext)
+		{
+			DLOG(mLog, DEBUG) << "Directory chain changed at page: " << i;
+
+			return false;
+		}
+
+		size_t numGrefs = min(requestedNumGrefs, cNumGrefsPerPage);
+
+		refs.insert(refs.end(), pageDirectory->gref,
+					pageDirectory->gref + numGrefs);
+
+		requestedNumGrefs -= numGrefs;
+	}
+
+	DLOG(mLog, DEBUG) << "Get buffer refs batched, directories: "
+					  << directories.size() << ", num refs: " << refs.size();
+
+	return true;
+}
+
+void BufferCache::rememberChain(uint64_t key, vector<grant_ref_t>&& directories)
+{
+	if (mChains.size() >= cMaxChains && !mChains.count(key))
+	{
+		mChains.erase(mChains.begin());
+	}
+
+	mChains[key] = std::move(directories);
+}
+
+void BufferCache::insert(Entry&& entry)
+{
+	while (mEntries.size() >= mMaxEntries)
+	{
+		DLOG(mLog, DEBUG) << "Evict, directory: " << (mEntries.back().key >> 32);
+
+		mIndex.erase(mEntries.back().key);
+		mEntries.pop_back();
+	}
+
+	mEntries.push_front(std::move(entry));
+	mIndex[mEntries.front().key] = mEntries.begin();
+}
+
+void BufferCache::erase(uint64_t key)
+{
+	auto it = mIndex.find(key);
+
+	if (it != mIndex.end())
+	{
+		mEntries.erase(it->second);
+		mIndex.erase(it);
+	}
+}
@@ -0,0 +1,124 @@
+/*
+ *  Grant buffer cache
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_BUFFERCACHE_HPP_
+#define SRC_BUFFERCACHE_HPP_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <xen/be/Log.hpp>
+#include <xen/be/XenGnttab.hpp>
+
+typedef std::shared_ptr<XenBackend::XenGnttabBuffer> GnttabBufferPtr;
+
+/***************************************************************************//**
+ * Keeps shared buffers mapped across OPEN/CLOSE cycles.
+ *
+ * The cache is useful only for frontends which reuse the grant references of
+ * the buffer on the next OPEN. A frontend which frees the buffer on CLOSE
+ * can't end foreign access to the pages while they are cached, so the pages
+ * stay pinned in the guest until the entry is evicted or invalidated. For
+ * this reason the cache is disabled (0 entries) by default.
+ *
+ * Buffers are keyed by the page directory reference and the buffer size.
+ * The page directory is read on each request and the cached mapping is used
+ * only if it contains the same grant references, so a reused directory
+ * reference never returns a stale mapping. Least recently used buffers are
+ * unmapped when the cache is full. A buffer which is evicted while a stream
+ * still uses it is unmapped when the stream releases it.
+ *
+ * The page directory is a linked list of pages, so the first walk maps its
+ * pages one by one. The discovered chain of directory references is
+ * remembered even if the buffer itself is not cached (up to cMaxChains
+ * chains): next OPEN maps all directory pages with one batched grant map
+ * operation and verifies the links against the chain. If the chain can't be
+ * mapped or its links differ, the directory is walked again. The chain holds
+ * grant references only, so remembering it doesn't pin guest pages.
+ * @ingroup snd_be
+ ******************************************************************************/
+class BufferCache
+{
+public:
+
+	/**
+	 * @param domId      frontend domain id
+	 * @param maxEntries max number of cached buffers
+	 */
+	BufferCache(domid_t domId, size_t maxEntries = 0);
+	~BufferCache();
+
+	/**
+	 * Returns mapped buffer described by the page directory.
+	 * @param directory first page directory reference
+	 * @param size      buffer size
+	 */
+	GnttabBufferPtr get(grant_ref_t directory, uint32_t size);
+
+	/**
+	 * Unmaps all cached buffers. Should be called when the frontend
+	 * disconnects.
+	 */
+	void invalidate();
+
+private:
+
+	struct Entry
+	{
+		uint64_t key;
+		std::vector<grant_ref_t> refs;
+		GnttabBufferPtr buffer;
+	};
+
+	typedef std::list<Entry> EntryList;
+
+	static const size_t cNumGrefsPerPage;
+	static const size_t cMaxChains;
+
+	domid_t mDomId;
+	size_t mMaxEntries;
+
+	EntryList mEntries;
+	std::unordered_map<uint64_t, EntryList::iterator> mIndex;
+	// directory chains of the buffers which have been opened
+	std::unordered_map<uint64_t, std::vector<grant_ref_t>> mChains;
+
+	std::mutex mMutex;
+
+	XenBackend::Log mLog;
+
+	void getBufferRefs(grant_ref_t startDirectory, uint32_t size,
+					   std::vector<grant_ref_t>& directories,
+					   std::vector<grant_ref_t>& refs);
+	bool getBufferRefsBatched(uint32_t size,
+							  const std::vector<grant_ref_t>& directories,
+							  std::vector<grant_ref_t>& refs);
+	void rememberChain(uint64_t key, std::vector<grant_ref_t>&& directories);
+	void insert(Entry&& entry);
+	void erase(uint64_t key);
+};
+
+typedef std::shared_ptr<BufferCache> BufferCachePtr;
+
+#endif /* SRC_BUFFERCACHE_HPP_ */
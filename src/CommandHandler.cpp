@@ -20,32 +20,22 @@
 
 #include "CommandHandler.hpp"
 
-#include <sys/mman.h>
-
 #include <errno.h>
 
 #include <xen/be/Exception.hpp>
 
-#ifdef WITH_ALSA
-#include "AlsaPcm.hpp"
-#endif
-
-#ifdef WITH_PULSE
-#include "PulsePcm.hpp"
-#endif
+#include "Trace.hpp"
 
 using std::bind;
-using std::min;
+using std::chrono::milliseconds;
 using std::out_of_range;
-using std::vector;
 using std::unordered_map;
 
 using namespace std::placeholders;
 
-using XenBackend::XenGnttabBuffer;
-
 using SoundItf::PcmDevicePtr;
 using SoundItf::PcmParams;
+using SoundItf::StreamType;
 
 unordered_map<int, CommandHandler::CommandFn> CommandHandler::sCmdTable =
 {
@@ -63,20 +53,47 @@ unordered_map<int, CommandHandler::CommandFn> CommandHandler::sCmdTable =
 
 CommandHandler::CommandHandler(PcmDevicePtr pcmDevice,
 							   EventRingBufferPtr eventRingBuffer,
-							   domid_t domId) :
+							   BufferCachePtr bufferCache,
+							   StreamStats& stats,
+							   const Metrics::Labels& labels,
+							   StreamType type, domid_t domId,
+							   milliseconds posInterval) :
 	mPcmDevice(pcmDevice),
 	mDomId(domId),
-	mEventRingBuffer(eventRingBuffer),
-	mEventId(0),
+	mPositionNotifier(eventRingBuffer, posInterval),
+	mBufferCache(bufferCache),
+	mStats(stats),
+	mOpened(false),
+	mPaused(false),
+	mNumRequests(std::make_shared<Metrics::Metric>()),
+	mNumErrors(std::make_shared<Metrics::Metric>()),
+	mNumCoalesced(std::make_shared<Metrics::Metric>()),
+	mNumRingFull(std::make_shared<Metrics::Metric>()),
 	mLog("CommandHandler")
 {
+	publishMetrics(labels);
+
 	pcmDevice->setProgressCbk(bind(&CommandHandler::progressCbk, this, _1));
 
+	if (type == StreamType::PLAYBACK)
+	{
+		mPlaybackWorker.reset(new PlaybackWorker(mPcmDevice, mStats));
+	}
+
 	LOG(mLog, DEBUG) << "Create command handler, dom: " << mDomId;
 }
 
 CommandHandler::~CommandHandler()
 {
+	try
+	{
+		dropPlayback();
+	}
+	catch(const std::exception& e)
+	{
+		DLOG(mLog, DEBUG) << e.what();
+	}
+
 	LOG(mLog, DEBUG) << "Delete command handler, dom: " << mDomId;
 }
 
@@ -121,6 +138,13 @@ int CommandHandler::processCommand(const xensnd_req& req, xensnd_resp& rsp)
 
 	DLOG(mLog, DEBUG) << "Return status: [" << status << "]";
 
+	mNumRequests->inc();
+
+	if (status)
+	{
+		mNumErrors->inc();
+	}
+
 	return status;
 }
 
@@ -130,11 +154,12 @@ int CommandHandler::processCommand(const xensnd_req& req, xensnd_resp& rsp)
 
 void CommandHandler::progressCbk(uint64_t frame)
 {
-	xensnd_evt event = { .id = mEventId++, .type = XENSND_EVT_CUR_POS };
+	mStats.recordProgress();
 
-	event.op.cur_pos.position = frame;
+	mPositionNotifier.update(frame);
 
-	mEventRingBuffer->sendEvent(event);
+	mNumCoalesced->set(mPositionNotifier.getNumCoalesced());
+	mNumRingFull->set(mPositionNotifier.getNumRingFull());
 }
 
 void CommandHandler::open(const xensnd_req& req, xensnd_resp& rsp)
@@ -143,25 +168,57 @@ void CommandHandler::open(const xensnd_req& req, xensnd_resp& rsp)
 
 	const xensnd_open_req& openReq = req.op.open;
 
-	vector<grant_ref_t> refs;
+	mBuffer = mBufferCache->get(openReq.gref_directory, openReq.buffer_sz);
 
-	getBufferRefs(openReq.gref_directory, openReq.buffer_sz, refs);
+	if (mPlaybackWorker)
+	{
+		mPlaybackWorker->setBuffer(static_cast<uint8_t*>(mBuffer->get()),
+								   openReq.buffer_sz);
+	}
+
+	mPaused = false;
+
+	mPositionNotifier.reset(openReq.period_sz);
+
+	mStats.resetProgress();
 
-	mBuffer.reset(new XenGnttabBuffer(mDomId, refs.data(), refs.size(),
-									  PROT_READ | PROT_WRITE));
+	TRACE_SCOPE("PcmDevice::open");
 
 	mPcmDevice->open( {openReq.pcm_rate, openReq.pcm_format,
 					   openReq.pcm_channels, openReq.buffer_sz,
 					   openReq.period_sz } );
+
+	mOpened = true;
 }
 
 void CommandHandler::close(const xensnd_req& req, xensnd_resp& rsp)
 {
 	DLOG(mLog, DEBUG) << "Handle command [CLOSE]";
 
-	mBuffer.reset();
+	if (mPlaybackWorker)
+	{
+		// paused device doesn't consume data: pending writes would never end
+		if (mPaused)
+		{
+			dropPlayback();
+		}
+		else
+		{
+			mPlaybackWorker->flush();
+		}
+
+		mPlaybackWorker->setBuffer(nullptr, 0);
+	}
+
+	mOpened = false;
+	mPaused = false;
 
+	TRACE_SCOPE("PcmDevice::close");
+
+	// the device may still access the buffer until it is closed
 	mPcmDevice->close();
+
+	mBuffer.reset();
 }
 
 void CommandHandler::read(const xensnd_req& req, xensnd_resp& rsp)
@@ -170,8 +227,14 @@ void CommandHandler::read(const xensnd_req& req, xensnd_resp& rsp)
 
 	const xensnd_rw_req& readReq = req.op.rw;
 
+	TRACE_SCOPE_ARG("PcmDevice::read", readReq.length);
+
+	auto start = StreamStats::Clock::now();
+
 	mPcmDevice->read(&(static_cast<uint8_t*>(mBuffer->get())[readReq.offset]),
 					 readReq.length);
+
+	mStats.recordDeviceIo(start);
 }
 
 void CommandHandler::write(const xensnd_req& req, xensnd_resp& rsp)
@@ -180,31 +243,59 @@ void CommandHandler::write(const xensnd_req& req, xensnd_resp& rsp)
 
 	const xensnd_rw_req& writeReq = req.op.rw;
 
-	mPcmDevice->write(&(static_cast<uint8_t*>(mBuffer->get())[writeReq.offset]),
-					  writeReq.length);
+	if (!mPlaybackWorker)
+	{
+		throw XenBackend::Exception("Write to capture stream", EINVAL);
+	}
+
+	mPlaybackWorker->queue(writeReq.offset, writeReq.length);
 }
 
 void CommandHandler::trigger(const xensnd_req& req, xensnd_resp& rsp)
 {
 	const xensnd_trigger_req& triggerReq = req.op.trigger;
 
+	TRACE_SCOPE_ARG("PcmDevice::trigger", triggerReq.type);
+
 	switch(triggerReq.type)
 	{
 	case XENSND_OP_TRIGGER_START:
 		DLOG(mLog, DEBUG) << "Handle command [TRIGGER][START]";
+
+		// prefilled data should reach the device before it is started
+		if (mPlaybackWorker)
+		{
+			mPlaybackWorker->flush();
+		}
+
+		mStats.resetProgress();
 		mPcmDevice->start();
+		mPaused = false;
 		break;
 	case XENSND_OP_TRIGGER_PAUSE:
 		DLOG(mLog, DEBUG) << "Handle command [TRIGGER][PAUSE]";
 		mPcmDevice->pause();
+		mPaused = true;
 		break;
 	case XENSND_OP_TRIGGER_STOP:
 		DLOG(mLog, DEBUG) << "Handle command [TRIGGER][STOP]";
-		mPcmDevice->stop();
+
+		if (mPlaybackWorker)
+		{
+			dropPlayback();
+		}
+		else
+		{
+			mPcmDevice->stop();
+		}
+
+		mPaused = false;
 		break;
 	case XENSND_OP_TRIGGER_RESUME:
 		DLOG(mLog, DEBUG) << "Handle command [TRIGGER][RESUME]";
+		mStats.resetProgress();
 		mPcmDevice->resume();
+		mPaused = false;
 		break;
 	default:
 		throw XenBackend::Exception("Unknown trigger type", -EINVAL);
@@ -234,7 +325,11 @@ void CommandHandler::queryHwParam(const xensnd_req& req, xensnd_resp& rsp)
 	sndReq.period.min = queryHwParamReq.period.min;
 	sndReq.period.max = queryHwParamReq.period.max;
 
-	mPcmDevice->queryHwRanges(sndReq, sndResp);
+	{
+		TRACE_SCOPE("PcmDevice::queryHwRanges");
+
+		mPcmDevice->queryHwRanges(sndReq, sndResp);
+	}
 
 	queryHwParamResp.formats = sndResp.formats;
 
@@ -251,40 +346,47 @@ void CommandHandler::queryHwParam(const xensnd_req& req, xensnd_resp& rsp)
 	queryHwParamResp.period.max = sndResp.period.max;
 }
 
-void CommandHandler::getBufferRefs(grant_ref_t startDirectory, uint32_t size,
-								   vector<grant_ref_t>& refs)
+void CommandHandler::dropPlayback()
 {
-	refs.clear();
-
-	size_t requestedNumGrefs = (size + XC_PAGE_SIZE - 1) / XC_PAGE_SIZE;
-
-	DLOG(mLog, DEBUG) << "Get buffer refs, directory: " << startDirectory
-					  << ", size: " << size
-					  << ", in grefs: " << requestedNumGrefs;
-
-
-	while(startDirectory != 0)
+	if (!mPlaybackWorker)
 	{
+		return;
+	}
 
-		XenGnttabBuffer pageBuffer(mDomId, startDirectory);
-
-		xensnd_page_directory* pageDirectory =
-				static_cast<xensnd_page_directory*>(pageBuffer.get());
-
-		size_t numGrefs = min(requestedNumGrefs, (XC_PAGE_SIZE -
-							  offsetof(xensnd_page_directory, gref)) /
-							  sizeof(uint32_t));
+	mPlaybackWorker->cancel();
 
-		DLOG(mLog, DEBUG) << "Gref address: " << pageDirectory->gref
-						  << ", numGrefs " << numGrefs;
+	// closed device may still drain the tail: it must not be stopped
+	if (!mOpened)
+	{
+		mPlaybackWorker->waitIdle();
 
-		refs.insert(refs.end(), pageDirectory->gref,
-					pageDirectory->gref + numGrefs);
+		return;
+	}
 
-		requestedNumGrefs -= numGrefs;
+	// stopping the device releases the write in progress
+	mPcmDevice->stop();
 
-		startDirectory = pageDirectory->gref_dir_next_page;
+	if (mPlaybackWorker->waitIdle())
+	{
+		// drop the data the cancelled write has put after the stop
+		mPcmDevice->stop();
 	}
+}
 
-	DLOG(mLog, DEBUG) << "Get buffer refs, num refs: " << refs.size();
+void CommandHandler::publishMetrics(const Metrics::Labels& labels)
+{
+	auto& registry = Metrics::Registry::getInstance();
+
+	registry.add("snd_be_stream_requests_total",
+				 "Number of requests processed",
+				 Metrics::Registry::Type::COUNTER, labels, mNumRequests);
+	registry.add("snd_be_stream_request_errors_total",
+				 "Number of requests completed with error",
+				 Metrics::Registry::Type::COUNTER, labels, mNumErrors);
+	registry.add("snd_be_stream_positions_coalesced_total",
+				 "Number of position events which were not sent",
+				 Metrics::Registry::Type::COUNTER, labels, mNumCoalesced);
+	registry.add("snd_be_stream_event_ring_full_total",
+				 "Number of times the event ring was found full",
+				 Metrics::Registry::Type::COUNTER, labels, mNumRingFull);
 }
@@ -21,42 +21,20 @@
 #ifndef SRC_COMMANDHANDLER_HPP_
 #define SRC_COMMANDHANDLER_HPP_
 
+#include <chrono>
 #include <cstdint>
 #include <memory>
 #include <unordered_map>
-#include <vector>
 
 #include <xen/be/Log.hpp>
-#include <xen/be/RingBufferBase.hpp>
-#include <xen/be/XenGnttab.hpp>
 
 #include <xen/io/sndif.h>
 
+#include "BufferCache.hpp"
+#include "PlaybackWorker.hpp"
+#include "PositionNotifier.hpp"
 #include "SoundItf.hpp"
-
-/***************************************************************************//**
- * Ring buffer used to send events to the frontend.
- * @ingroup snd_be
- ******************************************************************************/
-class EventRingBuffer : public XenBackend::RingBufferOutBase<
-		xensnd_event_page, xensnd_evt>
-{
-public:
-	/**
-	 * @param domId     frontend domain id
-	 * @param port      event channel port number
-	 * @param ref       grant table reference
-	 * @param offset    start of the ring buffer inside the page
-	 * @param size      size of the ring buffer
-	 */
-	EventRingBuffer(domid_t domId, evtchn_port_t port,
-					grant_ref_t ref, int offset, size_t size) :
-		RingBufferOutBase<xensnd_event_page, xensnd_evt>(domId, port, ref,
-														 offset, size) {}
-};
-
-typedef std::shared_ptr<EventRingBuffer> EventRingBufferPtr;
-
+#include "StreamStats.hpp"
 
 /***************************************************************************//**
  * Handles commands received from the frontend.
@@ -67,11 +45,23 @@ class CommandHandler
 public:
 
 	/**
-	 * @param type  Alsa stream type
-	 * @param domId domain id
+	 * @param pcmDevice       pcm device
+	 * @param eventRingBuffer event ring buffer
+	 * @param bufferCache     cache of mapped buffers
+	 * @param stats           stream statistics
+	 * @param labels          metric labels of the stream
+	 * @param type            stream type
+	 * @param domId           domain id
+	 * @param posInterval     min interval between position events
 	 */
 	CommandHandler(SoundItf::PcmDevicePtr pcmDevice,
-				   EventRingBufferPtr eventRingBuffer, domid_t domId);
+				   EventRingBufferPtr eventRingBuffer,
+				   BufferCachePtr bufferCache,
+				   StreamStats& stats,
+				   const Metrics::Labels& labels,
+				   SoundItf::StreamType type, domid_t domId,
+				   std::chrono::milliseconds posInterval =
+						   std::chrono::milliseconds(0));
 	~CommandHandler();
 
 	/**
@@ -89,9 +79,18 @@ private:
 
 	SoundItf::PcmDevicePtr mPcmDevice;
 	domid_t mDomId;
-	EventRingBufferPtr mEventRingBuffer;
-	std::unique_ptr<XenBackend::XenGnttabBuffer> mBuffer;
-	uint16_t mEventId;
+	PositionNotifier mPositionNotifier;
+	BufferCachePtr mBufferCache;
+	GnttabBufferPtr mBuffer;
+	StreamStats& mStats;
+	std::unique_ptr<PlaybackWorker> mPlaybackWorker;
+	bool mOpened;
+	bool mPaused;
+
+	Metrics::MetricPtr mNumRequests;
+	Metrics::MetricPtr mNumErrors;
+	Metrics::MetricPtr mNumCoalesced;
+	Metrics::MetricPtr mNumRingFull;
 
 	XenBackend::Log mLog;
 
@@ -104,7 +103,8 @@ private:
 	void trigger(const xensnd_req& req, xensnd_resp& rsp);
 	void queryHwParam(const xensnd_req& req, xensnd_resp& rsp);
 
-	void getBufferRefs(grant_ref_t startDirectory, uint32_t size, std::vector<grant_ref_t>& refs);
+	void dropPlayback();
+	void publishMetrics(const Metrics::Labels& labels);
 };
 
 #endif /* SRC_COMMANDHANDLER_HPP_ */
@@ -0,0 +1,556 @@
+/*
+ *  File pcm device
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "FilePcm.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <xen/be/Exception.hpp>
+#include <xen/io/sndif.h>
+
+#include "FormatConverter.hpp"
+
+using std::min;
+using std::string;
+using std::vector;
+
+using XenBackend::Exception;
+
+using SoundItf::PcmParamRanges;
+using SoundItf::PcmParams;
+using SoundItf::StreamType;
+
+using Dsp::FormatConverter;
+
+namespace File {
+
+namespace {
+
+const uint16_t cTagPcm = 1;
+const uint16_t cTagFloat = 3;
+const uint16_t cTagAlaw = 6;
+const uint16_t cTagMulaw = 7;
+const uint16_t cTagExtensible = 0xFFFE;
+
+const size_t cHeaderSize = 44;
+
+struct WavFormat
+{
+	uint8_t format;
+	uint16_t tag;
+	uint16_t bits;
+};
+
+// sndif formats which are stored in WAV files as is
+const WavFormat cWavFormats[] =
+{
+	{XENSND_PCM_FORMAT_U8,     cTagPcm,    8},
+	{XENSND_PCM_FORMAT_S16_LE, cTagPcm,   16},
+	{XENSND_PCM_FORMAT_S32_LE, cTagPcm,   32},
+	{XENSND_PCM_FORMAT_F32_LE, cTagFloat, 32},
+	{XENSND_PCM_FORMAT_F64_LE, cTagFloat, 64},
+	{XENSND_PCM_FORMAT_A_LAW,  cTagAlaw,   8},
+	{XENSND_PCM_FORMAT_MU_LAW, cTagMulaw,  8},
+};
+
+bool isWavFile(const string& fileName)
+{
+	string ext = ".wav";
+
+	if (fileName.size() < ext.size())
+	{
+		return false;
+	}
+
+	return strcasecmp(fileName.c_str() + fileName.size() - ext.size(),
+					  ext.c_str()) == 0;
+}
+
+uint64_t getWavFormats()
+{
+	uint64_t formats = 0;
+
+	for (auto& wavFormat : cWavFormats)
+	{
+		formats |= 1ull << wavFormat.format;
+	}
+
+	return formats;
+}
+
+const WavFormat& getWavFormat(uint8_t format)
+{
+	for (auto& wavFormat : cWavFormats)
+	{
+		if (wavFormat.format == format)
+		{
+			return wavFormat;
+		}
+	}
+
+	throw Exception("Format is not supported by WAV: " +
+					std::to_string(format), EINVAL);
+}
+
+void putLe(uint8_t* data, uint32_t value, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		data[i] = value >> (8 * i);
+	}
+}
+
+uint32_t getLe(const uint8_t* data, size_t size)
+{
+	uint32_t value = 0;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		value |= static_cast<uint32_t>(data[i]) << (8 * i);
+	}
+
+	return value;
+}
+
+bool readAll(int fd, uint8_t* data, size_t size)
+{
+	while(size)
+	{
+		auto ret = ::read(fd, data, size);
+
+		if (ret < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (ret < 0)
+		{
+			throw Exception("Can't read file", errno);
+		}
+
+		if (ret == 0)
+		{
+			return false;
+		}
+
+		data += ret;
+		size -= ret;
+	}
+
+	return true;
+}
+
+}
+
+/*******************************************************************************
+ * FilePcm
+ ******************************************************************************/
+
+FilePcm::FilePcm(StreamType type, const string& fileName, bool realTime) :
+	NullPcm(type, realTime),
+	mFileName(fileName),
+	mIsWav(isWavFile(fileName)),
+	mFd(-1),
+	mBufferPos(0),
+	mBufferEnd(0),
+	mDataSize(0),
+	mLog("FilePcm")
+{
+	LOG(mLog, DEBUG) << "Create pcm device: " << mFileName;
+}
+
+FilePcm::~FilePcm()
+{
+	finish();
+	release();
+
+	LOG(mLog, DEBUG) << "Delete pcm device: " << mFileName;
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void FilePcm::queryHwRanges(PcmParamRanges& req, PcmParamRanges& resp)
+{
+	if (!mIsWav)
+	{
+		NullPcm::queryHwRanges(req, resp);
+
+		return;
+	}
+
+	resp = req;
+
+	if (mType == StreamType::PLAYBACK)
+	{
+		resp.formats = req.formats & getWavFormats();
+
+		return;
+	}
+
+	// the samples of the file are offered as they are
+	int fd = openFile();
+	uint64_t dataSize;
+	PcmParams params;
+
+	try
+	{
+		params = readHeader(fd, dataSize);
+	}
+	catch(const std::exception& e)
+	{
+		::close(fd);
+
+		throw;
+	}
+
+	::close(fd);
+
+	resp.formats = 1ull << params.format;
+	resp.rates.min = resp.rates.max = params.rate;
+	resp.channels.min = resp.channels.max = params.numChannels;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void FilePcm::openData(const PcmParams& params)
+{
+	finish();
+	release();
+
+	mFd = openFile();
+
+	mBuffer.resize(cBufferSize);
+	mBufferPos = 0;
+	mBufferEnd = 0;
+	mDataSize = 0;
+
+	try
+	{
+		if (mType == StreamType::PLAYBACK)
+		{
+			if (mIsWav)
+			{
+				// the sizes are set on close
+				writeHeader(params, 0);
+			}
+		}
+		else if (mIsWav)
+		{
+			auto fileParams = readHeader(mFd, mDataSize);
+
+			if (fileParams.format != params.format ||
+				fileParams.rate != params.rate ||
+				fileParams.numChannels != params.numChannels)
+			{
+				throw Exception("Parameters don't match file: " + mFileName,
+								EINVAL);
+			}
+		}
+		else
+		{
+			mDataSize = UINT64_MAX;
+		}
+	}
+	catch(const std::exception& e)
+	{
+		release();
+
+		throw;
+	}
+
+	LOG(mLog, DEBUG) << "Open file: " << mFileName;
+}
+
+void FilePcm::closeData()
+{
+	finish();
+	release();
+
+	LOG(mLog, DEBUG) << "Close file: " << mFileName;
+}
+
+void FilePcm::readData(uint8_t* buffer, size_t size)
+{
+	while(size)
+	{
+		if (mBufferPos == mBufferEnd)
+		{
+			ssize_t ret = 0;
+
+			if (mDataSize)
+			{
+				do
+				{
+					ret = ::read(mFd, mBuffer.data(),
+								 min<uint64_t>(mBuffer.size(), mDataSize));
+				}
+				while(ret < 0 && errno == EINTR);
+			}
+
+			if (ret < 0)
+			{
+				throw Exception("Can't read file: " + mFileName, errno);
+			}
+
+			if (ret == 0)
+			{
+				DLOG(mLog, DEBUG) << "End of file: " << mFileName;
+
+				FormatConverter::fillSilence(mParams.format, buffer, size);
+
+				return;
+			}
+
+			mBufferPos = 0;
+			mBufferEnd = ret;
+			mDataSize -= ret;
+		}
+
+		auto count = min(size, mBufferEnd - mBufferPos);
+
+		memcpy(buffer, &mBuffer[mBufferPos], count);
+
+		mBufferPos += count;
+		buffer += count;
+		size -= count;
+	}
+}
+
+void FilePcm::writeData(const uint8_t* buffer, size_t size)
+{
+	while(size)
+	{
+		auto count = min(size, mBuffer.size() - mBufferPos);
+
+		memcpy(&mBuffer[mBufferPos], buffer, count);
+
+		mBufferPos += count;
+		mDataSize += count;
+		buffer += count;
+		size -= count;
+
+		if (mBufferPos == mBuffer.size())
+		{
+			flush();
+		}
+	}
+}
+
+int FilePcm::openFile()
+{
+	int fd;
+
+	if (mType == StreamType::PLAYBACK)
+	{
+		fd = ::open(mFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					0644);
+	}
+	else
+	{
+		fd = ::open(mFileName.c_str(), O_RDONLY | O_CLOEXEC);
+	}
+
+	if (fd < 0)
+	{
+		throw Exception("Can't open file: " + mFileName, errno);
+	}
+
+	return fd;
+}
+
+PcmParams FilePcm::readHeader(int fd, uint64_t& dataSize)
+{
+	uint8_t header[40];
+	PcmParams params {};
+	bool hasFormat = false;
+
+	if (!readAll(fd, header, 12) || memcmp(header, "RIFF", 4) ||
+		memcmp(&header[8], "WAVE", 4))
+	{
+		throw Exception("Not a WAV file: " + mFileName, EINVAL);
+	}
+
+	while(readAll(fd, header, 8))
+	{
+		uint32_t chunkSize = getLe(&header[4], 4);
+
+		if (memcmp(header, "data", 4) == 0)
+		{
+			if (!hasFormat)
+			{
+				throw Exception("No format chunk: " + mFileName, EINVAL);
+			}
+
+			// streamed files have no valid size: read until end of file
+			dataSize = chunkSize && chunkSize != UINT32_MAX ?
+					   chunkSize : UINT64_MAX;
+
+			return params;
+		}
+
+		off_t skip = chunkSize + (chunkSize & 1);
+
+		if (memcmp(header, "fmt ", 4) == 0)
+		{
+			size_t size = min<size_t>(chunkSize, sizeof(header));
+
+			if (size < 16 || !readAll(fd, header, size))
+			{
+				throw Exception("Invalid format chunk: " + mFileName, EINVAL);
+			}
+
+			skip -= size;
+
+			uint16_t tag = getLe(&header[0], 2);
+			uint16_t bits = getLe(&header[14], 2);
+
+			if (tag == cTagExtensible && size >= 26)
+			{
+				// the tag is the first field of the sub format GUID
+				tag = getLe(&header[24], 2);
+			}
+
+			params.numChannels = getLe(&header[2], 2);
+			params.rate = getLe(&header[4], 4);
+
+			bool found = false;
+
+			for (auto& wavFormat : cWavFormats)
+			{
+				if (wavFormat.tag == tag && wavFormat.bits == bits)
+				{
+					params.format = wavFormat.format;
+					found = true;
+				}
+			}
+
+			if (!found || !params.numChannels || !params.rate)
+			{
+				throw Exception("Unsupported WAV format: " + mFileName,
+								EINVAL);
+			}
+
+			hasFormat = true;
+		}
+
+		if (lseek(fd, skip, SEEK_CUR) < 0)
+		{
+			throw Exception("Can't seek file: " + mFileName, errno);
+		}
+	}
+
+	throw Exception("No data chunk: " + mFileName, EINVAL);
+}
+
+void FilePcm::writeHeader(const PcmParams& params, uint64_t dataSize)
+{
+	auto& wavFormat = getWavFormat(params.format);
+	uint32_t blockAlign = params.numChannels * wavFormat.bits / 8;
+	uint32_t size = min<uint64_t>(dataSize, UINT32_MAX - cHeaderSize);
+
+	uint8_t header[cHeaderSize] {};
+
+	memcpy(&header[0], "RIFF", 4);
+	putLe(&header[4], cHeaderSize - 8 + size, 4);
+	memcpy(&header[8], "WAVE", 4);
+	memcpy(&header[12], "fmt ", 4);
+	putLe(&header[16], 16, 4);
+	putLe(&header[20], wavFormat.tag, 2);
+	putLe(&header[22], params.numChannels, 2);
+	putLe(&header[24], params.rate, 4);
+	putLe(&header[28], params.rate * blockAlign, 4);
+	putLe(&header[32], blockAlign, 2);
+	putLe(&header[34], wavFormat.bits, 2);
+	memcpy(&header[36], "data", 4);
+	putLe(&header[40], size, 4);
+
+	if (pwrite(mFd, header, sizeof(header), 0) != sizeof(header) ||
+		lseek(mFd, sizeof(header), SEEK_SET) < 0)
+	{
+		throw Exception("Can't write file: " + mFileName, errno);
+	}
+}
+
+void FilePcm::flush()
+{
+	size_t offset = 0;
+
+	while(offset < mBufferPos)
+	{
+		auto ret = ::write(mFd, &mBuffer[offset], mBufferPos - offset);
+
+		if (ret < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (ret < 0)
+		{
+			throw Exception("Can't write file: " + mFileName, errno);
+		}
+
+		offset += ret;
+	}
+
+	mBufferPos = 0;
+}
+
+void FilePcm::finish()
+{
+	if (mFd < 0 || mType != StreamType::PLAYBACK)
+	{
+		return;
+	}
+
+	try
+	{
+		flush();
+
+		if (mIsWav)
+		{
+			writeHeader(mParams, mDataSize);
+		}
+	}
+	catch(const std::exception& e)
+	{
+		LOG(mLog, ERROR) << e.what();
+	}
+}
+
+void FilePcm::release()
+{
+	if (mFd >= 0)
+	{
+		::close(mFd);
+	}
+
+	mFd = -1;
+}
+
+}
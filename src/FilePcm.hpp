@@ -0,0 +1,107 @@
+/*
+ *  File pcm device
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_FILEPCM_HPP_
+#define SRC_FILEPCM_HPP_
+
+#include <string>
+#include <vector>
+
+#include <xen/be/Log.hpp>
+
+#include "NullPcm.hpp"
+
+namespace File {
+
+/***************************************************************************//**
+ * @defgroup file
+ * File device related classes.
+ ******************************************************************************/
+
+/***************************************************************************//**
+ * Pcm device which plays to a file and captures from a file.
+ *
+ * The clock and the position reports are the ones of the null device, so the
+ * file is played and captured either at the stream rate or as fast as
+ * possible. Files with .wav extension are in WAV format, other files contain
+ * raw samples. Playback truncates the file on each open. Capture of a WAV
+ * file offers the format, rate and channels of the file only: the processing
+ * device converts the samples to the frontend parameters. Capture after the
+ * end of the file produces silence.
+ *
+ * The file is accessed through a buffer of cBufferSize bytes, so the device
+ * makes one system call per buffer rather than one per request.
+ * @ingroup file
+ ******************************************************************************/
+class FilePcm : public Null::NullPcm
+{
+public:
+
+	/**
+	 * @param type     stream type
+	 * @param fileName file to play to or capture from
+	 * @param realTime run at the stream rate, otherwise as fast as possible
+	 */
+	FilePcm(SoundItf::StreamType type, const std::string& fileName,
+			bool realTime = true);
+	~FilePcm();
+
+	/**
+	 * Queries the device for HW intervals and masks.
+	 * @req HW parameters that the frontend wants to set
+	 * @resp refined HW parameters that backend can support
+	 */
+	void queryHwRanges(SoundItf::PcmParamRanges& req,
+					   SoundItf::PcmParamRanges& resp) override;
+
+private:
+
+	static const size_t cBufferSize = 1024 * 1024;
+
+	std::string mFileName;
+	bool mIsWav;
+	int mFd;
+
+	std::vector<uint8_t> mBuffer;
+	// playback: bytes in the buffer, capture: bytes taken from the buffer
+	size_t mBufferPos;
+	// capture: bytes in the buffer
+	size_t mBufferEnd;
+	// playback: bytes written, capture: bytes left in the file
+	uint64_t mDataSize;
+
+	XenBackend::Log mLog;
+
+	void openData(const SoundItf::PcmParams& params) override;
+	void closeData() override;
+	void readData(uint8_t* buffer, size_t size) override;
+	void writeData(const uint8_t* buffer, size_t size) override;
+
+	int openFile();
+	SoundItf::PcmParams readHeader(int fd, uint64_t& dataSize);
+	void writeHeader(const SoundItf::PcmParams& params, uint64_t dataSize);
+	void flush();
+	void finish();
+	void release();
+};
+
+}
+
+#endif /* SRC_FILEPCM_HPP_ */
@@ -0,0 +1,568 @@
+/*
+ *  Sample format converter
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "FormatConverter.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+
+#include <xen/be/Exception.hpp>
+#include <xen/io/sndif.h>
+
+using std::min;
+using std::string;
+using std::tuple;
+
+using XenBackend::Exception;
+
+namespace Dsp {
+
+namespace {
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+const bool cHostBigEndian = true;
+#else
+const bool cHostBigEndian = false;
+#endif
+
+enum class Linear {S8, S16, S24, S32, F32, F64};
+
+enum class Coding {LINEAR, ALAW, MULAW, IEC958};
+
+struct FormatInfo
+{
+	uint8_t format;
+	const char* name;
+	uint8_t size;
+	uint8_t depth;
+	Linear linear;
+	Coding coding;
+	bool isUnsigned;
+	bool isBigEndian;
+};
+
+const FormatInfo cFormatInfo[] =
+{
+	{XENSND_PCM_FORMAT_S8,     "S8",     1,  8, Linear::S8,  Coding::LINEAR, false, false },
+	{XENSND_PCM_FORMAT_U8,     "U8",     1,  8, Linear::S8,  Coding::LINEAR, true,  false },
+	{XENSND_PCM_FORMAT_S16_LE, "S16_LE", 2, 16, Linear::S16, Coding::LINEAR, false, false },
+	{XENSND_PCM_FORMAT_S16_BE, "S16_BE", 2, 16, Linear::S16, Coding::LINEAR, false, true  },
+	{XENSND_PCM_FORMAT_U16_LE, "U16_LE", 2, 16, Linear::S16, Coding::LINEAR, true,  false },
+	{XENSND_PCM_FORMAT_U16_BE, "U16_BE", 2, 16, Linear::S16, Coding::LINEAR, true,  true  },
+	{XENSND_PCM_FORMAT_S24_LE, "S24_LE", 4, 24, Linear::S24, Coding::LINEAR, false, false },
+	{XENSND_PCM_FORMAT_S24_BE, "S24_BE", 4, 24, Linear::S24, Coding::LINEAR, false, true  },
+	{XENSND_PCM_FORMAT_U24_LE, "U24_LE", 4, 24, Linear::S24, Coding::LINEAR, true,  false },
+	{XENSND_PCM_FORMAT_U24_BE, "U24_BE", 4, 24, Linear::S24, Coding::LINEAR, true,  true  },
+	{XENSND_PCM_FORMAT_S32_LE, "S32_LE", 4, 32, Linear::S32, Coding::LINEAR, false, false },
+	{XENSND_PCM_FORMAT_S32_BE, "S32_BE", 4, 32, Linear::S32, Coding::LINEAR, false, true  },
+	{XENSND_PCM_FORMAT_U32_LE, "U32_LE", 4, 32, Linear::S32, Coding::LINEAR, true,  false },
+	{XENSND_PCM_FORMAT_U32_BE, "U32_BE", 4, 32, Linear::S32, Coding::LINEAR, true,  true  },
+	{XENSND_PCM_FORMAT_F32_LE, "F32_LE", 4, 25, Linear::F32, Coding::LINEAR, false, false },
+	{XENSND_PCM_FORMAT_F32_BE, "F32_BE", 4, 25, Linear::F32, Coding::LINEAR, false, true  },
+	{XENSND_PCM_FORMAT_F64_LE, "F64_LE", 8, 53, Linear::F64, Coding::LINEAR, false, false },
+	{XENSND_PCM_FORMAT_F64_BE, "F64_BE", 8, 53, Linear::F64, Coding::LINEAR, false, true  },
+	{XENSND_PCM_FORMAT_IEC958_SUBFRAME_LE,
+							   "IEC958_LE", 4, 24, Linear::S32, Coding::IEC958, false, false },
+	{XENSND_PCM_FORMAT_IEC958_SUBFRAME_BE,
+							   "IEC958_BE", 4, 24, Linear::S32, Coding::IEC958, false, true  },
+	{XENSND_PCM_FORMAT_A_LAW,  "A_LAW",  1, 13, Linear::S16, Coding::ALAW,   false, false },
+	{XENSND_PCM_FORMAT_MU_LAW, "MU_LAW", 1, 14, Linear::S16, Coding::MULAW,  false, false },
+};
+
+const FormatInfo& getFormatInfo(uint8_t format)
+{
+	for (auto& info : cFormatInfo)
+	{
+		if (info.format == format)
+		{
+			return info;
+		}
+	}
+
+	throw Exception("Can't convert format " + std::to_string(format), EINVAL);
+}
+
+/*******************************************************************************
+ * Generic kernels
+ *
+ * Used for rare conversions only, so they are scalar. Widening kernels
+ * process samples backward to allow in place conversion.
+ ******************************************************************************/
+
+void s8ToS32(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int8_t*>(src);
+	auto d = static_cast<int32_t*>(dst);
+
+	for (size_t i = numSamples; i-- > 0;)
+	{
+		d[i] = static_cast<int32_t>(static_cast<uint32_t>(s[i]) << 24);
+	}
+}
+
+void s32ToS8(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int32_t*>(src);
+	auto d = static_cast<int8_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		d[i] = s[i] >> 24;
+	}
+}
+
+void s16ToS32(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int16_t*>(src);
+	auto d = static_cast<int32_t*>(dst);
+
+	for (size_t i = numSamples; i-- > 0;)
+	{
+		d[i] = static_cast<int32_t>(static_cast<uint32_t>(s[i]) << 16);
+	}
+}
+
+void s32ToS16(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int32_t*>(src);
+	auto d = static_cast<int16_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		d[i] = s[i] >> 16;
+	}
+}
+
+void s32ToF64(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int32_t*>(src);
+	auto d = static_cast<double*>(dst);
+
+	for (size_t i = numSamples; i-- > 0;)
+	{
+		d[i] = s[i] / 2147483648.0;
+	}
+}
+
+void f64ToS32(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const double*>(src);
+	auto d = static_cast<int32_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		double value = s[i] * 2147483648.0;
+
+		if (value >= 2147483647.0)
+		{
+			d[i] = INT32_MAX;
+		}
+		else if (value <= -2147483648.0)
+		{
+			d[i] = INT32_MIN;
+		}
+		else if (value == value)
+		{
+			d[i] = static_cast<int32_t>(value);
+		}
+		else
+		{
+			d[i] = 0;
+		}
+	}
+}
+
+void alawToS16Kernel(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint8_t*>(src);
+	auto d = static_cast<int16_t*>(dst);
+
+	for (size_t i = numSamples; i-- > 0;)
+	{
+		d[i] = alawToS16(s[i]);
+	}
+}
+
+void s16ToAlawKernel(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int16_t*>(src);
+	auto d = static_cast<uint8_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		d[i] = s16ToAlaw(s[i]);
+	}
+}
+
+void mulawToS16Kernel(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint8_t*>(src);
+	auto d = static_cast<int16_t*>(dst);
+
+	for (size_t i = numSamples; i-- > 0;)
+	{
+		d[i] = mulawToS16(s[i]);
+	}
+}
+
+void s16ToMulawKernel(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int16_t*>(src);
+	auto d = static_cast<uint8_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		d[i] = s16ToMulaw(s[i]);
+	}
+}
+
+// IEC958 subframe: 24 bit sample in bits 4..27
+
+void iec958ToS32(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint32_t*>(src);
+	auto d = static_cast<int32_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		d[i] = static_cast<int32_t>((s[i] << 4) & 0xFFFFFF00);
+	}
+}
+
+void s32ToIec958(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint32_t*>(src);
+	auto d = static_cast<uint32_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		d[i] = (s[i] >> 4) & 0x0FFFFFF0;
+	}
+}
+
+}
+
+/*******************************************************************************
+ * FormatConverter
+ ******************************************************************************/
+
+FormatConverter::FormatConverter(uint8_t srcFormat, uint8_t dstFormat) :
+	mSrcFormat(srcFormat),
+	mDstFormat(dstFormat)
+{
+	auto& src = getFormatInfo(srcFormat);
+	auto& dst = getFormatInfo(dstFormat);
+	auto& k = getKernels();
+
+	if (isIdentity())
+	{
+		return;
+	}
+
+	// to host endian signed
+
+	if (src.size > 1 && src.isBigEndian != cHostBigEndian)
+	{
+		addStep("swap", src.size == 2 ? k.swap16 :
+						src.size == 4 ? k.swap32 : k.swap64);
+	}
+
+	if (src.isUnsigned)
+	{
+		addStep("flip", src.linear == Linear::S8 ? k.flip8 :
+						src.linear == Linear::S16 ? k.flip16 :
+						src.linear == Linear::S24 ? k.flip24 : k.flip32);
+	}
+
+	if (src.coding == Coding::ALAW)
+	{
+		addStep("alaw", alawToS16Kernel);
+	}
+	else if (src.coding == Coding::MULAW)
+	{
+		addStep("mulaw", mulawToS16Kernel);
+	}
+	else if (src.coding == Coding::IEC958)
+	{
+		addStep("iec958", iec958ToS32);
+	}
+
+	// width
+
+	if (src.linear == Linear::S16 && dst.linear == Linear::F32)
+	{
+		addStep("s16ToF32", k.s16ToF32);
+	}
+	else if (src.linear == Linear::F32 && dst.linear == Linear::S16)
+	{
+		addStep("f32ToS16", k.f32ToS16);
+	}
+	else if (src.linear != dst.linear)
+	{
+		switch (src.linear)
+		{
+		case Linear::S8:
+			addStep("s8ToS32", s8ToS32);
+			break;
+		case Linear::S16:
+			addStep("s16ToS32", s16ToS32);
+			break;
+		case Linear::S24:
+			addStep("s24ToS32", k.s24ToS32);
+			break;
+		case Linear::F32:
+			addStep("f32ToS32", k.f32ToS32);
+			break;
+		case Linear::F64:
+			addStep("f64ToS32", f64ToS32);
+			break;
+		default:
+			break;
+		}
+
+		switch (dst.linear)
+		{
+		case Linear::S8:
+			addStep("s32ToS8", s32ToS8);
+			break;
+		case Linear::S16:
+			addStep("s32ToS16", s32ToS16);
+			break;
+		case Linear::S24:
+			addStep("s32ToS24", k.s32ToS24);
+			break;
+		case Linear::F32:
+			addStep("s32ToF32", k.s32ToF32);
+			break;
+		case Linear::F64:
+			addStep("s32ToF64", s32ToF64);
+			break;
+		default:
+			break;
+		}
+	}
+
+	// from host endian signed
+
+	if (dst.coding == Coding::ALAW)
+	{
+		addStep("alaw", s16ToAlawKernel);
+	}
+	else if (dst.coding == Coding::MULAW)
+	{
+		addStep("mulaw", s16ToMulawKernel);
+	}
+	else if (dst.coding == Coding::IEC958)
+	{
+		addStep("iec958", s32ToIec958);
+	}
+
+	if (dst.isUnsigned)
+	{
+		addStep("flip", dst.linear == Linear::S8 ? k.flip8 :
+						dst.linear == Linear::S16 ? k.flip16 :
+						dst.linear == Linear::S24 ? k.flip24 : k.flip32);
+	}
+
+	if (dst.size > 1 && dst.isBigEndian != cHostBigEndian)
+	{
+		addStep("swap", dst.size == 2 ? k.swap16 :
+						dst.size == 4 ? k.swap32 : k.swap64);
+	}
+
+	if (mSteps.size() > 1)
+	{
+		mScratch.resize(cChunkSamples);
+	}
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void FormatConverter::convert(const void* src, void* dst, size_t numSamples)
+{
+	if (mSteps.empty())
+	{
+		memcpy(dst, src, numSamples * getSrcSampleSize());
+
+		return;
+	}
+
+	if (mSteps.size() == 1)
+	{
+		mSteps[0].kernel(src, dst, numSamples);
+
+		return;
+	}
+
+	auto s = static_cast<const uint8_t*>(src);
+	auto d = static_cast<uint8_t*>(dst);
+	auto srcSize = getSrcSampleSize();
+	auto dstSize = getDstSampleSize();
+
+	while (numSamples)
+	{
+		auto count = min(numSamples, cChunkSamples);
+		const void* in = s;
+
+		for (size_t i = 0; i < mSteps.size(); i++)
+		{
+			void* out = i + 1 == mSteps.size() ? static_cast<void*>(d) :
+												 mScratch.data();
+
+			mSteps[i].kernel(in, out, count);
+
+			in = out;
+		}
+
+		s += count * srcSize;
+		d += count * dstSize;
+		numSamples -= count;
+	}
+}
+
+string FormatConverter::getDescription() const
+{
+	string description = string(getFormatInfo(mSrcFormat).name) + " -> " +
+						 getFormatInfo(mDstFormat).name + " [" +
+						 getKernels().isa + "]:";
+
+	for (auto& step : mSteps)
+	{
+		description += string(" ") + step.name;
+	}
+
+	return description;
+}
+
+uint64_t FormatConverter::getSupportedFormats()
+{
+	uint64_t formats = 0;
+
+	for (auto& info : cFormatInfo)
+	{
+		formats |= 1ull << info.format;
+	}
+
+	return formats;
+}
+
+uint8_t FormatConverter::getFloatFormat()
+{
+	return cHostBigEndian ? XENSND_PCM_FORMAT_F32_BE : XENSND_PCM_FORMAT_F32_LE;
+}
+
+size_t FormatConverter::getSampleSize(uint8_t format)
+{
+	return getFormatInfo(format).size;
+}
+
+void FormatConverter::fillSilence(uint8_t format, uint8_t* buffer,
+								  size_t size)
+{
+	// unsigned formats have the middle value as silence
+	struct Silence
+	{
+		uint8_t format;
+		uint8_t sample[4];
+		size_t size;
+	};
+
+	static const Silence cSilence[] =
+	{
+		{XENSND_PCM_FORMAT_U8,     {0x80},                   1},
+		{XENSND_PCM_FORMAT_U16_LE, {0x00, 0x80},             2},
+		{XENSND_PCM_FORMAT_U16_BE, {0x80, 0x00},             2},
+		{XENSND_PCM_FORMAT_U24_LE, {0x00, 0x00, 0x80, 0x00}, 4},
+		{XENSND_PCM_FORMAT_U24_BE, {0x00, 0x80, 0x00, 0x00}, 4},
+		{XENSND_PCM_FORMAT_U32_LE, {0x00, 0x00, 0x00, 0x80}, 4},
+		{XENSND_PCM_FORMAT_U32_BE, {0x80, 0x00, 0x00, 0x00}, 4},
+		{XENSND_PCM_FORMAT_A_LAW,  {0xD5},                   1},
+		{XENSND_PCM_FORMAT_MU_LAW, {0xFF},                   1},
+	};
+
+	for (auto& silence : cSilence)
+	{
+		if (silence.format == format)
+		{
+			for (size_t i = 0; i < size; i++)
+			{
+				buffer[i] = silence.sample[i % silence.size];
+			}
+
+			return;
+		}
+	}
+
+	memset(buffer, 0, size);
+}
+
+uint8_t FormatConverter::selectFormat(uint8_t format, uint64_t formats)
+{
+	if (formats & (1ull << format))
+	{
+		return format;
+	}
+
+	auto& src = getFormatInfo(format);
+	auto selected = format;
+	tuple<bool, bool, int, bool, bool> selectedKey;
+	bool found = false;
+
+	for (auto& info : cFormatInfo)
+	{
+		if (!(formats & (1ull << info.format)))
+		{
+			continue;
+		}
+
+		bool isLossy = info.depth < src.depth;
+
+		// prefer linear formats which keep precision with the smallest
+		// sample size, then host endian and signed ones
+		auto key = std::make_tuple(info.coding != Coding::LINEAR, isLossy,
+								   isLossy ? -info.depth : info.size,
+								   info.size > 1 &&
+								   info.isBigEndian != cHostBigEndian,
+								   info.isUnsigned);
+
+		if (!found || key < selectedKey)
+		{
+			selected = info.format;
+			selectedKey = key;
+			found = true;
+		}
+	}
+
+	return selected;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void FormatConverter::addStep(const char* name, Kernel kernel)
+{
+	mSteps.push_back({name, kernel});
+}
+
+}
@@ -0,0 +1,137 @@
+/*
+ *  Sample format converter
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_FORMATCONVERTER_HPP_
+#define SRC_FORMATCONVERTER_HPP_
+
+#include <string>
+#include <vector>
+
+#include "FormatKernels.hpp"
+
+namespace Dsp {
+
+/***************************************************************************//**
+ * @defgroup dsp
+ * Sample processing related classes.
+ ******************************************************************************/
+
+/***************************************************************************//**
+ * Converts samples from one sndif format to another.
+ *
+ * The conversion is a chain of kernels selected on construction: byte swap and
+ * sign flip to get host endian signed samples, width change, then sign flip
+ * and byte swap to the destination format. Most common pairs (endian swap,
+ * signed/unsigned, S24 to S32, float to S16/S32) need one kernel only and
+ * are converted directly, longer chains go through a scratch buffer.
+ * @ingroup dsp
+ ******************************************************************************/
+class FormatConverter
+{
+public:
+
+	/**
+	 * @param srcFormat source sndif format
+	 * @param dstFormat destination sndif format
+	 */
+	FormatConverter(uint8_t srcFormat, uint8_t dstFormat);
+
+	/**
+	 * Converts samples.
+	 * @param src        source samples
+	 * @param dst        destination samples
+	 * @param numSamples number of samples
+	 */
+	void convert(const void* src, void* dst, size_t numSamples);
+
+	/**
+	 * Returns true if source and destination formats are equal.
+	 */
+	bool isIdentity() const { return mSrcFormat == mDstFormat; }
+
+	/**
+	 * Returns source sample size in bytes.
+	 */
+	size_t getSrcSampleSize() const { return getSampleSize(mSrcFormat); }
+
+	/**
+	 * Returns destination sample size in bytes.
+	 */
+	size_t getDstSampleSize() const { return getSampleSize(mDstFormat); }
+
+	/**
+	 * Returns conversion description for logging.
+	 */
+	std::string getDescription() const;
+
+	/**
+	 * Returns mask of formats which can be converted.
+	 */
+	static uint64_t getSupportedFormats();
+
+	/**
+	 * Returns host endian float format.
+	 */
+	static uint8_t getFloatFormat();
+
+	/**
+	 * Returns sample size of the format in bytes.
+	 * @param format sndif format
+	 */
+	static size_t getSampleSize(uint8_t format);
+
+	/**
+	 * Fills the buffer with silence of the format.
+	 * @param format sndif format
+	 * @param buffer buffer to fill
+	 * @param size   buffer size in bytes
+	 */
+	static void fillSilence(uint8_t format, uint8_t* buffer, size_t size);
+
+	/**
+	 * Selects the best format to convert to.
+	 * @param format  sndif format to convert from
+	 * @param formats mask of formats to select from
+	 * @return selected format or the format itself if it is in the mask
+	 */
+	static uint8_t selectFormat(uint8_t format, uint64_t formats);
+
+private:
+
+	static const size_t cChunkSamples = 1024;
+
+	struct Step
+	{
+		const char* name;
+		Kernel kernel;
+	};
+
+	uint8_t mSrcFormat;
+	uint8_t mDstFormat;
+
+	std::vector<Step> mSteps;
+	std::vector<uint64_t> mScratch;
+
+	void addStep(const char* name, Kernel kernel);
+};
+
+}
+
+#endif /* SRC_FORMATCONVERTER_HPP_ */
@@ -0,0 +1,1436 @@
+/*
+ *  Sample format conversion kernels
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "FormatKernels.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DSP_X86
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DSP_NEON
+#endif
+
+namespace Dsp {
+
+namespace {
+
+const float cS32Scale = 2147483648.0f;
+const float cS16Scale = 32768.0f;
+// the biggest float which is less than 2^31
+const float cS32MaxFloat = 2147483520.0f;
+
+/*******************************************************************************
+ * Scalar kernels
+ ******************************************************************************/
+
+void swap16Scalar(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint16_t*>(src);
+	auto d = static_cast<uint16_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		d[i] = __builtin_bswap16(s[i]);
+	}
+}
+
+void swap32Scalar(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint32_t*>(src);
+	auto d = static_cast<uint32_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		d[i] = __builtin_bswap32(s[i]);
+	}
+}
+
+void swap64Scalar(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint64_t*>(src);
+	auto d = static_cast<uint64_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		d[i] = __builtin_bswap64(s[i]);
+	}
+}
+
+void flip8Scalar(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint8_t*>(src);
+	auto d = static_cast<uint8_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		d[i] = s[i] ^ 0x80;
+	}
+}
+
+void flip16Scalar(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint16_t*>(src);
+	auto d = static_cast<uint16_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		d[i] = s[i] ^ 0x8000;
+	}
+}
+
+template<uint32_t mask>
+void xor32Scalar(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint32_t*>(src);
+	auto d = static_cast<uint32_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		d[i] = s[i] ^ mask;
+	}
+}
+
+void s24ToS32Scalar(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint32_t*>(src);
+	auto d = static_cast<int32_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		d[i] = static_cast<int32_t>(s[i] << 8);
+	}
+}
+
+void s32ToS24Scalar(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int32_t*>(src);
+	auto d = static_cast<int32_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		d[i] = s[i] >> 8;
+	}
+}
+
+void s16ToF32Scalar(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int16_t*>(src);
+	auto d = static_cast<float*>(dst);
+
+	// backward: dst samples are wider than src ones
+	for (size_t i = numSamples; i-- > 0;)
+	{
+		d[i] = s[i] / cS16Scale;
+	}
+}
+
+void f32ToS16Scalar(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const float*>(src);
+	auto d = static_cast<int16_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		float value = s[i] * cS16Scale;
+
+		if (value >= 32767.0f)
+		{
+			d[i] = 32767;
+		}
+		else if (value <= -32768.0f)
+		{
+			d[i] = -32768;
+		}
+		else if (value == value)
+		{
+			d[i] = static_cast<int16_t>(lrintf(value));
+		}
+		else
+		{
+			d[i] = 0;
+		}
+	}
+}
+
+void s32ToF32Scalar(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int32_t*>(src);
+	auto d = static_cast<float*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		d[i] = s[i] / cS32Scale;
+	}
+}
+
+void f32ToS32Scalar(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const float*>(src);
+	auto d = static_cast<int32_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		float value = s[i] * cS32Scale;
+
+		if (value >= cS32MaxFloat)
+		{
+			d[i] = INT32_MAX;
+		}
+		else if (value <= -cS32Scale)
+		{
+			d[i] = INT32_MIN;
+		}
+		else if (value == value)
+		{
+			d[i] = static_cast<int32_t>(lrintf(value));
+		}
+		else
+		{
+			d[i] = 0;
+		}
+	}
+}
+
+void mixS16Scalar(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int16_t*>(src);
+	auto d = static_cast<int16_t*>(dst);
+
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		int32_t value = d[i] + s[i];
+
+		d[i] = value > INT16_MAX ? INT16_MAX :
+			   value < INT16_MIN ? INT16_MIN : value;
+	}
+}
+
+float dotScalar(const float* a, const float* b, size_t size)
+{
+	float sum[4] = {};
+	size_t i = 0;
+
+	for (; i + 4 <= size; i += 4)
+	{
+		sum[0] += a[i] * b[i];
+		sum[1] += a[i + 1] * b[i + 1];
+		sum[2] += a[i + 2] * b[i + 2];
+		sum[3] += a[i + 3] * b[i + 3];
+	}
+
+	for (; i < size; i++)
+	{
+		sum[0] += a[i] * b[i];
+	}
+
+	return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+
+void matrixScalar(const float* in, float* out, const float* matrix,
+				  size_t inChannels, size_t outChannels, size_t numFrames)
+{
+	for (size_t frame = 0; frame < numFrames; frame++)
+	{
+		float acc[cMatrixStride] = {};
+
+		for (size_t i = 0; i < inChannels; i++)
+		{
+			auto row = &matrix[i * cMatrixStride];
+
+			for (size_t o = 0; o < outChannels; o++)
+			{
+				acc[o] += in[i] * row[o];
+			}
+		}
+
+		memcpy(out, acc, outChannels * sizeof(float));
+
+		in += inChannels;
+		out += outChannels;
+	}
+}
+
+const Kernels cScalarKernels =
+{
+	"scalar",
+	swap16Scalar, swap32Scalar, swap64Scalar,
+	flip8Scalar, flip16Scalar, xor32Scalar<0x800000>, xor32Scalar<0x80000000>,
+	s24ToS32Scalar, s32ToS24Scalar,
+	s16ToF32Scalar, f32ToS16Scalar, s32ToF32Scalar, f32ToS32Scalar,
+	mixS16Scalar, dotScalar, matrixScalar
+};
+
+#ifdef DSP_X86
+
+/*******************************************************************************
+ * SSE2 kernels
+ ******************************************************************************/
+
+__attribute__((target("sse2")))
+void swap16Sse2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint16_t*>(src);
+	auto d = static_cast<uint16_t*>(dst);
+	size_t i = 0;
+
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&s[i]));
+
+		x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&d[i]), x);
+	}
+
+	swap16Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("sse2")))
+void swap32Sse2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint32_t*>(src);
+	auto d = static_cast<uint32_t*>(dst);
+	size_t i = 0;
+
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&s[i]));
+
+		// swap 16 bit halves then bytes inside the halves
+		x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+		x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+		x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&d[i]), x);
+	}
+
+	swap32Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("sse2")))
+void flip8Sse2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint8_t*>(src);
+	auto d = static_cast<uint8_t*>(dst);
+	auto mask = _mm_set1_epi8(static_cast<char>(0x80));
+	size_t i = 0;
+
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&s[i]));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&d[i]),
+						 _mm_xor_si128(x, mask));
+	}
+
+	flip8Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("sse2")))
+void flip16Sse2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint16_t*>(src);
+	auto d = static_cast<uint16_t*>(dst);
+	auto mask = _mm_set1_epi16(static_cast<short>(0x8000));
+	size_t i = 0;
+
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&s[i]));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&d[i]),
+						 _mm_xor_si128(x, mask));
+	}
+
+	flip16Scalar(&s[i], &d[i], numSamples - i);
+}
+
+template<uint32_t mask>
+__attribute__((target("sse2")))
+void xor32Sse2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint32_t*>(src);
+	auto d = static_cast<uint32_t*>(dst);
+	auto xorMask = _mm_set1_epi32(static_cast<int>(mask));
+	size_t i = 0;
+
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&s[i]));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&d[i]),
+						 _mm_xor_si128(x, xorMask));
+	}
+
+	xor32Scalar<mask>(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("sse2")))
+void s24ToS32Sse2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint32_t*>(src);
+	auto d = static_cast<int32_t*>(dst);
+	size_t i = 0;
+
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&s[i]));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&d[i]),
+						 _mm_slli_epi32(x, 8));
+	}
+
+	s24ToS32Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("sse2")))
+void s32ToS24Sse2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int32_t*>(src);
+	auto d = static_cast<int32_t*>(dst);
+	size_t i = 0;
+
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&s[i]));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&d[i]),
+						 _mm_srai_epi32(x, 8));
+	}
+
+	s32ToS24Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("sse2")))
+void s16ToF32Sse2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int16_t*>(src);
+	auto d = static_cast<float*>(dst);
+	auto scale = _mm_set1_ps(1.0f / cS16Scale);
+	size_t i = numSamples & ~static_cast<size_t>(7);
+
+	// backward: dst samples are wider than src ones
+	s16ToF32Scalar(&s[i], &d[i], numSamples - i);
+
+	while (i)
+	{
+		i -= 8;
+
+		auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&s[i]));
+		auto lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		auto hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+
+		_mm_storeu_ps(&d[i], _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(&d[i + 4], _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+}
+
+__attribute__((target("sse2")))
+void f32ToS16Sse2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const float*>(src);
+	auto d = static_cast<int16_t*>(dst);
+	auto scale = _mm_set1_ps(cS16Scale);
+	auto max = _mm_set1_ps(32767.0f);
+	auto min = _mm_set1_ps(-32768.0f);
+	size_t i = 0;
+
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		// overflow gives INT32_MIN: clamp in float domain
+		auto lo = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(
+				_mm_mul_ps(_mm_loadu_ps(&s[i]), scale), max), min));
+		auto hi = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(
+				_mm_mul_ps(_mm_loadu_ps(&s[i + 4]), scale), max), min));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&d[i]),
+						 _mm_packs_epi32(lo, hi));
+	}
+
+	f32ToS16Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("sse2")))
+void s32ToF32Sse2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int32_t*>(src);
+	auto d = static_cast<float*>(dst);
+	auto scale = _mm_set1_ps(1.0f / cS32Scale);
+	size_t i = 0;
+
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&s[i]));
+
+		_mm_storeu_ps(&d[i], _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+	}
+
+	s32ToF32Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("sse2")))
+void f32ToS32Sse2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const float*>(src);
+	auto d = static_cast<int32_t*>(dst);
+	auto scale = _mm_set1_ps(cS32Scale);
+	auto max = _mm_set1_ps(cS32MaxFloat);
+	auto maxInt = _mm_set1_epi32(INT32_MAX);
+	size_t i = 0;
+
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		auto x = _mm_mul_ps(_mm_loadu_ps(&s[i]), scale);
+
+		// out of range and NaN lanes convert to INT32_MIN: saturate positive
+		// lanes and zero NaN lanes as the scalar kernel does
+		auto over = _mm_castps_si128(_mm_cmpge_ps(x, max));
+		auto valid = _mm_castps_si128(_mm_cmpord_ps(x, x));
+		auto y = _mm_cvtps_epi32(x);
+
+		y = _mm_or_si128(_mm_andnot_si128(over, y),
+						 _mm_and_si128(over, maxInt));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&d[i]),
+						 _mm_and_si128(y, valid));
+	}
+
+	f32ToS32Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("sse2")))
+void mixS16Sse2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int16_t*>(src);
+	auto d = static_cast<int16_t*>(dst);
+	size_t i = 0;
+
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&s[i]));
+		auto y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&d[i]));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&d[i]),
+						 _mm_adds_epi16(x, y));
+	}
+
+	mixS16Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("sse2")))
+float dotSse2(const float* a, const float* b, size_t size)
+{
+	auto sum0 = _mm_setzero_ps();
+	auto sum1 = _mm_setzero_ps();
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(&a[i]),
+										   _mm_loadu_ps(&b[i])));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(&a[i + 4]),
+										   _mm_loadu_ps(&b[i + 4])));
+	}
+
+	float sum[4];
+
+	_mm_storeu_ps(sum, _mm_add_ps(sum0, sum1));
+
+	return (sum[0] + sum[1]) + (sum[2] + sum[3]) +
+		   dotScalar(&a[i], &b[i], size - i);
+}
+
+__attribute__((target("sse2")))
+void matrixSse2(const float* in, float* out, const float* matrix,
+				size_t inChannels, size_t outChannels, size_t numFrames)
+{
+	for (size_t frame = 0; frame < numFrames; frame++)
+	{
+		auto acc0 = _mm_setzero_ps();
+		auto acc1 = _mm_setzero_ps();
+
+		for (size_t i = 0; i < inChannels; i++)
+		{
+			auto row = &matrix[i * cMatrixStride];
+			auto sample = _mm_set1_ps(in[i]);
+
+			acc0 = _mm_add_ps(acc0, _mm_mul_ps(sample, _mm_loadu_ps(row)));
+			acc1 = _mm_add_ps(acc1, _mm_mul_ps(sample, _mm_loadu_ps(row + 4)));
+		}
+
+		float acc[cMatrixStride];
+
+		_mm_storeu_ps(acc, acc0);
+		_mm_storeu_ps(acc + 4, acc1);
+
+		memcpy(out, acc, outChannels * sizeof(float));
+
+		in += inChannels;
+		out += outChannels;
+	}
+}
+
+const Kernels cSse2Kernels =
+{
+	"sse2",
+	swap16Sse2, swap32Sse2, swap64Scalar,
+	flip8Sse2, flip16Sse2, xor32Sse2<0x800000>, xor32Sse2<0x80000000>,
+	s24ToS32Sse2, s32ToS24Sse2,
+	s16ToF32Sse2, f32ToS16Sse2, s32ToF32Sse2, f32ToS32Sse2,
+	mixS16Sse2, dotSse2, matrixSse2
+};
+
+/*******************************************************************************
+ * AVX2 kernels
+ *
+ * The upper halves of the YMM registers are cleared before the scalar code
+ * and on return to avoid AVX to SSE transition penalty.
+ ******************************************************************************/
+
+__attribute__((target("avx2")))
+void shuffle8Avx2(const void* src, void* dst, size_t numBytes, __m256i mask)
+{
+	auto s = static_cast<const uint8_t*>(src);
+	auto d = static_cast<uint8_t*>(dst);
+
+	for (size_t i = 0; i < numBytes; i += 32)
+	{
+		auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&s[i]));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(&d[i]),
+							_mm256_shuffle_epi8(x, mask));
+	}
+}
+
+__attribute__((target("avx2")))
+void swap16Avx2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint16_t*>(src);
+	auto d = static_cast<uint16_t*>(dst);
+	size_t i = numSamples & ~static_cast<size_t>(15);
+
+	shuffle8Avx2(s, d, i * 2, _mm256_setr_epi8(
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+
+	_mm256_zeroupper();
+
+	swap16Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("avx2")))
+void swap32Avx2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint32_t*>(src);
+	auto d = static_cast<uint32_t*>(dst);
+	size_t i = numSamples & ~static_cast<size_t>(7);
+
+	shuffle8Avx2(s, d, i * 4, _mm256_setr_epi8(
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+
+	_mm256_zeroupper();
+
+	swap32Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("avx2")))
+void swap64Avx2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint64_t*>(src);
+	auto d = static_cast<uint64_t*>(dst);
+	size_t i = numSamples & ~static_cast<size_t>(3);
+
+	shuffle8Avx2(s, d, i * 8, _mm256_setr_epi8(
+			7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+			7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8));
+
+	_mm256_zeroupper();
+
+	swap64Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("avx2")))
+void xor8Avx2(const void* src, void* dst, size_t numBytes, __m256i mask)
+{
+	auto s = static_cast<const uint8_t*>(src);
+	auto d = static_cast<uint8_t*>(dst);
+
+	for (size_t i = 0; i < numBytes; i += 32)
+	{
+		auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&s[i]));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(&d[i]),
+							_mm256_xor_si256(x, mask));
+	}
+}
+
+__attribute__((target("avx2")))
+void flip8Avx2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint8_t*>(src);
+	auto d = static_cast<uint8_t*>(dst);
+	size_t i = numSamples & ~static_cast<size_t>(31);
+
+	xor8Avx2(s, d, i, _mm256_set1_epi8(static_cast<char>(0x80)));
+
+	_mm256_zeroupper();
+
+	flip8Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("avx2")))
+void flip16Avx2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint16_t*>(src);
+	auto d = static_cast<uint16_t*>(dst);
+	size_t i = numSamples & ~static_cast<size_t>(15);
+
+	xor8Avx2(s, d, i * 2, _mm256_set1_epi16(static_cast<short>(0x8000)));
+
+	_mm256_zeroupper();
+
+	flip16Scalar(&s[i], &d[i], numSamples - i);
+}
+
+template<uint32_t mask>
+__attribute__((target("avx2")))
+void xor32Avx2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint32_t*>(src);
+	auto d = static_cast<uint32_t*>(dst);
+	size_t i = numSamples & ~static_cast<size_t>(7);
+
+	xor8Avx2(s, d, i * 4, _mm256_set1_epi32(static_cast<int>(mask)));
+
+	_mm256_zeroupper();
+
+	xor32Scalar<mask>(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("avx2")))
+void s24ToS32Avx2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint32_t*>(src);
+	auto d = static_cast<int32_t*>(dst);
+	size_t i = 0;
+
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&s[i]));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(&d[i]),
+							_mm256_slli_epi32(x, 8));
+	}
+
+	_mm256_zeroupper();
+
+	s24ToS32Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("avx2")))
+void s32ToS24Avx2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int32_t*>(src);
+	auto d = static_cast<int32_t*>(dst);
+	size_t i = 0;
+
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&s[i]));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(&d[i]),
+							_mm256_srai_epi32(x, 8));
+	}
+
+	_mm256_zeroupper();
+
+	s32ToS24Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("avx2")))
+void s16ToF32Avx2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int16_t*>(src);
+	auto d = static_cast<float*>(dst);
+	size_t i = numSamples & ~static_cast<size_t>(7);
+
+	// backward: dst samples are wider than src ones
+	s16ToF32Scalar(&s[i], &d[i], numSamples - i);
+
+	auto scale = _mm256_set1_ps(1.0f / cS16Scale);
+
+	while (i)
+	{
+		i -= 8;
+
+		auto x = _mm256_cvtepi16_epi32(
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(&s[i])));
+
+		_mm256_storeu_ps(&d[i], _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+	}
+
+	_mm256_zeroupper();
+}
+
+__attribute__((target("avx2")))
+void f32ToS16Avx2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const float*>(src);
+	auto d = static_cast<int16_t*>(dst);
+	auto scale = _mm256_set1_ps(cS16Scale);
+	auto max = _mm256_set1_ps(32767.0f);
+	auto min = _mm256_set1_ps(-32768.0f);
+	size_t i = 0;
+
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		auto lo = _mm256_cvtps_epi32(_mm256_max_ps(_mm256_min_ps(
+				_mm256_mul_ps(_mm256_loadu_ps(&s[i]), scale), max), min));
+		auto hi = _mm256_cvtps_epi32(_mm256_max_ps(_mm256_min_ps(
+				_mm256_mul_ps(_mm256_loadu_ps(&s[i + 8]), scale), max), min));
+
+		// pack works inside 128 bit lanes: restore the order
+		auto x = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi),
+										  _MM_SHUFFLE(3, 1, 2, 0));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(&d[i]), x);
+	}
+
+	_mm256_zeroupper();
+
+	f32ToS16Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("avx2")))
+void s32ToF32Avx2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int32_t*>(src);
+	auto d = static_cast<float*>(dst);
+	auto scale = _mm256_set1_ps(1.0f / cS32Scale);
+	size_t i = 0;
+
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&s[i]));
+
+		_mm256_storeu_ps(&d[i], _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+	}
+
+	_mm256_zeroupper();
+
+	s32ToF32Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("avx2")))
+void f32ToS32Avx2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const float*>(src);
+	auto d = static_cast<int32_t*>(dst);
+	auto scale = _mm256_set1_ps(cS32Scale);
+	auto max = _mm256_set1_ps(cS32MaxFloat);
+	auto maxInt = _mm256_set1_epi32(INT32_MAX);
+	size_t i = 0;
+
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		auto x = _mm256_mul_ps(_mm256_loadu_ps(&s[i]), scale);
+
+		// out of range and NaN lanes convert to INT32_MIN: saturate positive
+		// lanes and zero NaN lanes as the scalar kernel does
+		auto over = _mm256_castps_si256(_mm256_cmp_ps(x, max, _CMP_GE_OQ));
+		auto valid = _mm256_castps_si256(_mm256_cmp_ps(x, x, _CMP_ORD_Q));
+		auto y = _mm256_blendv_epi8(_mm256_cvtps_epi32(x), maxInt, over);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(&d[i]),
+							_mm256_and_si256(y, valid));
+	}
+
+	_mm256_zeroupper();
+
+	f32ToS32Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("avx2")))
+void mixS16Avx2(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int16_t*>(src);
+	auto d = static_cast<int16_t*>(dst);
+	size_t i = 0;
+
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&s[i]));
+		auto y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&d[i]));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(&d[i]),
+							_mm256_adds_epi16(x, y));
+	}
+
+	_mm256_zeroupper();
+
+	mixS16Scalar(&s[i], &d[i], numSamples - i);
+}
+
+__attribute__((target("avx2")))
+float dotAvx2(const float* a, const float* b, size_t size)
+{
+	auto sum0 = _mm256_setzero_ps();
+	auto sum1 = _mm256_setzero_ps();
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16)
+	{
+		sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(&a[i]),
+												 _mm256_loadu_ps(&b[i])));
+		sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(&a[i + 8]),
+												 _mm256_loadu_ps(&b[i + 8])));
+	}
+
+	sum0 = _mm256_add_ps(sum0, sum1);
+
+	auto sum4 = _mm_add_ps(_mm256_castps256_ps128(sum0),
+						   _mm256_extractf128_ps(sum0, 1));
+
+	float sum[4];
+
+	_mm_storeu_ps(sum, sum4);
+
+	_mm256_zeroupper();
+
+	return (sum[0] + sum[1]) + (sum[2] + sum[3]) +
+		   dotScalar(&a[i], &b[i], size - i);
+}
+
+__attribute__((target("avx2")))
+void matrixAvx2(const float* in, float* out, const float* matrix,
+				size_t inChannels, size_t outChannels, size_t numFrames)
+{
+	for (size_t frame = 0; frame < numFrames; frame++)
+	{
+		auto acc = _mm256_setzero_ps();
+
+		for (size_t i = 0; i < inChannels; i++)
+		{
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(
+					_mm256_set1_ps(in[i]),
+					_mm256_loadu_ps(&matrix[i * cMatrixStride])));
+		}
+
+		if (outChannels == cMatrixStride)
+		{
+			_mm256_storeu_ps(out, acc);
+		}
+		else
+		{
+			float result[cMatrixStride];
+
+			_mm256_storeu_ps(result, acc);
+
+			for (size_t o = 0; o < outChannels; o++)
+			{
+				out[o] = result[o];
+			}
+		}
+
+		in += inChannels;
+		out += outChannels;
+	}
+
+	_mm256_zeroupper();
+}
+
+const Kernels cAvx2Kernels =
+{
+	"avx2",
+	swap16Avx2, swap32Avx2, swap64Avx2,
+	flip8Avx2, flip16Avx2, xor32Avx2<0x800000>, xor32Avx2<0x80000000>,
+	s24ToS32Avx2, s32ToS24Avx2,
+	s16ToF32Avx2, f32ToS16Avx2, s32ToF32Avx2, f32ToS32Avx2,
+	mixS16Avx2, dotAvx2, matrixAvx2
+};
+
+#endif /* DSP_X86 */
+
+#ifdef DSP_NEON
+
+/*******************************************************************************
+ * NEON kernels
+ ******************************************************************************/
+
+void swap16Neon(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint16_t*>(src);
+	auto d = static_cast<uint16_t*>(dst);
+	size_t i = 0;
+
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		auto x = vld1q_u8(reinterpret_cast<const uint8_t*>(&s[i]));
+
+		vst1q_u8(reinterpret_cast<uint8_t*>(&d[i]), vrev16q_u8(x));
+	}
+
+	swap16Scalar(&s[i], &d[i], numSamples - i);
+}
+
+void swap32Neon(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint32_t*>(src);
+	auto d = static_cast<uint32_t*>(dst);
+	size_t i = 0;
+
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		auto x = vld1q_u8(reinterpret_cast<const uint8_t*>(&s[i]));
+
+		vst1q_u8(reinterpret_cast<uint8_t*>(&d[i]), vrev32q_u8(x));
+	}
+
+	swap32Scalar(&s[i], &d[i], numSamples - i);
+}
+
+void swap64Neon(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint64_t*>(src);
+	auto d = static_cast<uint64_t*>(dst);
+	size_t i = 0;
+
+	for (; i + 2 <= numSamples; i += 2)
+	{
+		auto x = vld1q_u8(reinterpret_cast<const uint8_t*>(&s[i]));
+
+		vst1q_u8(reinterpret_cast<uint8_t*>(&d[i]), vrev64q_u8(x));
+	}
+
+	swap64Scalar(&s[i], &d[i], numSamples - i);
+}
+
+void flip8Neon(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint8_t*>(src);
+	auto d = static_cast<uint8_t*>(dst);
+	auto mask = vdupq_n_u8(0x80);
+	size_t i = 0;
+
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		vst1q_u8(&d[i], veorq_u8(vld1q_u8(&s[i]), mask));
+	}
+
+	flip8Scalar(&s[i], &d[i], numSamples - i);
+}
+
+void flip16Neon(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint16_t*>(src);
+	auto d = static_cast<uint16_t*>(dst);
+	auto mask = vdupq_n_u16(0x8000);
+	size_t i = 0;
+
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		vst1q_u16(&d[i], veorq_u16(vld1q_u16(&s[i]), mask));
+	}
+
+	flip16Scalar(&s[i], &d[i], numSamples - i);
+}
+
+template<uint32_t mask>
+void xor32Neon(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint32_t*>(src);
+	auto d = static_cast<uint32_t*>(dst);
+	auto xorMask = vdupq_n_u32(mask);
+	size_t i = 0;
+
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		vst1q_u32(&d[i], veorq_u32(vld1q_u32(&s[i]), xorMask));
+	}
+
+	xor32Scalar<mask>(&s[i], &d[i], numSamples - i);
+}
+
+void s24ToS32Neon(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const uint32_t*>(src);
+	auto d = static_cast<int32_t*>(dst);
+	size_t i = 0;
+
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		vst1q_s32(&d[i], vreinterpretq_s32_u32(vshlq_n_u32(vld1q_u32(&s[i]), 8)));
+	}
+
+	s24ToS32Scalar(&s[i], &d[i], numSamples - i);
+}
+
+void s32ToS24Neon(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int32_t*>(src);
+	auto d = static_cast<int32_t*>(dst);
+	size_t i = 0;
+
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		vst1q_s32(&d[i], vshrq_n_s32(vld1q_s32(&s[i]), 8));
+	}
+
+	s32ToS24Scalar(&s[i], &d[i], numSamples - i);
+}
+
+void s16ToF32Neon(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int16_t*>(src);
+	auto d = static_cast<float*>(dst);
+	size_t i = numSamples & ~static_cast<size_t>(3);
+
+	// backward: dst samples are wider than src ones
+	s16ToF32Scalar(&s[i], &d[i], numSamples - i);
+
+	while (i)
+	{
+		i -= 4;
+
+		vst1q_f32(&d[i], vcvtq_n_f32_s32(vmovl_s16(vld1_s16(&s[i])), 15));
+	}
+}
+
+void f32ToS16Neon(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const float*>(src);
+	auto d = static_cast<int16_t*>(dst);
+	size_t i = 0;
+
+#ifdef __aarch64__
+	// round to nearest as the scalar kernel does, the conversion and the
+	// narrowing saturate out of range values, NaN converts to 0
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		auto x = vmulq_n_f32(vld1q_f32(&s[i]), cS16Scale);
+
+		vst1_s16(&d[i], vqmovn_s32(vcvtnq_s32_f32(x)));
+	}
+#endif
+
+	f32ToS16Scalar(&s[i], &d[i], numSamples - i);
+}
+
+void s32ToF32Neon(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int32_t*>(src);
+	auto d = static_cast<float*>(dst);
+	size_t i = 0;
+
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		vst1q_f32(&d[i], vcvtq_n_f32_s32(vld1q_s32(&s[i]), 31));
+	}
+
+	s32ToF32Scalar(&s[i], &d[i], numSamples - i);
+}
+
+void f32ToS32Neon(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const float*>(src);
+	auto d = static_cast<int32_t*>(dst);
+	size_t i = 0;
+
+#ifdef __aarch64__
+	auto max = vdupq_n_f32(cS32MaxFloat);
+	auto maxInt = vdupq_n_s32(INT32_MAX);
+
+	// round to nearest as the scalar kernel does, the conversion saturates
+	// values from 2^31 and NaN converts to 0; the scalar kernel saturates
+	// the biggest float below 2^31 as well
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		auto x = vmulq_n_f32(vld1q_f32(&s[i]), cS32Scale);
+
+		vst1q_s32(&d[i], vbslq_s32(vcgeq_f32(x, max), maxInt,
+								   vcvtnq_s32_f32(x)));
+	}
+#endif
+
+	f32ToS32Scalar(&s[i], &d[i], numSamples - i);
+}
+
+void mixS16Neon(const void* src, void* dst, size_t numSamples)
+{
+	auto s = static_cast<const int16_t*>(src);
+	auto d = static_cast<int16_t*>(dst);
+	size_t i = 0;
+
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		vst1q_s16(&d[i], vqaddq_s16(vld1q_s16(&s[i]), vld1q_s16(&d[i])));
+	}
+
+	mixS16Scalar(&s[i], &d[i], numSamples - i);
+}
+
+float dotNeon(const float* a, const float* b, size_t size)
+{
+	auto sum0 = vdupq_n_f32(0.0f);
+	auto sum1 = vdupq_n_f32(0.0f);
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		sum0 = vmlaq_f32(sum0, vld1q_f32(&a[i]), vld1q_f32(&b[i]));
+		sum1 = vmlaq_f32(sum1, vld1q_f32(&a[i + 4]), vld1q_f32(&b[i + 4]));
+	}
+
+	sum0 = vaddq_f32(sum0, sum1);
+
+	auto sum2 = vadd_f32(vget_low_f32(sum0), vget_high_f32(sum0));
+
+	return vget_lane_f32(vpadd_f32(sum2, sum2), 0) +
+		   dotScalar(&a[i], &b[i], size - i);
+}
+
+void matrixNeon(const float* in, float* out, const float* matrix,
+				size_t inChannels, size_t outChannels, size_t numFrames)
+{
+	for (size_t frame = 0; frame < numFrames; frame++)
+	{
+		auto acc0 = vdupq_n_f32(0.0f);
+		auto acc1 = vdupq_n_f32(0.0f);
+
+		for (size_t i = 0; i < inChannels; i++)
+		{
+			auto row = &matrix[i * cMatrixStride];
+
+			acc0 = vmlaq_n_f32(acc0, vld1q_f32(row), in[i]);
+			acc1 = vmlaq_n_f32(acc1, vld1q_f32(row + 4), in[i]);
+		}
+
+		float acc[cMatrixStride];
+
+		vst1q_f32(acc, acc0);
+		vst1q_f32(acc + 4, acc1);
+
+		memcpy(out, acc, outChannels * sizeof(float));
+
+		in += inChannels;
+		out += outChannels;
+	}
+}
+
+const Kernels cNeonKernels =
+{
+	"neon",
+	swap16Neon, swap32Neon, swap64Neon,
+	flip8Neon, flip16Neon, xor32Neon<0x800000>, xor32Neon<0x80000000>,
+	s24ToS32Neon, s32ToS24Neon,
+	s16ToF32Neon, f32ToS16Neon, s32ToF32Neon, f32ToS32Neon,
+	mixS16Neon, dotNeon, matrixNeon
+};
+
+#endif /* DSP_NEON */
+
+const Kernels& detectKernels()
+{
+#ifdef DSP_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return cAvx2Kernels;
+	}
+
+	if (__builtin_cpu_supports("sse2"))
+	{
+		return cSse2Kernels;
+	}
+#endif
+
+#ifdef DSP_NEON
+	return cNeonKernels;
+#endif
+
+	return cScalarKernels;
+}
+
+/*******************************************************************************
+ * Law codecs
+ ******************************************************************************/
+
+int16_t decodeAlaw(uint8_t value)
+{
+	value ^= 0x55;
+
+	int result = (value & 0x0F) << 4;
+	int segment = (value & 0x70) >> 4;
+
+	switch (segment)
+	{
+	case 0:
+		result += 8;
+		break;
+	case 1:
+		result += 0x108;
+		break;
+	default:
+		result += 0x108;
+		result <<= segment - 1;
+		break;
+	}
+
+	return (value & 0x80) ? result : -result;
+}
+
+int16_t decodeMulaw(uint8_t value)
+{
+	value = ~value;
+
+	int result = ((value & 0x0F) << 3) + 0x84;
+
+	result <<= (value & 0x70) >> 4;
+
+	return (value & 0x80) ? (0x84 - result) : (result - 0x84);
+}
+
+int getSegment(int value, const int* segmentEnds)
+{
+	int segment = 0;
+
+	while (segment < 8 && value > segmentEnds[segment])
+	{
+		segment++;
+	}
+
+	return segment;
+}
+
+struct LawTables
+{
+	int16_t alaw[256];
+	int16_t mulaw[256];
+
+	LawTables()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			alaw[i] = decodeAlaw(i);
+			mulaw[i] = decodeMulaw(i);
+		}
+	}
+};
+
+const LawTables cLawTables;
+
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+const Kernels& getKernels()
+{
+	static const Kernels& sKernels = detectKernels();
+
+	return sKernels;
+}
+
+const Kernels& getScalarKernels()
+{
+	return cScalarKernels;
+}
+
+int16_t alawToS16(uint8_t value)
+{
+	return cLawTables.alaw[value];
+}
+
+uint8_t s16ToAlaw(int16_t value)
+{
+	static const int cSegmentEnds[8] =
+		{0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF};
+
+	int sample = value >> 3;
+	int mask = 0xD5;
+
+	if (sample < 0)
+	{
+		mask = 0x55;
+		sample = -sample - 1;
+	}
+
+	int segment = getSegment(sample, cSegmentEnds);
+
+	if (segment >= 8)
+	{
+		return 0x7F ^ mask;
+	}
+
+	int result = segment << 4;
+
+	result |= (sample >> (segment < 2 ? 1 : segment)) & 0x0F;
+
+	return result ^ mask;
+}
+
+int16_t mulawToS16(uint8_t value)
+{
+	return cLawTables.mulaw[value];
+}
+
+uint8_t s16ToMulaw(int16_t value)
+{
+	static const int cSegmentEnds[8] =
+		{0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF};
+
+	int sample = value >> 2;
+	int mask = 0xFF;
+
+	if (sample < 0)
+	{
+		sample = -sample;
+		mask = 0x7F;
+	}
+
+	if (sample > 8159)
+	{
+		sample = 8159;
+	}
+
+	sample += 0x84 >> 2;
+
+	int segment = getSegment(sample, cSegmentEnds);
+
+	if (segment >= 8)
+	{
+		return 0x7F ^ mask;
+	}
+
+	int result = (segment << 4) | ((sample >> (segment + 1)) & 0x0F);
+
+	return result ^ mask;
+}
+
+}
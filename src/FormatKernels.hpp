@@ -0,0 +1,124 @@
+/*
+ *  Sample format conversion kernels
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_FORMATKERNELS_HPP_
+#define SRC_FORMATKERNELS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Dsp {
+
+/**
+ * Converts numSamples samples from src to dst. src and dst may be equal.
+ * @ingroup dsp
+ */
+typedef void (*Kernel)(const void* src, void* dst, size_t numSamples);
+
+/**
+ * Returns dot product of two float vectors of size elements.
+ * @ingroup dsp
+ */
+typedef float (*DotKernel)(const float* a, const float* b, size_t size);
+
+/**
+ * Max number of output channels of the matrix kernel.
+ * @ingroup dsp
+ */
+const size_t cMatrixStride = 8;
+
+/**
+ * Multiplies interleaved frames by the matrix: out = M x in. The matrix has
+ * inChannels rows of cMatrixStride coefficients, one per output channel.
+ * @ingroup dsp
+ */
+typedef void (*MatrixKernel)(const float* in, float* out, const float* matrix,
+							 size_t inChannels, size_t outChannels,
+							 size_t numFrames);
+
+/***************************************************************************//**
+ * Set of sample conversion kernels optimized for one instruction set.
+ *
+ * Float samples are normalized to [-1.0, 1.0). Integer samples are host
+ * endian. Float to integer conversions clamp out of range values.
+ * @ingroup dsp
+ ******************************************************************************/
+struct Kernels
+{
+	const char* isa;	//!< instruction set name
+
+	Kernel swap16;		//!< swaps bytes of 16 bit samples
+	Kernel swap32;		//!< swaps bytes of 32 bit samples
+	Kernel swap64;		//!< swaps bytes of 64 bit samples
+	Kernel flip8;		//!< flips sign of 8 bit samples
+	Kernel flip16;		//!< flips sign of 16 bit samples
+	Kernel flip24;		//!< flips sign of 24 bit samples in 32 bit container
+	Kernel flip32;		//!< flips sign of 32 bit samples
+	Kernel s24ToS32;	//!< 24 bit in 32 bit container to 32 bit
+	Kernel s32ToS24;	//!< 32 bit to 24 bit in 32 bit container
+	Kernel s16ToF32;	//!< 16 bit to float
+	Kernel f32ToS16;	//!< float to 16 bit
+	Kernel s32ToF32;	//!< 32 bit to float
+	Kernel f32ToS32;	//!< float to 32 bit
+	Kernel mixS16;		//!< adds 16 bit src to dst with saturation
+	DotKernel dot;		//!< dot product used by FIR filters
+	MatrixKernel matrix;	//!< channel matrix used by remixer
+};
+
+/**
+ * Returns kernels for the best instruction set supported by the CPU.
+ * The CPU is detected once.
+ * @ingroup dsp
+ */
+const Kernels& getKernels();
+
+/**
+ * Returns portable kernels.
+ * @ingroup dsp
+ */
+const Kernels& getScalarKernels();
+
+/**
+ * Decodes A-law sample.
+ * @ingroup dsp
+ */
+int16_t alawToS16(uint8_t value);
+
+/**
+ * Encodes A-law sample.
+ * @ingroup dsp
+ */
+uint8_t s16ToAlaw(int16_t value);
+
+/**
+ * Decodes mu-law sample.
+ * @ingroup dsp
+ */
+int16_t mulawToS16(uint8_t value);
+
+/**
+ * Encodes mu-law sample.
+ * @ingroup dsp
+ */
+uint8_t s16ToMulaw(int16_t value);
+
+}
+
+#endif /* SRC_FORMATKERNELS_HPP_ */
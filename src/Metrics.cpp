@@ -0,0 +1,407 @@
+/*
+ *  Runtime metrics
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <xen/be/Exception.hpp>
+
+using std::lock_guard;
+using std::mutex;
+using std::ostringstream;
+using std::string;
+using std::thread;
+using std::vector;
+
+using XenBackend::Exception;
+
+namespace Metrics {
+
+namespace {
+
+// time to wait for the request before the metrics are sent as plain text
+const int cRequestTimeoutMs = 100;
+
+string escape(const string& value)
+{
+	string result;
+
+	for (auto c : value)
+	{
+		switch(c)
+		{
+		case '\\':
+			result += "\\\\";
+			break;
+		case '"':
+			result += "\\\"";
+			break;
+		case '\n':
+			result += "\\n";
+			break;
+		default:
+			result += c;
+		}
+	}
+
+	return result;
+}
+
+}
+
+/*******************************************************************************
+ * Registry
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+Registry& Registry::getInstance()
+{
+	static Registry sRegistry;
+
+	return sRegistry;
+}
+
+void Registry::add(const string& name, const string& help, Type type,
+				   const Labels& labels, MetricPtr metric)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	removeExpired();
+
+	mEntries.push_back({name, help, type, labels, metric});
+}
+
+string Registry::format()
+{
+	vector<Entry> entries;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		removeExpired();
+
+		entries = mEntries;
+	}
+
+	std::stable_sort(entries.begin(), entries.end(),
+					 [](const Entry& lhs, const Entry& rhs)
+					 { return lhs.name < rhs.name; });
+
+	ostringstream stream;
+	string name;
+
+	for (auto& entry : entries)
+	{
+		auto metric = entry.metric.lock();
+
+		if (!metric)
+		{
+			continue;
+		}
+
+		if (entry.name != name)
+		{
+			name = entry.name;
+
+			stream << "# HELP " << name << " " << entry.help << "\n"
+				   << "# TYPE " << name << " "
+				   << (entry.type == Type::COUNTER ? "counter" : "gauge")
+				   << "\n";
+		}
+
+		stream << name << formatLabels(entry.labels) << " "
+			   << metric->get() << "\n";
+	}
+
+	return stream.str();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void Registry::removeExpired()
+{
+	mEntries.erase(std::remove_if(mEntries.begin(), mEntries.end(),
+								  [](const Entry& entry)
+								  { return entry.metric.expired(); }),
+				   mEntries.end());
+}
+
+string Registry::formatLabels(const Labels& labels)
+{
+	vector<string> items;
+
+	if (!labels.domId.empty())
+	{
+		items.push_back("dom=\"" + escape(labels.domId) + "\"");
+	}
+
+	if (!labels.devId.empty())
+	{
+		items.push_back("dev=\"" + escape(labels.devId) + "\"");
+	}
+
+	if (!labels.streamId.empty())
+	{
+		items.push_back("stream=\"" + escape(labels.streamId) + "\"");
+	}
+
+	if (items.empty())
+	{
+		return "";
+	}
+
+	string result = "{";
+
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		result += (i ? "," : "") + items[i];
+	}
+
+	return result + "}";
+}
+
+/*******************************************************************************
+ * PcmMetrics
+ ******************************************************************************/
+
+PcmMetrics::PcmMetrics() :
+	xruns(std::make_shared<Metric>()),
+	writtenBytes(std::make_shared<Metric>()),
+	capturedBytes(std::make_shared<Metric>())
+{
+}
+
+void PcmMetrics::publish(const Labels& labels)
+{
+	auto& registry = Registry::getInstance();
+
+	registry.add("snd_be_pcm_xruns_total",
+				 "Number of device underruns and overruns",
+				 Registry::Type::COUNTER, labels, xruns);
+	registry.add("snd_be_pcm_written_bytes_total",
+				 "Number of bytes written to the device",
+				 Registry::Type::COUNTER, labels, writtenBytes);
+	registry.add("snd_be_pcm_captured_bytes_total",
+				 "Number of bytes read from the device",
+				 Registry::Type::COUNTER, labels, capturedBytes);
+}
+
+/*******************************************************************************
+ * Server
+ ******************************************************************************/
+
+Server::Server(const string& path) :
+	mPath(path),
+	mSocketFd(-1),
+	mEventFd(-1),
+	mLog("MetricsServer")
+{
+	try
+	{
+		sockaddr_un addr {};
+
+		if (mPath.size() >= sizeof(addr.sun_path))
+		{
+			throw Exception("Socket path is too long: " + mPath, ENAMETOOLONG);
+		}
+
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, mPath.c_str(), sizeof(addr.sun_path) - 1);
+
+		if ((mSocketFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+								SOCK_CLOEXEC, 0)) < 0)
+		{
+			throw Exception("Can't create metrics socket", errno);
+		}
+
+		// remove the socket left by the previous run
+		unlink(mPath.c_str());
+
+		if (bind(mSocketFd, reinterpret_cast<sockaddr*>(&addr),
+				 sizeof(addr)) < 0)
+		{
+			throw Exception("Can't bind metrics socket: " + mPath, errno);
+		}
+
+		if (listen(mSocketFd, 4) < 0)
+		{
+			throw Exception("Can't listen metrics socket: " + mPath, errno);
+		}
+
+		if ((mEventFd = eventfd(0, EFD_CLOEXEC)) < 0)
+		{
+			throw Exception("Can't create eventfd", errno);
+		}
+	}
+	catch(const std::exception& e)
+	{
+		release();
+
+		throw;
+	}
+
+	mThread = thread(&Server::run, this);
+
+	LOG(mLog, INFO) << "Serve metrics on: " << mPath;
+}
+
+Server::~Server()
+{
+	uint64_t value = 1;
+
+	if (::write(mEventFd, &value, sizeof(value)) < 0)
+	{
+		LOG(mLog, ERROR) << "Can't wake up metrics thread";
+	}
+
+	mThread.join();
+
+	release();
+
+	LOG(mLog, DEBUG) << "Delete metrics server";
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void Server::run()
+{
+	while(true)
+	{
+		pollfd fds[] = {{mSocketFd, POLLIN, 0}, {mEventFd, POLLIN, 0}};
+
+		if (poll(fds, 2, -1) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			LOG(mLog, ERROR) << "Wait for clients failed: " << strerror(errno);
+
+			break;
+		}
+
+		if (fds[1].revents)
+		{
+			break;
+		}
+
+		int fd;
+
+		while((fd = accept4(mSocketFd, nullptr, nullptr,
+							SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+		{
+			serve(fd);
+
+			::close(fd);
+		}
+	}
+}
+
+void Server::serve(int fd)
+{
+	char request[4096];
+	ssize_t size = 0;
+
+	pollfd fds[] = {{fd, POLLIN, 0}, {mEventFd, POLLIN, 0}};
+
+	if (poll(fds, 2, cRequestTimeoutMs) > 0 && fds[0].revents)
+	{
+		size = ::read(fd, request, sizeof(request));
+	}
+
+	auto body = Registry::getInstance().format();
+	string response;
+
+	if (size >= 4 && string(request, 4) == "GET ")
+	{
+		response = "HTTP/1.0 200 OK\r\n"
+				   "Content-Type: text/plain; version=0.0.4\r\n"
+				   "Content-Length: " + std::to_string(body.size()) +
+				   "\r\n\r\n" + body;
+	}
+	else
+	{
+		response = body;
+	}
+
+	size_t offset = 0;
+
+	while(offset < response.size())
+	{
+		auto written = send(fd, &response[offset], response.size() - offset,
+							MSG_NOSIGNAL);
+
+		if (written >= 0)
+		{
+			offset += written;
+		}
+		else if ((errno != EAGAIN && errno != EINTR) ||
+				 !waitFd(fd, POLLOUT))
+		{
+			DLOG(mLog, DEBUG) << "Client is gone: " << strerror(errno);
+
+			break;
+		}
+	}
+}
+
+bool Server::waitFd(int fd, short events)
+{
+	pollfd fds[] = {{fd, events, 0}, {mEventFd, POLLIN, 0}};
+
+	return poll(fds, 2, cTimeoutMs) > 0 && !fds[1].revents;
+}
+
+void Server::release()
+{
+	if (mSocketFd >= 0)
+	{
+		::close(mSocketFd);
+
+		unlink(mPath.c_str());
+	}
+
+	if (mEventFd >= 0)
+	{
+		::close(mEventFd);
+	}
+
+	mSocketFd = mEventFd = -1;
+}
+
+}
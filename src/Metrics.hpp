@@ -0,0 +1,206 @@
+/*
+ *  Runtime metrics
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_METRICS_HPP_
+#define SRC_METRICS_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <xen/be/Log.hpp>
+
+namespace Metrics {
+
+/***************************************************************************//**
+ * Labels which identify the metrics of a stream.
+ * @ingroup snd_be
+ ******************************************************************************/
+struct Labels
+{
+	std::string domId;
+	std::string devId;
+	std::string streamId;
+};
+
+/***************************************************************************//**
+ * Metric value.
+ *
+ * The value is owned by the publisher and updated with relaxed atomics, so
+ * updates on the audio path don't take any lock.
+ * @ingroup snd_be
+ ******************************************************************************/
+class Metric
+{
+public:
+
+	Metric() : mValue(0) {}
+
+	/**
+	 * Increments the value.
+	 * @param value increment
+	 */
+	void inc(uint64_t value = 1)
+	{
+		mValue.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	/**
+	 * Sets the value.
+	 * @param value new value
+	 */
+	void set(uint64_t value) { mValue.store(value, std::memory_order_relaxed); }
+
+	/**
+	 * Returns the value.
+	 */
+	uint64_t get() const { return mValue.load(std::memory_order_relaxed); }
+
+private:
+
+	std::atomic<uint64_t> mValue;
+};
+
+typedef std::shared_ptr<Metric> MetricPtr;
+
+/***************************************************************************//**
+ * Registry of the published metrics.
+ *
+ * The registry keeps weak references: a metric disappears from the output
+ * once its publisher releases it.
+ * @ingroup snd_be
+ ******************************************************************************/
+class Registry
+{
+public:
+
+	enum class Type
+	{
+		COUNTER,
+		GAUGE
+	};
+
+	/**
+	 * Returns the registry shared by all publishers of the process.
+	 */
+	static Registry& getInstance();
+
+	/**
+	 * Publishes the metric.
+	 * @param name   metric name
+	 * @param help   metric description
+	 * @param type   metric type
+	 * @param labels metric labels
+	 * @param metric metric value
+	 */
+	void add(const std::string& name, const std::string& help, Type type,
+			 const Labels& labels, MetricPtr metric);
+
+	/**
+	 * Returns all metrics in Prometheus text format.
+	 */
+	std::string format();
+
+private:
+
+	struct Entry
+	{
+		std::string name;
+		std::string help;
+		Type type;
+		Labels labels;
+		std::weak_ptr<Metric> metric;
+	};
+
+	std::vector<Entry> mEntries;
+	std::mutex mMutex;
+
+	Registry() = default;
+
+	void removeExpired();
+	static std::string formatLabels(const Labels& labels);
+};
+
+/***************************************************************************//**
+ * Metrics of a pcm device.
+ *
+ * The metrics are updated whether published or not: devices used internally,
+ * e.g. by the mixer, are not published.
+ * @ingroup snd_be
+ ******************************************************************************/
+struct PcmMetrics
+{
+	MetricPtr xruns;
+	MetricPtr writtenBytes;
+	MetricPtr capturedBytes;
+
+	PcmMetrics();
+
+	/**
+	 * Publishes the metrics.
+	 * @param labels metric labels
+	 */
+	void publish(const Labels& labels);
+};
+
+/***************************************************************************//**
+ * Serves the registry over a UNIX domain socket.
+ *
+ * Each connection gets the metrics in Prometheus text format. If the client
+ * sends an HTTP request, the metrics are wrapped into an HTTP response. The
+ * server runs its own thread with non-blocking sockets and reads metric
+ * values only, so a slow client never blocks the audio path.
+ * @ingroup snd_be
+ ******************************************************************************/
+class Server
+{
+public:
+
+	/**
+	 * @param path socket path
+	 */
+	explicit Server(const std::string& path);
+	~Server();
+
+private:
+
+	static const int cTimeoutMs = 1000;
+
+	std::string mPath;
+
+	int mSocketFd;
+	int mEventFd;
+	std::thread mThread;
+
+	XenBackend::Log mLog;
+
+	void run();
+	void serve(int fd);
+	bool waitFd(int fd, short events);
+	void release();
+};
+
+}
+
+#endif /* SRC_METRICS_HPP_ */
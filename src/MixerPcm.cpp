@@ -0,0 +1,601 @@
+/*
+ *  Mixer pcm device
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "MixerPcm.hpp"
+
+#include <algorithm>
+
+#include <xen/be/Exception.hpp>
+#include <xen/io/sndif.h>
+
+#include "AlsaPcm.hpp"
+#include "FormatKernels.hpp"
+#include "ProcessingPcm.hpp"
+#include "RealTime.hpp"
+
+using std::fill;
+using std::find;
+using std::lock_guard;
+using std::max;
+using std::min;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::unique_lock;
+
+using std::chrono::microseconds;
+
+using SoundItf::PcmDevicePtr;
+using SoundItf::PcmParamRanges;
+using SoundItf::PcmParams;
+using SoundItf::StreamType;
+
+namespace Mix {
+
+namespace {
+
+const int cRtPriority = 50;
+
+// max number of waits for the mixing thread on stop and close
+const int cMaxWaits = 100;
+
+const microseconds cPeriodTime(Mixer::cPeriodFrames * 1000000ull /
+							   Mixer::cRate);
+
+}
+
+/*******************************************************************************
+ * Mixer
+ ******************************************************************************/
+
+mutex Mixer::sMutex;
+std::map<string, std::weak_ptr<Mixer>> Mixer::sMixers;
+
+Mixer::Mixer(const string& deviceName) :
+	mDeviceName(deviceName),
+	mTerminate(false),
+	mMixBuffer(cPeriodFrames * cNumChannels),
+	mInputBuffer(cPeriodFrames * cNumChannels),
+	mDeviceFrames(0),
+	mLog("Mixer")
+{
+	mInputs.reserve(cMaxInputs);
+
+	LOG(mLog, DEBUG) << "Create mixer, device: " << mDeviceName;
+}
+
+Mixer::~Mixer()
+{
+	stop();
+
+	LOG(mLog, DEBUG) << "Delete mixer, device: " << mDeviceName;
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+shared_ptr<Mixer> Mixer::get(const string& deviceName)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	auto mixer = sMixers[deviceName].lock();
+
+	if (!mixer)
+	{
+		mixer.reset(new Mixer(deviceName));
+
+		sMixers[deviceName] = mixer;
+	}
+
+	return mixer;
+}
+
+uint8_t Mixer::getFormat()
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return XENSND_PCM_FORMAT_S16_BE;
+#else
+	return XENSND_PCM_FORMAT_S16_LE;
+#endif
+}
+
+void Mixer::addInput(MixerPcm* input)
+{
+	lock_guard<mutex> openLock(mOpenMutex);
+
+	bool first = false;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		if (mInputs.size() == cMaxInputs)
+		{
+			throw XenBackend::Exception("Too many mixer inputs: " +
+										mDeviceName, EBUSY);
+		}
+
+		first = mInputs.empty();
+	}
+
+	if (first)
+	{
+		start();
+	}
+
+	lock_guard<mutex> lock(mMutex);
+
+	// the mixing thread consumes the inputs under the lock, so the ring is
+	// reset on the consumer side before it is consumed
+	input->mRing.clear();
+
+	mInputs.push_back(input);
+
+	LOG(mLog, DEBUG) << "Add input, device: " << mDeviceName
+					 << ", inputs: " << mInputs.size();
+}
+
+void Mixer::removeInput(MixerPcm* input)
+{
+	lock_guard<mutex> openLock(mOpenMutex);
+
+	bool last = false;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		auto it = find(mInputs.begin(), mInputs.end(), input);
+
+		if (it == mInputs.end())
+		{
+			return;
+		}
+
+		mInputs.erase(it);
+
+		last = mInputs.empty();
+
+		LOG(mLog, DEBUG) << "Remove input, device: " << mDeviceName
+						 << ", inputs: " << mInputs.size();
+	}
+
+	if (last)
+	{
+		stop();
+	}
+}
+
+void Mixer::waitConsumed()
+{
+	unique_lock<mutex> lock(mWaitMutex);
+
+	// the mixer notifies without the lock: don't rely on the notification
+	mWaitCondVar.wait_for(lock, cPeriodTime * 2);
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void Mixer::start()
+{
+	LOG(mLog, DEBUG) << "Start mixing, device: " << mDeviceName;
+
+	if (!mPcmDevice)
+	{
+		mPcmDevice.reset(new Dsp::ProcessingPcm(
+				PcmDevicePtr(new Alsa::AlsaPcm(StreamType::PLAYBACK,
+											   mDeviceName)),
+				StreamType::PLAYBACK));
+	}
+
+	mPcmDevice->open({cRate, getFormat(), cNumChannels,
+					  cPeriodFrames * cNumPeriods * cFrameSize,
+					  cPeriodFrames * cFrameSize});
+
+	mPcmDevice->setProgressCbk([this] (uint64_t bytes)
+							   { progressCbk(bytes); });
+
+	mDeviceFrames = 0;
+	mTerminate = false;
+
+	mThread = thread(&Mixer::run, this);
+}
+
+void Mixer::stop()
+{
+	if (!mThread.joinable())
+	{
+		return;
+	}
+
+	LOG(mLog, DEBUG) << "Stop mixing, device: " << mDeviceName;
+
+	mTerminate = true;
+
+	mThread.join();
+
+	mPcmDevice->close();
+}
+
+void Mixer::run()
+{
+	RealTime::setupThread(RealTime::ThreadClass::MIXER, cRtPriority);
+
+	try
+	{
+		// prefill half of the device buffer before starting it
+		for (uint32_t i = 0; i < cNumPeriods / 2; i++)
+		{
+			mixPeriod();
+		}
+
+		mPcmDevice->start();
+	}
+	catch(const std::exception& e)
+	{
+		LOG(mLog, ERROR) << "Can't start device " << mDeviceName << ": "
+						 << e.what();
+	}
+
+	while(!mTerminate)
+	{
+		try
+		{
+			mixPeriod();
+		}
+		catch(const std::exception& e)
+		{
+			LOG(mLog, ERROR) << "Mixing failed, device: " << mDeviceName
+							 << ": " << e.what();
+
+			std::this_thread::sleep_for(cPeriodTime);
+		}
+	}
+}
+
+void Mixer::mixPeriod()
+{
+	auto mix = Dsp::getKernels().mixS16;
+
+	fill(mMixBuffer.begin(), mMixBuffer.end(), 0);
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		for (auto input : mInputs)
+		{
+			auto numFrames = input->consume(mInputBuffer.data(), cPeriodFrames,
+											mDeviceFrames);
+
+			if (numFrames)
+			{
+				mix(mInputBuffer.data(), mMixBuffer.data(),
+					numFrames * cNumChannels);
+			}
+		}
+	}
+
+	mWaitCondVar.notify_all();
+
+	mPcmDevice->write(reinterpret_cast<uint8_t*>(mMixBuffer.data()),
+					  cPeriodFrames * cFrameSize);
+
+	mDeviceFrames += cPeriodFrames;
+}
+
+void Mixer::progressCbk(uint64_t bytes)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	for (auto input : mInputs)
+	{
+		input->played(bytes / cFrameSize);
+	}
+}
+
+/*******************************************************************************
+ * MixerPcm
+ ******************************************************************************/
+
+MixerPcm::MixerPcm(const string& deviceName) :
+	mDeviceName(deviceName.empty() ? "default" : deviceName),
+	mMixer(Mixer::get(mDeviceName)),
+	mRing(cRingFrames * Mixer::cNumChannels),
+	mState(State::CLOSED),
+	mGeneration(0),
+	mFlush(false),
+	mFrames(0),
+	mMarkPos(0),
+	mNumMarks(0),
+	mLog("MixerPcm")
+{
+	LOG(mLog, DEBUG) << "Create mixer pcm device: " << mDeviceName;
+}
+
+MixerPcm::~MixerPcm()
+{
+	LOG(mLog, DEBUG) << "Delete mixer pcm device: " << mDeviceName;
+
+	close();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void MixerPcm::queryHwRanges(PcmParamRanges& req, PcmParamRanges& resp)
+{
+	resp = req;
+
+	resp.formats = req.formats & (1ull << Mixer::getFormat());
+
+	resp.rates.min = resp.rates.max = Mixer::cRate;
+	resp.channels.min = resp.channels.max = Mixer::cNumChannels;
+
+	resp.buffer.min = max(req.buffer.min, Mixer::cPeriodFrames * 2);
+	resp.buffer.max = min(req.buffer.max,
+						  static_cast<unsigned int>(cRingFrames));
+
+	resp.period.min = max(req.period.min, Mixer::cPeriodFrames);
+	resp.period.max = min(req.period.max,
+						  static_cast<unsigned int>(cRingFrames / 2));
+
+	if (!resp.formats ||
+		req.rates.min > Mixer::cRate || req.rates.max < Mixer::cRate ||
+		req.channels.min > Mixer::cNumChannels ||
+		req.channels.max < Mixer::cNumChannels ||
+		resp.buffer.min > resp.buffer.max ||
+		resp.period.min > resp.period.max)
+	{
+		throw XenBackend::Exception("Parameters are not supported by mixer: " +
+									mDeviceName, EINVAL);
+	}
+}
+
+void MixerPcm::open(const PcmParams& params)
+{
+	if (params.format != Mixer::getFormat() || params.rate != Mixer::cRate ||
+		params.numChannels != Mixer::cNumChannels)
+	{
+		throw XenBackend::Exception("Parameters are not supported by mixer: " +
+									mDeviceName, EINVAL);
+	}
+
+	close();
+
+	DLOG(mLog, DEBUG) << "Open mixer pcm device: " << mDeviceName;
+
+	// the ring is cleared when the input is added
+	mFlush = false;
+	mFrames = 0;
+	mMarkPos = 0;
+	mNumMarks = 0;
+	mState = State::STOPPED;
+
+	try
+	{
+		mMixer->addInput(this);
+	}
+	catch(const std::exception& e)
+	{
+		mState = State::CLOSED;
+
+		throw;
+	}
+}
+
+void MixerPcm::close()
+{
+	if (mState == State::CLOSED)
+	{
+		return;
+	}
+
+	DLOG(mLog, DEBUG) << "Close mixer pcm device: " << mDeviceName;
+
+	// as alsa close does, let the written data to be played
+	for (int i = 0; i < cMaxWaits && mState == State::RUNNING &&
+		 mRing.getReadAvailable(); i++)
+	{
+		mMixer->waitConsumed();
+	}
+
+	mState = State::CLOSED;
+
+	mMixer->removeInput(this);
+}
+
+void MixerPcm::read(uint8_t* buffer, size_t size)
+{
+	throw XenBackend::Exception("Mixer doesn't support capture: " +
+								mDeviceName, EINVAL);
+}
+
+void MixerPcm::write(uint8_t* buffer, size_t size)
+{
+	if (mState == State::CLOSED)
+	{
+		throw XenBackend::Exception("Mixer device is not opened: " +
+									mDeviceName, EFAULT);
+	}
+
+	auto generation = mGeneration.load();
+	auto samples = reinterpret_cast<const int16_t*>(buffer);
+	auto numSamples = size / sizeof(int16_t);
+
+	while(numSamples)
+	{
+		auto written = mRing.write(samples, numSamples);
+
+		samples += written;
+		numSamples -= written;
+
+		if (!numSamples)
+		{
+			break;
+		}
+
+		// stop releases the write in progress
+		if (mGeneration != generation)
+		{
+			DLOG(mLog, DEBUG) << "Drop data of stopped device: " << mDeviceName;
+
+			return;
+		}
+
+		auto state = State::STOPPED;
+
+		if (mState.compare_exchange_strong(state, State::RUNNING))
+		{
+			LOG(mLog, DEBUG) << "Start on full ring: " << mDeviceName;
+		}
+
+		mMixer->waitConsumed();
+	}
+}
+
+void MixerPcm::start()
+{
+	LOG(mLog, DEBUG) << "Start";
+
+	if (mState == State::CLOSED)
+	{
+		throw XenBackend::Exception("Mixer device is not opened: " +
+									mDeviceName, EFAULT);
+	}
+
+	mState = State::RUNNING;
+}
+
+void MixerPcm::stop()
+{
+	LOG(mLog, DEBUG) << "Stop";
+
+	if (mState == State::CLOSED)
+	{
+		throw XenBackend::Exception("Mixer device is not opened: " +
+									mDeviceName, EFAULT);
+	}
+
+	mState = State::STOPPED;
+	mGeneration++;
+
+	flush();
+}
+
+void MixerPcm::pause()
+{
+	LOG(mLog, DEBUG) << "Pause";
+
+	auto state = State::RUNNING;
+
+	if (!mState.compare_exchange_strong(state, State::PAUSED))
+	{
+		throw XenBackend::Exception("Mixer device is not running: " +
+									mDeviceName, EFAULT);
+	}
+}
+
+void MixerPcm::resume()
+{
+	LOG(mLog, DEBUG) << "Resume";
+
+	auto state = State::PAUSED;
+
+	if (!mState.compare_exchange_strong(state, State::RUNNING))
+	{
+		throw XenBackend::Exception("Mixer device is not paused: " +
+									mDeviceName, EFAULT);
+	}
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+size_t MixerPcm::consume(int16_t* buffer, size_t numFrames,
+						 uint64_t deviceFrame)
+{
+	if (mFlush)
+	{
+		mRing.clear();
+		mFlush = false;
+	}
+
+	if (mState != State::RUNNING)
+	{
+		return 0;
+	}
+
+	numFrames = mRing.read(buffer, numFrames * Mixer::cNumChannels) /
+				Mixer::cNumChannels;
+
+	if (!numFrames)
+	{
+		return 0;
+	}
+
+	mFrames += numFrames;
+
+	// when marks are full the last one is moved forward
+	if (mNumMarks < cMaxMarks)
+	{
+		mNumMarks++;
+	}
+
+	mMarks[(mMarkPos + mNumMarks - 1) % cMaxMarks] =
+			{deviceFrame + numFrames, mFrames};
+
+	return numFrames;
+}
+
+void MixerPcm::played(uint64_t deviceFrame)
+{
+	uint64_t frame = 0;
+	bool progress = false;
+
+	while(mNumMarks && mMarks[mMarkPos].deviceFrame <= deviceFrame)
+	{
+		frame = mMarks[mMarkPos].frame;
+		progress = true;
+
+		mMarkPos = (mMarkPos + 1) % cMaxMarks;
+		mNumMarks--;
+	}
+
+	if (progress && mProgressCbk)
+	{
+		mProgressCbk(frame * Mixer::cFrameSize);
+	}
+}
+
+void MixerPcm::flush()
+{
+	mFlush = true;
+
+	for (int i = 0; i < cMaxWaits && mFlush; i++)
+	{
+		mMixer->waitConsumed();
+	}
+}
+
+}
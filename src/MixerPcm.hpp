@@ -0,0 +1,259 @@
+/*
+ *  Mixer pcm device
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_MIXERPCM_HPP_
+#define SRC_MIXERPCM_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <xen/be/Log.hpp>
+
+#include "SoundItf.hpp"
+#include "SpscRing.hpp"
+
+namespace Mix {
+
+/***************************************************************************//**
+ * @defgroup mix
+ * Software mixer related classes.
+ ******************************************************************************/
+
+class MixerPcm;
+
+/***************************************************************************//**
+ * Mixes playback streams into one pcm device.
+ *
+ * One mixer exists per device name. The device is opened when the first
+ * input is opened and closed when the last one is closed. The mixing thread
+ * owns the device: each period it takes the frames available in the rings
+ * of running inputs, sums them with saturation and writes the result to the
+ * device. Writes to the device pace the thread. The mix format is fixed,
+ * the device is wrapped with the processing pcm device to convert it to what
+ * the hardware supports.
+ * @ingroup mix
+ ******************************************************************************/
+class Mixer
+{
+public:
+
+	static const uint32_t cRate = 48000;
+	static const uint8_t cNumChannels = 2;
+	static const uint32_t cPeriodFrames = 240;
+	static const uint32_t cNumPeriods = 4;
+	static const size_t cFrameSize = cNumChannels * sizeof(int16_t);
+
+	/**
+	 * Returns the mixer of the device. Creates it if it doesn't exist.
+	 * @param deviceName alsa pcm device name
+	 */
+	static std::shared_ptr<Mixer> get(const std::string& deviceName);
+
+	/**
+	 * Returns host endian S16 sndif format used for mixing.
+	 */
+	static uint8_t getFormat();
+
+	/**
+	 * @param deviceName alsa pcm device name
+	 */
+	explicit Mixer(const std::string& deviceName);
+	~Mixer();
+
+	/**
+	 * Adds input to the mix. Opens the device if it is the first input.
+	 * @param input mixer pcm device
+	 */
+	void addInput(MixerPcm* input);
+
+	/**
+	 * Removes input from the mix. Closes the device if it is the last input.
+	 * @param input mixer pcm device
+	 */
+	void removeInput(MixerPcm* input);
+
+	/**
+	 * Waits until the mixing thread consumes data or timeout expires.
+	 */
+	void waitConsumed();
+
+private:
+
+	static const size_t cMaxInputs = 32;
+
+	static std::mutex sMutex;
+	static std::map<std::string, std::weak_ptr<Mixer>> sMixers;
+
+	std::string mDeviceName;
+	SoundItf::PcmDevicePtr mPcmDevice;
+
+	// serializes adding and removing inputs
+	std::mutex mOpenMutex;
+
+	std::vector<MixerPcm*> mInputs;
+	std::mutex mMutex;
+
+	std::thread mThread;
+	std::atomic<bool> mTerminate;
+	std::mutex mWaitMutex;
+	std::condition_variable mWaitCondVar;
+
+	std::vector<int16_t> mMixBuffer;
+	std::vector<int16_t> mInputBuffer;
+	uint64_t mDeviceFrames;
+
+	XenBackend::Log mLog;
+
+	void start();
+	void stop();
+	void run();
+	void mixPeriod();
+	void progressCbk(uint64_t bytes);
+};
+
+/***************************************************************************//**
+ * Playback stream mixed by the mixer of the device.
+ *
+ * Accepts mix format only: frames are written to the SPSC ring read by the
+ * mixing thread. Write blocks while the ring is full. As the alsa start
+ * threshold does, a full ring starts the stopped input. The position reported
+ * through the progress callback is the number of frames of this input which
+ * were played by the device.
+ * @ingroup mix
+ ******************************************************************************/
+class MixerPcm : public SoundItf::PcmDevice
+{
+public:
+
+	/**
+	 * @param deviceName alsa pcm device name
+	 */
+	explicit MixerPcm(const std::string& deviceName);
+	~MixerPcm();
+
+	/**
+	 * Queries the device for HW intervals and masks.
+	 * @req HW parameters that the frontend wants to set
+	 * @resp refined HW parameters that backend can support
+	 */
+	void queryHwRanges(SoundItf::PcmParamRanges& req,
+					   SoundItf::PcmParamRanges& resp) override;
+
+	/**
+	 * Opens the device.
+	 * @param params pcm parameters
+	 */
+	void open(const SoundItf::PcmParams& params) override;
+
+	/**
+	 * Closes the device.
+	 */
+	void close() override;
+
+	/**
+	 * Reads data from the device.
+	 * @param buffer buffer where to put data
+	 * @param size   number of bytes to read
+	 */
+	void read(uint8_t* buffer, size_t size) override;
+
+	/**
+	 * Writes data to the device.
+	 * @param buffer buffer with data
+	 * @param size   number of bytes to write
+	 */
+	void write(uint8_t* buffer, size_t size) override;
+
+	/**
+	 * Starts the pcm device.
+	 */
+	void start() override;
+
+	/**
+	 * Stops the pcm device.
+	 */
+	void stop() override;
+
+	/**
+	 * Pauses the pcm device.
+	 */
+	void pause() override;
+
+	/**
+	 * Resumes the pcm device.
+	 */
+	void resume() override;
+
+	/**
+	 * Sets progress callback.
+	 * @param cbk callback
+	 */
+	void setProgressCbk(SoundItf::ProgressCbk cbk) override
+	{
+		mProgressCbk = cbk;
+	}
+
+private:
+
+	friend class Mixer;
+
+	static const size_t cRingFrames = 16384;
+	static const size_t cMaxMarks = 16;
+
+	enum class State {CLOSED, STOPPED, RUNNING, PAUSED};
+
+	// device frame at which the input frame will be played
+	struct Mark
+	{
+		uint64_t deviceFrame;
+		uint64_t frame;
+	};
+
+	std::string mDeviceName;
+	std::shared_ptr<Mixer> mMixer;
+	SpscRing<int16_t> mRing;
+
+	std::atomic<State> mState;
+	std::atomic<uint32_t> mGeneration;
+	std::atomic<bool> mFlush;
+
+	SoundItf::ProgressCbk mProgressCbk;
+
+	// accessed by the mixer under its mutex
+	uint64_t mFrames;
+	Mark mMarks[cMaxMarks];
+	size_t mMarkPos;
+	size_t mNumMarks;
+
+	XenBackend::Log mLog;
+
+	size_t consume(int16_t* buffer, size_t numFrames, uint64_t deviceFrame);
+	void played(uint64_t deviceFrame);
+	void flush();
+};
+
+}
+
+#endif /* SRC_MIXERPCM_HPP_ */
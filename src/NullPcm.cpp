@@ -0,0 +1,404 @@
+/*
+ *  Null pcm device
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "NullPcm.hpp"
+
+#include <errno.h>
+
+#include <xen/be/Exception.hpp>
+
+#include "FormatConverter.hpp"
+
+using std::bind;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+using XenBackend::Exception;
+
+using SoundItf::PcmParamRanges;
+using SoundItf::PcmParams;
+using SoundItf::StreamType;
+
+using Dsp::FormatConverter;
+
+namespace Null {
+
+/*******************************************************************************
+ * NullPcm
+ ******************************************************************************/
+
+NullPcm::NullPcm(StreamType type, bool realTime) :
+	mType(type),
+	mParams {},
+	mRealTime(realTime),
+	mOpened(false),
+	mRunning(false),
+	mXrun(false),
+	mGeneration(0),
+	mBytesPerSecond(0),
+	mFrameSize(0),
+	mPosition(0),
+	mClockBase(0),
+	mTimer(bind(&NullPcm::timerCbk, this)),
+	mTimerPeriod(0),
+	mLog("NullPcm")
+{
+	LOG(mLog, DEBUG) << "Create pcm device, real time: " << mRealTime;
+}
+
+NullPcm::~NullPcm()
+{
+	mTimer.stop();
+
+	LOG(mLog, DEBUG) << "Delete pcm device";
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void NullPcm::queryHwRanges(PcmParamRanges& req, PcmParamRanges& resp)
+{
+	resp = req;
+
+	resp.formats = req.formats & FormatConverter::getSupportedFormats();
+}
+
+void NullPcm::open(const PcmParams& params)
+{
+	auto frameSize = FormatConverter::getSampleSize(params.format) *
+					 params.numChannels;
+
+	if (!frameSize || !params.rate)
+	{
+		throw Exception("Invalid pcm parameters", EINVAL);
+	}
+
+	LOG(mLog, DEBUG) << "Open pcm device, rate: " << params.rate
+					 << ", format: " << static_cast<int>(params.format)
+					 << ", channels: " << static_cast<int>(params.numChannels)
+					 << ", buffer: " << params.bufferSize
+					 << ", period: " << params.periodSize;
+
+	openData(params);
+
+	lock_guard<mutex> lock(mMutex);
+
+	mParams = params;
+	mFrameSize = frameSize;
+	mBytesPerSecond = static_cast<uint64_t>(params.rate) * frameSize;
+	mPosition = 0;
+	mClockBase = 0;
+	mRunning = false;
+	mXrun = false;
+	mOpened = true;
+
+	auto periodSize = params.periodSize ? params.periodSize :
+										  params.bufferSize / 4;
+
+	mTimerPeriod = microseconds(periodSize * 1000000ull / mBytesPerSecond);
+}
+
+void NullPcm::close()
+{
+	LOG(mLog, DEBUG) << "Close pcm device";
+
+	mTimer.stop();
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		if (!mOpened)
+		{
+			return;
+		}
+
+		mOpened = false;
+		mRunning = false;
+		mGeneration++;
+	}
+
+	mCondVar.notify_all();
+
+	closeData();
+}
+
+void NullPcm::read(uint8_t* buffer, size_t size)
+{
+	uint64_t position;
+
+	{
+		unique_lock<mutex> lock(mMutex);
+
+		if (!mOpened)
+		{
+			throw Exception("Device is not opened", EFAULT);
+		}
+
+		// the data is read once the clock has captured it
+		if (mRealTime)
+		{
+			waitClock(lock, mPosition + size);
+		}
+
+		position = mPosition += size;
+		mXrun = false;
+	}
+
+	readData(buffer, size);
+
+	mMetrics.capturedBytes->inc(size);
+
+	if (!mRealTime)
+	{
+		reportProgress(position);
+	}
+}
+
+void NullPcm::write(uint8_t* buffer, size_t size)
+{
+	uint64_t position;
+
+	{
+		unique_lock<mutex> lock(mMutex);
+
+		if (!mOpened)
+		{
+			throw Exception("Device is not opened", EFAULT);
+		}
+
+		// the data is written once it fits into the buffer
+		if (mRealTime && mPosition + size > mParams.bufferSize)
+		{
+			waitClock(lock, mPosition + size - mParams.bufferSize);
+		}
+
+		position = mPosition += size;
+		mXrun = false;
+	}
+
+	writeData(buffer, size);
+
+	mMetrics.writtenBytes->inc(size);
+
+	if (!mRealTime)
+	{
+		reportProgress(position);
+	}
+}
+
+void NullPcm::start()
+{
+	LOG(mLog, DEBUG) << "Start";
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		if (!mOpened)
+		{
+			throw Exception("Device is not opened", EFAULT);
+		}
+
+		restartClock(0);
+
+		mRunning = true;
+		mXrun = false;
+	}
+
+	mCondVar.notify_all();
+
+	if (mRealTime)
+	{
+		mTimer.start(mTimerPeriod);
+	}
+}
+
+void NullPcm::stop()
+{
+	LOG(mLog, DEBUG) << "Stop";
+
+	mTimer.stop();
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mRunning = false;
+		mPosition = 0;
+		mClockBase = 0;
+		mGeneration++;
+	}
+
+	mCondVar.notify_all();
+}
+
+void NullPcm::pause()
+{
+	LOG(mLog, DEBUG) << "Pause";
+
+	mTimer.stop();
+
+	lock_guard<mutex> lock(mMutex);
+
+	mClockBase = updateClock();
+	mRunning = false;
+}
+
+void NullPcm::resume()
+{
+	LOG(mLog, DEBUG) << "Resume";
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		restartClock(mClockBase);
+
+		mRunning = true;
+	}
+
+	mCondVar.notify_all();
+
+	if (mRealTime)
+	{
+		mTimer.start(mTimerPeriod);
+	}
+}
+
+/*******************************************************************************
+ * Protected
+ ******************************************************************************/
+
+void NullPcm::readData(uint8_t* buffer, size_t size)
+{
+	FormatConverter::fillSilence(mParams.format, buffer, size);
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void NullPcm::waitClock(unique_lock<mutex>& lock, uint64_t position)
+{
+	auto generation = mGeneration;
+
+	while(mGeneration == generation && updateClock() < position)
+	{
+		// the stopped clock waits for start or resume
+		if (mRunning)
+		{
+			mCondVar.wait_until(lock, getTime(position));
+		}
+		else
+		{
+			mCondVar.wait(lock);
+		}
+	}
+}
+
+uint64_t NullPcm::updateClock()
+{
+	if (!mRunning)
+	{
+		return mClockBase;
+	}
+
+	auto clock = getClock(Clock::now());
+
+	// the clock has passed the written data or the captured data doesn't fit
+	// into the buffer: restart the clock at the position as a recovered
+	// device does
+	uint64_t limit = mType == StreamType::PLAYBACK ?
+					 mPosition : mPosition + mParams.bufferSize;
+
+	if (clock > limit)
+	{
+		if (!mXrun)
+		{
+			mXrun = true;
+
+			mMetrics.xruns->inc();
+
+			DLOG(mLog, DEBUG) << "Xrun, position: " << mPosition;
+		}
+
+		restartClock(limit);
+
+		return limit;
+	}
+
+	return clock;
+}
+
+uint64_t NullPcm::getClock(Clock::time_point time)
+{
+	auto elapsed = duration_cast<microseconds>(time - mStart).count();
+	uint64_t frames = elapsed * mParams.rate / 1000000ull;
+
+	return mClockBase + frames * mFrameSize;
+}
+
+NullPcm::Clock::time_point NullPcm::getTime(uint64_t position)
+{
+	if (position <= mClockBase)
+	{
+		return mStart;
+	}
+
+	uint64_t frames = (position - mClockBase + mFrameSize - 1) / mFrameSize;
+
+	return mStart + microseconds((frames * 1000000ull + mParams.rate - 1) /
+								 mParams.rate);
+}
+
+void NullPcm::restartClock(uint64_t position)
+{
+	mClockBase = position;
+	mStart = Clock::now();
+}
+
+void NullPcm::reportProgress(uint64_t position)
+{
+	if (mProgressCbk)
+	{
+		mProgressCbk(position);
+	}
+}
+
+void NullPcm::timerCbk()
+{
+	uint64_t position;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		if (!mRunning)
+		{
+			return;
+		}
+
+		position = updateClock();
+	}
+
+	reportProgress(position);
+}
+
+}
@@ -0,0 +1,211 @@
+/*
+ *  Null pcm device
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_NULLPCM_HPP_
+#define SRC_NULLPCM_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include <xen/be/Log.hpp>
+
+#include "SoundItf.hpp"
+#include "TimerScheduler.hpp"
+
+namespace Null {
+
+/***************************************************************************//**
+ * @defgroup null
+ * Null device related classes.
+ ******************************************************************************/
+
+/***************************************************************************//**
+ * Pcm device which consumes and produces data without hardware.
+ *
+ * In real-time mode the device simulates a sound card clock: once started,
+ * the clock advances at the stream rate. Write blocks until the data fits
+ * into the buffer, read blocks until the data is captured, and the clock
+ * position is reported each period. A clock which passes the written data
+ * (underrun) or the read data by more than the buffer (overrun) is counted as
+ * xrun and restarted at the current position. Stop and close release the
+ * blocked call.
+ *
+ * In fast mode data is consumed and produced at once and the position is
+ * reported after each call.
+ *
+ * Playback data is dropped and capture produces silence. Derived devices keep
+ * the data by overriding the data hooks.
+ * @ingroup null
+ ******************************************************************************/
+class NullPcm : public SoundItf::PcmDevice
+{
+public:
+
+	/**
+	 * @param type     stream type
+	 * @param realTime run at the stream rate, otherwise as fast as possible
+	 */
+	NullPcm(SoundItf::StreamType type, bool realTime = true);
+	~NullPcm();
+
+	/**
+	 * Queries the device for HW intervals and masks.
+	 * @req HW parameters that the frontend wants to set
+	 * @resp refined HW parameters that backend can support
+	 */
+	void queryHwRanges(SoundItf::PcmParamRanges& req,
+					   SoundItf::PcmParamRanges& resp) override;
+
+	/**
+	 * Opens the device.
+	 * @param params pcm parameters
+	 */
+	void open(const SoundItf::PcmParams& params) override;
+
+	/**
+	 * Closes the device.
+	 */
+	void close() override;
+
+	/**
+	 * Reads data from the device.
+	 * @param buffer buffer where to put data
+	 * @param size   number of bytes to read
+	 */
+	void read(uint8_t* buffer, size_t size) override;
+
+	/**
+	 * Writes data to the device.
+	 * @param buffer buffer with data
+	 * @param size   number of bytes to write
+	 */
+	void write(uint8_t* buffer, size_t size) override;
+
+	/**
+	 * Starts the pcm device.
+	 */
+	void start() override;
+
+	/**
+	 * Stops the pcm device.
+	 */
+	void stop() override;
+
+	/**
+	 * Pauses the pcm device.
+	 */
+	void pause() override;
+
+	/**
+	 * Resumes the pcm device.
+	 */
+	void resume() override;
+
+	/**
+	 * Sets progress callback.
+	 * @param cbk callback
+	 */
+	void setProgressCbk(SoundItf::ProgressCbk cbk) override
+	{
+		mProgressCbk = cbk;
+	}
+
+	/**
+	 * Publishes the device metrics with the labels of the stream.
+	 * @param labels metric labels
+	 */
+	void setMetricLabels(const Metrics::Labels& labels) override
+	{
+		mMetrics.publish(labels);
+	}
+
+protected:
+
+	SoundItf::StreamType mType;
+	SoundItf::PcmParams mParams;
+
+	/**
+	 * Is called on open before the device is opened.
+	 * @param params pcm parameters
+	 */
+	virtual void openData(const SoundItf::PcmParams& params) {}
+
+	/**
+	 * Is called on close after the device is closed.
+	 */
+	virtual void closeData() {}
+
+	/**
+	 * Produces captured data.
+	 * @param buffer buffer where to put data
+	 * @param size   number of bytes to read
+	 */
+	virtual void readData(uint8_t* buffer, size_t size);
+
+	/**
+	 * Consumes played data.
+	 * @param buffer buffer with data
+	 * @param size   number of bytes to write
+	 */
+	virtual void writeData(const uint8_t* buffer, size_t size) {}
+
+private:
+
+	typedef std::chrono::steady_clock Clock;
+
+	bool mRealTime;
+	bool mOpened;
+	bool mRunning;
+	bool mXrun;
+	// incremented on stop to release the blocked call
+	uint64_t mGeneration;
+	uint64_t mBytesPerSecond;
+	size_t mFrameSize;
+
+	// bytes written to or read from the device
+	uint64_t mPosition;
+	// clock position in bytes at mStart
+	uint64_t mClockBase;
+	Clock::time_point mStart;
+
+	ScheduledTimer mTimer;
+	std::chrono::microseconds mTimerPeriod;
+	SoundItf::ProgressCbk mProgressCbk;
+
+	Metrics::PcmMetrics mMetrics;
+
+	std::mutex mMutex;
+	std::condition_variable mCondVar;
+
+	XenBackend::Log mLog;
+
+	void waitClock(std::unique_lock<std::mutex>& lock, uint64_t position);
+	uint64_t updateClock();
+	uint64_t getClock(Clock::time_point time);
+	Clock::time_point getTime(uint64_t position);
+	void restartClock(uint64_t position);
+	void reportProgress(uint64_t position);
+	void timerCbk();
+};
+
+}
+
+#endif /* SRC_NULLPCM_HPP_ */
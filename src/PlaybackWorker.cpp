@@ -0,0 +1,232 @@
+/*
+ *  Playback worker
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "PlaybackWorker.hpp"
+
+#include <errno.h>
+
+#include <xen/be/Exception.hpp>
+
+#include "RealTime.hpp"
+#include "Trace.hpp"
+
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+
+using SoundItf::PcmDevicePtr;
+
+/*******************************************************************************
+ * PlaybackWorker
+ ******************************************************************************/
+
+PlaybackWorker::PlaybackWorker(PcmDevicePtr pcmDevice, StreamStats& stats,
+							   size_t queueSize) :
+	mPcmDevice(pcmDevice),
+	mStats(stats),
+	mQueueSize(queueSize ? queueSize : 1),
+	mBuffer(nullptr),
+	mBufferSize(0),
+	mBusy(false),
+	mTerminate(false),
+	mGeneration(0),
+	mError(0),
+	mLog("PlaybackWorker")
+{
+	mThread = thread(&PlaybackWorker::run, this);
+
+	LOG(mLog, DEBUG) << "Create playback worker, queue size: " << mQueueSize;
+}
+
+PlaybackWorker::~PlaybackWorker()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mQueue.clear();
+		mTerminate = true;
+	}
+
+	mCondVar.notify_all();
+
+	mThread.join();
+
+	LOG(mLog, DEBUG) << "Delete playback worker";
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void PlaybackWorker::setBuffer(uint8_t* buffer, size_t size)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mBuffer = buffer;
+	mBufferSize = size;
+}
+
+void PlaybackWorker::queue(uint32_t offset, uint32_t length)
+{
+	unique_lock<mutex> lock(mMutex);
+
+	if (mError)
+	{
+		auto error = mError;
+
+		mError = 0;
+
+		throw XenBackend::Exception("Playback failed", error);
+	}
+
+	if (!mBuffer)
+	{
+		throw XenBackend::Exception("Buffer is not set", EFAULT);
+	}
+
+	if (static_cast<size_t>(offset) + length > mBufferSize)
+	{
+		throw XenBackend::Exception("Write out of buffer bounds", EINVAL);
+	}
+
+	mCondVar.wait(lock, [this] { return mQueue.size() < mQueueSize ||
+										mTerminate; });
+
+	mQueue.push_back({offset, length});
+
+	mCondVar.notify_all();
+}
+
+void PlaybackWorker::flush()
+{
+	unique_lock<mutex> lock(mMutex);
+
+	mCondVar.wait(lock, [this] { return (mQueue.empty() && !mBusy) ||
+										mTerminate; });
+}
+
+void PlaybackWorker::cancel()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (!mQueue.empty())
+	{
+		DLOG(mLog, DEBUG) << "Cancel pending writes: " << mQueue.size();
+	}
+
+	mQueue.clear();
+	mGeneration++;
+	mError = 0;
+
+	mCondVar.notify_all();
+}
+
+bool PlaybackWorker::waitIdle()
+{
+	unique_lock<mutex> lock(mMutex);
+
+	bool wasBusy = mBusy;
+
+	mCondVar.wait(lock, [this] { return !mBusy || mTerminate; });
+
+	return wasBusy;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void PlaybackWorker::run()
+{
+	RealTime::setupThread(RealTime::ThreadClass::PLAYBACK);
+
+	unique_lock<mutex> lock(mMutex);
+
+	while(true)
+	{
+		mCondVar.wait(lock, [this] { return !mQueue.empty() || mTerminate; });
+
+		if (mTerminate)
+		{
+			break;
+		}
+
+		auto descriptor = mQueue.front();
+		auto data = &mBuffer[descriptor.offset];
+		auto generation = mGeneration;
+
+		mQueue.pop_front();
+		mBusy = true;
+
+		// wake up the ring thread blocked on full queue
+		mCondVar.notify_all();
+
+		lock.unlock();
+
+		writeData(data, descriptor.length, generation);
+
+		lock.lock();
+
+		mBusy = false;
+
+		mCondVar.notify_all();
+	}
+}
+
+void PlaybackWorker::writeData(uint8_t* data, size_t size,
+							   uint64_t generation)
+{
+	int error = 0;
+
+	try
+	{
+		TRACE_SCOPE_ARG("PcmDevice::write", size);
+
+		auto start = StreamStats::Clock::now();
+
+		mPcmDevice->writeShared(data, size);
+
+		mStats.recordDeviceIo(start);
+	}
+	catch(const XenBackend::Exception& e)
+	{
+		LOG(mLog, ERROR) << e.what();
+
+		error = e.getErrno() > 0 ? e.getErrno() : EIO;
+	}
+	catch(const std::exception& e)
+	{
+		LOG(mLog, ERROR) << e.what();
+
+		error = EIO;
+	}
+
+	if (error)
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		// errors of cancelled writes are not reported to the frontend
+		if (generation == mGeneration)
+		{
+			mError = error;
+		}
+	}
+}
@@ -0,0 +1,121 @@
+/*
+ *  Playback worker
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_PLAYBACKWORKER_HPP_
+#define SRC_PLAYBACKWORKER_HPP_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <xen/be/Log.hpp>
+
+#include "SoundItf.hpp"
+#include "StreamStats.hpp"
+
+/***************************************************************************//**
+ * Writes frontend data to the pcm device on a dedicated thread.
+ *
+ * The ring thread queues (offset, length) descriptors which point into the
+ * shared buffer and responds to the frontend as soon as the descriptor is
+ * accepted. When the queue is full, queuing blocks until the device consumes
+ * data: the queue depth is the only backpressure seen by the ring thread.
+ * @ingroup snd_be
+ ******************************************************************************/
+class PlaybackWorker
+{
+public:
+
+	/**
+	 * @param pcmDevice pcm device to write to
+	 * @param stats     stream statistics
+	 * @param queueSize max number of pending descriptors
+	 */
+	PlaybackWorker(SoundItf::PcmDevicePtr pcmDevice, StreamStats& stats,
+				   size_t queueSize = cDefaultQueueSize);
+	~PlaybackWorker();
+
+	/**
+	 * Sets the buffer the descriptors point into.
+	 * @param buffer buffer address
+	 * @param size   buffer size
+	 */
+	void setBuffer(uint8_t* buffer, size_t size);
+
+	/**
+	 * Queues data to be written to the device. Blocks while the queue is full.
+	 * Throws if the previous write failed.
+	 * @param offset offset of the data inside the buffer
+	 * @param length length of the data
+	 */
+	void queue(uint32_t offset, uint32_t length);
+
+	/**
+	 * Waits until all queued data is written to the device.
+	 */
+	void flush();
+
+	/**
+	 * Discards all pending data. Doesn't wait for the write in progress.
+	 */
+	void cancel();
+
+	/**
+	 * Waits until the write in progress (if any) is finished.
+	 * @return true if there was a write in progress
+	 */
+	bool waitIdle();
+
+	static const size_t cDefaultQueueSize = 16;
+
+private:
+
+	struct Descriptor
+	{
+		uint32_t offset;
+		uint32_t length;
+	};
+
+	SoundItf::PcmDevicePtr mPcmDevice;
+	StreamStats& mStats;
+	size_t mQueueSize;
+
+	uint8_t* mBuffer;
+	size_t mBufferSize;
+
+	std::deque<Descriptor> mQueue;
+	bool mBusy;
+	bool mTerminate;
+	uint64_t mGeneration;
+	int mError;
+
+	std::mutex mMutex;
+	std::condition_variable mCondVar;
+	std::thread mThread;
+
+	XenBackend::Log mLog;
+
+	void run();
+	void writeData(uint8_t* data, size_t size, uint64_t generation);
+};
+
+#endif /* SRC_PLAYBACKWORKER_HPP_ */
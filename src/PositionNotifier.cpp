@@ -0,0 +1,220 @@
+/*
+ *  Position event notifier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "PositionNotifier.hpp"
+
+#include "Trace.hpp"
+
+using std::bind;
+using std::lock_guard;
+using std::mutex;
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+/*******************************************************************************
+ * PositionNotifier
+ ******************************************************************************/
+
+const milliseconds PositionNotifier::cRetryInterval(10);
+
+PositionNotifier::PositionNotifier(EventRingBufferPtr eventRingBuffer,
+								   milliseconds minInterval) :
+	mEventRingBuffer(eventRingBuffer),
+	mMinInterval(minInterval),
+	mPeriodSize(0),
+	mEventId(0),
+	mSentPosition(0),
+	mRingFull(false),
+	mPending(false),
+	mPendingPosition(0),
+	mTimerArmed(false),
+	mNumCoalesced(0),
+	mNumRingFull(0),
+	mTimer(bind(&PositionNotifier::timerCbk, this)),
+	mLog("PositionNotifier")
+{
+}
+
+PositionNotifier::~PositionNotifier()
+{
+	mTimer.stop();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void PositionNotifier::reset(uint32_t periodSize)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mPeriodSize = periodSize;
+	mSentPosition = 0;
+	mSentTime = Clock::time_point();
+	mRingFull = false;
+	mPending = false;
+}
+
+void PositionNotifier::update(uint64_t position)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (position == mSentPosition)
+	{
+		mPending = false;
+
+		return;
+	}
+
+	auto now = Clock::now();
+
+	if (mMinInterval.count() && now - mSentTime < mMinInterval &&
+		!isUrgent(position))
+	{
+		mNumCoalesced++;
+
+		mPending = true;
+		mPendingPosition = position;
+
+		armTimer(duration_cast<microseconds>(mSentTime + mMinInterval - now));
+
+		return;
+	}
+
+	sendOrHold(position, now);
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+bool PositionNotifier::isUrgent(uint64_t position)
+{
+	if (!mPeriodSize)
+	{
+		return true;
+	}
+
+	// crosses the period boundary
+	if (position / mPeriodSize != mSentPosition / mPeriodSize)
+	{
+		return true;
+	}
+
+	// close to the next period boundary
+	return mPeriodSize - position % mPeriodSize <=
+		   mPeriodSize / cNearBoundaryDiv;
+}
+
+void PositionNotifier::sendOrHold(uint64_t position, Clock::time_point now)
+{
+	if (send(position))
+	{
+		mSentPosition = position;
+		mSentTime = now;
+		mPending = false;
+
+		return;
+	}
+
+	mPending = true;
+	mPendingPosition = position;
+
+	armTimer(cRetryInterval);
+}
+
+bool PositionNotifier::send(uint64_t position)
+{
+	xensnd_evt event = { .id = mEventId++, .type = XENSND_EVT_CUR_POS };
+
+	event.op.cur_pos.position = position;
+
+	try
+	{
+		TRACE_SCOPE("EventRingBuffer::sendEvent");
+
+		mEventRingBuffer->sendEvent(event);
+	}
+	catch(const std::exception& e)
+	{
+		// keep the position: it is retried by the timer or replaced by the
+		// next update
+		if (!mRingFull)
+		{
+			LOG(mLog, WARNING) << "Can't send position: " << e.what();
+
+			mNumRingFull++;
+		}
+
+		mRingFull = true;
+		mNumCoalesced++;
+
+		return false;
+	}
+
+	if (mRingFull)
+	{
+		LOG(mLog, DEBUG) << "Event ring is drained";
+
+		mRingFull = false;
+	}
+
+	return true;
+}
+
+void PositionNotifier::armTimer(microseconds delay)
+{
+	if (!mTimerArmed)
+	{
+		mTimerArmed = true;
+
+		mTimer.start(delay);
+	}
+}
+
+void PositionNotifier::timerCbk()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	// the timer is one shot
+	mTimer.stop(false);
+	mTimerArmed = false;
+
+	if (!mPending)
+	{
+		return;
+	}
+
+	auto now = Clock::now();
+
+	// a position was sent meanwhile: wait for the rest of the interval
+	if (now - mSentTime < mMinInterval)
+	{
+		armTimer(duration_cast<microseconds>(mSentTime + mMinInterval - now));
+
+		return;
+	}
+
+	DLOG(mLog, DEBUG) << "Send held back position: " << mPendingPosition;
+
+	sendOrHold(mPendingPosition, now);
+}
@@ -0,0 +1,152 @@
+/*
+ *  Position event notifier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_POSITIONNOTIFIER_HPP_
+#define SRC_POSITIONNOTIFIER_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include <xen/be/Log.hpp>
+#include <xen/be/RingBufferBase.hpp>
+
+#include <xen/io/sndif.h>
+
+#include "TimerScheduler.hpp"
+
+/***************************************************************************//**
+ * Ring buffer used to send events to the frontend.
+ * @ingroup snd_be
+ ******************************************************************************/
+class EventRingBuffer : public XenBackend::RingBufferOutBase<
+		xensnd_event_page, xensnd_evt>
+{
+public:
+	/**
+	 * @param domId     frontend domain id
+	 * @param port      event channel port number
+	 * @param ref       grant table reference
+	 * @param offset    start of the ring buffer inside the page
+	 * @param size      size of the ring buffer
+	 */
+	EventRingBuffer(domid_t domId, evtchn_port_t port,
+					grant_ref_t ref, int offset, size_t size) :
+		RingBufferOutBase<xensnd_event_page, xensnd_evt>(domId, port, ref,
+														 offset, size) {}
+};
+
+typedef std::shared_ptr<EventRingBuffer> EventRingBufferPtr;
+
+/***************************************************************************//**
+ * Sends XENSND_EVT_CUR_POS events with as few frontend wakeups as possible.
+ *
+ * Each event notifies the frontend through the event channel. Positions are
+ * sent at most once per min interval: positions received in between replace
+ * each other and only the latest one is sent. The frontend needs exact
+ * positions at period boundaries to report elapsed periods, so the interval
+ * is not applied to positions which cross a boundary or are close to the
+ * next one. Thus the interval thins positions only for devices which report
+ * more often than once per period, e.g. the mixer.
+ *
+ * If the ring is full because the frontend doesn't drain it, the latest
+ * position is kept. A held back position is sent by a one shot timer when
+ * the interval expires, or retried after cRetryInterval if the ring was full,
+ * unless a newer position is sent before. So the last position of a stream
+ * reaches the frontend even if the device reports no more positions.
+ * Repeated positions are not sent.
+ * @ingroup snd_be
+ ******************************************************************************/
+class PositionNotifier
+{
+public:
+
+	/**
+	 * @param eventRingBuffer event ring buffer
+	 * @param minInterval     min interval between events, 0 - no limit
+	 */
+	PositionNotifier(EventRingBufferPtr eventRingBuffer,
+					 std::chrono::milliseconds minInterval);
+	~PositionNotifier();
+
+	/**
+	 * Resets the position on stream open.
+	 * @param periodSize period size in bytes
+	 */
+	void reset(uint32_t periodSize);
+
+	/**
+	 * Updates the stream position.
+	 * @param position position in bytes
+	 */
+	void update(uint64_t position);
+
+	/**
+	 * Returns number of positions which were not sent.
+	 */
+	uint64_t getNumCoalesced() const { return mNumCoalesced; }
+
+	/**
+	 * Returns number of times the event ring was found full.
+	 */
+	uint64_t getNumRingFull() const { return mNumRingFull; }
+
+private:
+
+	// part of the period before the boundary where the interval is not applied
+	static const uint32_t cNearBoundaryDiv = 4;
+	// delay before the position is sent again to the full ring
+	static const std::chrono::milliseconds cRetryInterval;
+
+	typedef std::chrono::steady_clock Clock;
+
+	EventRingBufferPtr mEventRingBuffer;
+	std::chrono::milliseconds mMinInterval;
+
+	uint32_t mPeriodSize;
+	uint16_t mEventId;
+
+	uint64_t mSentPosition;
+	Clock::time_point mSentTime;
+	bool mRingFull;
+	// latest position which was not sent
+	bool mPending;
+	uint64_t mPendingPosition;
+	bool mTimerArmed;
+	std::atomic<uint64_t> mNumCoalesced;
+	std::atomic<uint64_t> mNumRingFull;
+
+	std::mutex mMutex;
+
+	// declared after the mutex: the callback takes it
+	ScheduledTimer mTimer;
+
+	XenBackend::Log mLog;
+
+	bool isUrgent(uint64_t position);
+	void sendOrHold(uint64_t position, Clock::time_point now);
+	bool send(uint64_t position);
+	void armTimer(std::chrono::microseconds delay);
+	void timerCbk();
+};
+
+#endif /* SRC_POSITIONNOTIFIER_HPP_ */
@@ -0,0 +1,580 @@
+/*
+ *  Processing pcm device
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "ProcessingPcm.hpp"
+
+#include <algorithm>
+#include <climits>
+
+using std::lock_guard;
+using std::max;
+using std::min;
+using std::mutex;
+
+using SoundItf::PcmDevicePtr;
+using SoundItf::PcmParamRanges;
+using SoundItf::PcmParams;
+using SoundItf::ProgressCbk;
+using SoundItf::StreamType;
+
+namespace Dsp {
+
+/*******************************************************************************
+ * ProcessingPcm
+ ******************************************************************************/
+
+ProcessingPcm::ProcessingPcm(PcmDevicePtr pcmDevice, StreamType type,
+							 Resampler::Quality quality) :
+	mPcmDevice(pcmDevice),
+	mType(type),
+	mQuality(quality),
+	mProgressScale(),
+	mDeviceRangesValid(false),
+	mDeviceRanges(),
+	mParams(),
+	mDeviceParams(),
+	mFrameSize(1),
+	mDeviceFrameSize(1),
+	mChunkFrames(0),
+	mRemixFirst(false),
+	mFloatOutPos(0),
+	mLog("ProcessingPcm")
+{
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void ProcessingPcm::queryHwRanges(PcmParamRanges& req, PcmParamRanges& resp)
+{
+	auto supportedFormats = FormatConverter::getSupportedFormats();
+	auto deviceReq = req;
+
+	// query all formats, rates and channels to know what the device can
+	// convert to
+	deviceReq.formats |= supportedFormats;
+	deviceReq.rates.min = 0;
+	deviceReq.rates.max = UINT_MAX;
+	deviceReq.channels.min = 0;
+	deviceReq.channels.max = UINT_MAX;
+
+	mPcmDevice->queryHwRanges(deviceReq, resp);
+
+	auto deviceFormats = resp.formats;
+
+	if (!(deviceFormats & supportedFormats))
+	{
+		resp.formats &= req.formats;
+
+		return;
+	}
+
+	// offer conversion only where the request doesn't meet the device
+	// ranges: the ranges refined by the device (e.g. pulse native spec) are
+	// passed through, so the device choice isn't converted locally
+
+	if (req.formats & deviceFormats)
+	{
+		resp.formats = req.formats & deviceFormats;
+	}
+	else
+	{
+		resp.formats = req.formats & supportedFormats;
+	}
+
+	if (!intersect(req.rates.min, req.rates.max,
+				   resp.rates.min, resp.rates.max))
+	{
+		resp.rates.min = max(req.rates.min, cMinRate);
+		resp.rates.max = min(req.rates.max, cMaxRate);
+	}
+
+	if (!intersect(req.channels.min, req.channels.max,
+				   resp.channels.min, resp.channels.max))
+	{
+		resp.channels.min = max(req.channels.min, 1u);
+		resp.channels.max = min<unsigned int>(req.channels.max,
+											  Remixer::cMaxChannels);
+	}
+}
+
+void ProcessingPcm::open(const PcmParams& params)
+{
+	mParams = params;
+	mDeviceParams = params;
+
+	if (FormatConverter::getSupportedFormats() & (1ull << params.format))
+	{
+		mDeviceParams.format =
+				FormatConverter::selectFormat(params.format,
+											  getDeviceRanges().formats);
+		mDeviceParams.rate = selectRate(params.rate);
+		mDeviceParams.numChannels = selectChannels(params.numChannels);
+	}
+
+	initConversion();
+
+	{
+		lock_guard<mutex> lock(mProgressMutex);
+
+		if (mConverter || isProcessing())
+		{
+			mProgressScale = {mFrameSize, mDeviceFrameSize,
+							  mParams.rate, mDeviceParams.rate};
+		}
+		else
+		{
+			mProgressScale = {1, 1, 1, 1};
+		}
+	}
+
+	mPcmDevice->open(mDeviceParams);
+}
+
+void ProcessingPcm::close()
+{
+	{
+		lock_guard<mutex> lock(mProgressMutex);
+
+		mProgressScale = {};
+	}
+
+	mPcmDevice->close();
+
+	mConverter.reset();
+	mDecoder.reset();
+	mRemixer.reset();
+	mResampler.reset();
+	mEncoder.reset();
+}
+
+void ProcessingPcm::read(uint8_t* buffer, size_t size)
+{
+	if (isProcessing())
+	{
+		processRead(buffer, size);
+	}
+	else if (mConverter)
+	{
+		convertRead(buffer, size);
+	}
+	else
+	{
+		mPcmDevice->read(buffer, size);
+	}
+}
+
+void ProcessingPcm::write(uint8_t* buffer, size_t size)
+{
+	if (isProcessing())
+	{
+		processWrite(buffer, size);
+	}
+	else if (mConverter)
+	{
+		convertWrite(buffer, size);
+	}
+	else
+	{
+		mPcmDevice->write(buffer, size);
+	}
+}
+
+void ProcessingPcm::writeShared(uint8_t* buffer, size_t size)
+{
+	// converted data is in own buffer which is reused
+	if (isProcessing() || mConverter)
+	{
+		write(buffer, size);
+	}
+	else
+	{
+		mPcmDevice->writeShared(buffer, size);
+	}
+}
+
+void ProcessingPcm::setProgressCbk(ProgressCbk cbk)
+{
+	mProgressCbk = cbk;
+
+	mPcmDevice->setProgressCbk([this] (uint64_t bytes)
+							   { progressCbk(bytes); });
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+const PcmParamRanges& ProcessingPcm::getDeviceRanges()
+{
+	if (!mDeviceRangesValid)
+	{
+		PcmParamRanges req = {};
+
+		req.formats = FormatConverter::getSupportedFormats();
+		req.rates.max = UINT_MAX;
+		req.channels.max = UINT_MAX;
+		req.buffer.max = UINT_MAX;
+		req.period.max = UINT_MAX;
+
+		mPcmDevice->queryHwRanges(req, mDeviceRanges);
+
+		mDeviceRangesValid = true;
+	}
+
+	return mDeviceRanges;
+}
+
+bool ProcessingPcm::intersect(unsigned int reqMin, unsigned int reqMax,
+							  unsigned int& min, unsigned int& max)
+{
+	if (reqMin > max || reqMax < min)
+	{
+		return false;
+	}
+
+	min = std::max(reqMin, min);
+	max = std::min(reqMax, max);
+
+	return true;
+}
+
+bool ProcessingPcm::isRateSupported(uint32_t rate)
+{
+	PcmParamRanges req = {}, resp = {};
+
+	req.formats = getDeviceRanges().formats;
+	req.rates.min = rate;
+	req.rates.max = rate;
+	req.channels.max = UINT_MAX;
+	req.buffer.max = UINT_MAX;
+	req.period.max = UINT_MAX;
+
+	try
+	{
+		mPcmDevice->queryHwRanges(req, resp);
+	}
+	catch(const std::exception& e)
+	{
+		return false;
+	}
+
+	return resp.rates.min <= rate && rate <= resp.rates.max;
+}
+
+uint32_t ProcessingPcm::selectRate(uint32_t rate)
+{
+	static const uint32_t cRates[] = {48000, 44100, 96000, 88200, 192000,
+									  32000, 16000, 8000};
+
+	if (isRateSupported(rate))
+	{
+		return rate;
+	}
+
+	for (auto candidate : cRates)
+	{
+		if (isRateSupported(candidate))
+		{
+			return candidate;
+		}
+	}
+
+	return rate;
+}
+
+uint8_t ProcessingPcm::selectChannels(uint8_t numChannels)
+{
+	auto& channels = getDeviceRanges().channels;
+
+	if (numChannels < channels.min)
+	{
+		return channels.min;
+	}
+
+	if (numChannels > channels.max)
+	{
+		return channels.max;
+	}
+
+	return numChannels;
+}
+
+void ProcessingPcm::initConversion()
+{
+	mConverter.reset();
+	mDecoder.reset();
+	mRemixer.reset();
+	mResampler.reset();
+	mEncoder.reset();
+
+	if (mParams.format == mDeviceParams.format &&
+		mParams.rate == mDeviceParams.rate &&
+		mParams.numChannels == mDeviceParams.numChannels)
+	{
+		return;
+	}
+
+	mFrameSize = FormatConverter::getSampleSize(mParams.format) *
+				 mParams.numChannels;
+	mDeviceFrameSize = FormatConverter::getSampleSize(mDeviceParams.format) *
+					   mDeviceParams.numChannels;
+
+	mChunkFrames = cChunkSize / max(max(mFrameSize, mDeviceFrameSize),
+									sizeof(float) * Remixer::cMaxChannels);
+
+	mDeviceParams.bufferSize = static_cast<uint64_t>(mParams.bufferSize) /
+							   mFrameSize * mDeviceParams.rate / mParams.rate *
+							   mDeviceFrameSize;
+	mDeviceParams.periodSize = static_cast<uint64_t>(mParams.periodSize) /
+							   mFrameSize * mDeviceParams.rate / mParams.rate *
+							   mDeviceFrameSize;
+
+	auto& src = mType == StreamType::PLAYBACK ? mParams : mDeviceParams;
+	auto& dst = mType == StreamType::PLAYBACK ? mDeviceParams : mParams;
+
+	if (src.rate == dst.rate && src.numChannels == dst.numChannels)
+	{
+		mConverter.reset(new FormatConverter(src.format, dst.format));
+
+		mBuffer.resize(mChunkFrames * mDeviceFrameSize);
+
+		LOG(mLog, DEBUG) << "Convert " << mConverter->getDescription();
+
+		return;
+	}
+
+	initProcessing(src, dst);
+}
+
+void ProcessingPcm::initProcessing(const PcmParams& src, const PcmParams& dst)
+{
+	auto floatFormat = FormatConverter::getFloatFormat();
+
+	mDecoder.reset(new FormatConverter(src.format, floatFormat));
+	mEncoder.reset(new FormatConverter(floatFormat, dst.format));
+
+	LOG(mLog, DEBUG) << "Decode " << mDecoder->getDescription();
+
+	mRemixFirst = dst.numChannels < src.numChannels;
+
+	if (src.numChannels != dst.numChannels)
+	{
+		mRemixer.reset(new Remixer(src.numChannels, dst.numChannels));
+
+		LOG(mLog, DEBUG) << "Remix " << static_cast<int>(src.numChannels)
+						 << " -> " << static_cast<int>(dst.numChannels)
+						 << ": " << mRemixer->getDescription();
+	}
+
+	if (src.rate != dst.rate)
+	{
+		mResampler.reset(new Resampler(src.rate, dst.rate,
+									   mRemixFirst ? dst.numChannels :
+													 src.numChannels,
+									   mQuality));
+
+		LOG(mLog, DEBUG) << "Resample " << src.rate << " -> "
+						 << dst.rate << ", quality: "
+						 << Resampler::getQualityName(mQuality)
+						 << ", taps: " << mResampler->getNumTaps()
+						 << ", phases: " << mResampler->getNumPhases();
+	}
+
+	LOG(mLog, DEBUG) << "Encode " << mEncoder->getDescription();
+
+	mFloatIn.resize(mChunkFrames * src.numChannels);
+	mFloatOut.clear();
+	mFloatOutPos = 0;
+}
+
+const float* ProcessingPcm::processFloat(const float* in, size_t& numFrames)
+{
+	auto& dst = mType == StreamType::PLAYBACK ? mDeviceParams : mParams;
+
+	if (mRemixer && mRemixFirst)
+	{
+		mRemixBuffer.resize(numFrames * dst.numChannels);
+
+		mRemixer->process(in, mRemixBuffer.data(), numFrames);
+
+		in = mRemixBuffer.data();
+	}
+
+	if (mResampler)
+	{
+		auto& src = mType == StreamType::PLAYBACK ? mParams : mDeviceParams;
+		auto numChannels = mRemixFirst ? dst.numChannels : src.numChannels;
+
+		mResampleBuffer.clear();
+
+		mResampler->process(in, numFrames, mResampleBuffer);
+
+		in = mResampleBuffer.data();
+		numFrames = mResampleBuffer.size() / numChannels;
+	}
+
+	if (mRemixer && !mRemixFirst)
+	{
+		mRemixBuffer.resize(numFrames * dst.numChannels);
+
+		mRemixer->process(in, mRemixBuffer.data(), numFrames);
+
+		in = mRemixBuffer.data();
+	}
+
+	return in;
+}
+
+void ProcessingPcm::convertWrite(uint8_t* buffer, size_t size)
+{
+	size_t numFrames = size / mFrameSize;
+
+	while (numFrames)
+	{
+		auto count = min(numFrames, mChunkFrames);
+
+		mConverter->convert(buffer, mBuffer.data(),
+							count * mParams.numChannels);
+
+		mPcmDevice->write(mBuffer.data(), count * mDeviceFrameSize);
+
+		buffer += count * mFrameSize;
+		numFrames -= count;
+	}
+}
+
+void ProcessingPcm::processWrite(uint8_t* buffer, size_t size)
+{
+	size_t numFrames = size / mFrameSize;
+
+	while (numFrames)
+	{
+		auto count = min(numFrames, mChunkFrames);
+
+		mDecoder->convert(buffer, mFloatIn.data(),
+						  count * mParams.numChannels);
+
+		size_t numOut = count;
+		auto out = processFloat(mFloatIn.data(), numOut);
+
+		if (numOut)
+		{
+			mBuffer.resize(numOut * mDeviceFrameSize);
+
+			mEncoder->convert(out, mBuffer.data(),
+							  numOut * mDeviceParams.numChannels);
+
+			mPcmDevice->write(mBuffer.data(), mBuffer.size());
+		}
+
+		buffer += count * mFrameSize;
+		numFrames -= count;
+	}
+}
+
+void ProcessingPcm::convertRead(uint8_t* buffer, size_t size)
+{
+	size_t numFrames = size / mFrameSize;
+
+	while (numFrames)
+	{
+		auto count = min(numFrames, mChunkFrames);
+
+		mPcmDevice->read(mBuffer.data(), count * mDeviceFrameSize);
+
+		mConverter->convert(mBuffer.data(), buffer,
+							count * mParams.numChannels);
+
+		buffer += count * mFrameSize;
+		numFrames -= count;
+	}
+}
+
+void ProcessingPcm::processRead(uint8_t* buffer, size_t size)
+{
+	auto numChannels = mParams.numChannels;
+	size_t numFrames = size / mFrameSize;
+
+	while (numFrames)
+	{
+		size_t pending = (mFloatOut.size() - mFloatOutPos) / numChannels;
+
+		if (!pending)
+		{
+			// read approximately as many device frames as needed
+			size_t count = min(mChunkFrames, static_cast<size_t>(
+					static_cast<uint64_t>(numFrames) * mDeviceParams.rate /
+					mParams.rate + 1));
+
+			mBuffer.resize(count * mDeviceFrameSize);
+
+			mPcmDevice->read(mBuffer.data(), mBuffer.size());
+
+			mDecoder->convert(mBuffer.data(), mFloatIn.data(),
+							  count * mDeviceParams.numChannels);
+
+			auto out = processFloat(mFloatIn.data(), count);
+
+			mFloatOut.assign(out, out + count * numChannels);
+			mFloatOutPos = 0;
+
+			continue;
+		}
+
+		auto count = min(pending, numFrames);
+
+		mEncoder->convert(&mFloatOut[mFloatOutPos], buffer,
+						  count * numChannels);
+
+		mFloatOutPos += count * numChannels;
+		buffer += count * mFrameSize;
+		numFrames -= count;
+	}
+}
+
+void ProcessingPcm::progressCbk(uint64_t bytes)
+{
+	ProgressScale scale;
+
+	{
+		lock_guard<mutex> lock(mProgressMutex);
+
+		scale = mProgressScale;
+	}
+
+	if (!mProgressCbk || !scale.deviceFrameSize)
+	{
+		return;
+	}
+
+	// device bytes to frontend bytes
+	uint64_t frames = bytes / scale.deviceFrameSize;
+
+	if (scale.deviceRate != scale.rate)
+	{
+		frames = frames * scale.rate / scale.deviceRate;
+	}
+
+	mProgressCbk(frames * scale.frameSize);
+}
+
+}
@@ -0,0 +1,219 @@
+/*
+ *  Processing pcm device
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_PROCESSINGPCM_HPP_
+#define SRC_PROCESSINGPCM_HPP_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <xen/be/Log.hpp>
+
+#include "FormatConverter.hpp"
+#include "Remixer.hpp"
+#include "Resampler.hpp"
+#include "SoundItf.hpp"
+
+namespace Dsp {
+
+/***************************************************************************//**
+ * Pcm device which converts frontend samples to the format, rate and number
+ * of channels supported by the underlying pcm device.
+ *
+ * HW ranges of the device are passed to the frontend as refined by the
+ * device, e.g. pulse device offers its native spec only. Only if the request
+ * doesn't meet the device formats, rates or channels, formats which can be
+ * converted to one of the device formats, rates in range cMinRate..cMaxRate
+ * or up to Remixer::cMaxChannels channels are advertised instead. When the
+ * frontend opens parameters which are not supported by the device, the
+ * closest device ones are selected on open.
+ * Format only conversion is done directly. Rate and channel conversion is
+ * done on host endian float samples: decode, remix and resample, encode.
+ * Remix goes first when it reduces number of channels.
+ * @ingroup dsp
+ ******************************************************************************/
+class ProcessingPcm : public SoundItf::PcmDevice
+{
+public:
+
+	/**
+	 * @param pcmDevice underlying pcm device
+	 * @param type      stream type
+	 * @param quality   resampler quality
+	 */
+	ProcessingPcm(SoundItf::PcmDevicePtr pcmDevice,
+				  SoundItf::StreamType type,
+				  Resampler::Quality quality = Resampler::Quality::MEDIUM);
+
+	/**
+	 * Queries the device for HW intervals and masks.
+	 * @req HW parameters that the frontend wants to set
+	 * @resp refined HW parameters that backend can support
+	 */
+	void queryHwRanges(SoundItf::PcmParamRanges& req,
+					   SoundItf::PcmParamRanges& resp) override;
+
+	/**
+	 * Opens the device.
+	 * @param params pcm parameters
+	 */
+	void open(const SoundItf::PcmParams& params) override;
+
+	/**
+	 * Closes the device.
+	 */
+	void close() override;
+
+	/**
+	 * Reads data from the device.
+	 * @param buffer buffer where to put data
+	 * @param size   number of bytes to read
+	 */
+	void read(uint8_t* buffer, size_t size) override;
+
+	/**
+	 * Writes data to the device.
+	 * @param buffer buffer with data
+	 * @param size   number of bytes to write
+	 */
+	void write(uint8_t* buffer, size_t size) override;
+
+	/**
+	 * Writes data from the shared buffer.
+	 * @param buffer buffer with data
+	 * @param size   number of bytes to write
+	 */
+	void writeShared(uint8_t* buffer, size_t size) override;
+
+	/**
+	 * Starts the pcm device.
+	 */
+	void start() override { mPcmDevice->start(); }
+
+	/**
+	 * Stops the pcm device.
+	 */
+	void stop() override { mPcmDevice->stop(); }
+
+	/**
+	 * Pauses the pcm device.
+	 */
+	void pause() override { mPcmDevice->pause(); }
+
+	/**
+	 * Resumes the pcm device.
+	 */
+	void resume() override { mPcmDevice->resume(); }
+
+	/**
+	 * Sets progress callback.
+	 * @param cbk callback
+	 */
+	void setProgressCbk(SoundItf::ProgressCbk cbk) override;
+
+	/**
+	 * Publishes the device metrics with the labels of the stream.
+	 * @param labels metric labels
+	 */
+	void setMetricLabels(const Metrics::Labels& labels) override
+	{
+		mPcmDevice->setMetricLabels(labels);
+	}
+
+private:
+
+	static const size_t cChunkSize = 16384;
+	static const uint32_t cMinRate = 8000;
+	static const uint32_t cMaxRate = 192000;
+
+	SoundItf::PcmDevicePtr mPcmDevice;
+	SoundItf::StreamType mType;
+	Resampler::Quality mQuality;
+	SoundItf::ProgressCbk mProgressCbk;
+
+	// scales device progress to frontend bytes: progress is reported on the
+	// device threads while open and close change the conversion
+	struct ProgressScale
+	{
+		size_t frameSize;
+		// 0 - the device is closed, progress is dropped
+		size_t deviceFrameSize;
+		uint32_t rate;
+		uint32_t deviceRate;
+	};
+
+	ProgressScale mProgressScale;
+	std::mutex mProgressMutex;
+
+	bool mDeviceRangesValid;
+	SoundItf::PcmParamRanges mDeviceRanges;
+
+	// frontend side and device side parameters
+	SoundItf::PcmParams mParams;
+	SoundItf::PcmParams mDeviceParams;
+	size_t mFrameSize;
+	size_t mDeviceFrameSize;
+	size_t mChunkFrames;
+
+	// direct format conversion
+	std::unique_ptr<FormatConverter> mConverter;
+
+	// float processing: decoder, remixer, resampler, encoder
+	std::unique_ptr<FormatConverter> mDecoder;
+	std::unique_ptr<Remixer> mRemixer;
+	std::unique_ptr<Resampler> mResampler;
+	std::unique_ptr<FormatConverter> mEncoder;
+	bool mRemixFirst;
+
+	std::vector<uint8_t> mBuffer;
+	std::vector<float> mFloatIn;
+	std::vector<float> mRemixBuffer;
+	std::vector<float> mResampleBuffer;
+	std::vector<float> mFloatOut;
+	size_t mFloatOutPos;
+
+	XenBackend::Log mLog;
+
+	static bool intersect(unsigned int reqMin, unsigned int reqMax,
+						  unsigned int& min, unsigned int& max);
+
+	const SoundItf::PcmParamRanges& getDeviceRanges();
+	bool isRateSupported(uint32_t rate);
+	uint32_t selectRate(uint32_t rate);
+	uint8_t selectChannels(uint8_t numChannels);
+
+	void initConversion();
+	void initProcessing(const SoundItf::PcmParams& src,
+						const SoundItf::PcmParams& dst);
+	const float* processFloat(const float* in, size_t& numFrames);
+	bool isProcessing() const { return mDecoder != nullptr; }
+
+	void convertWrite(uint8_t* buffer, size_t size);
+	void processWrite(uint8_t* buffer, size_t size);
+	void convertRead(uint8_t* buffer, size_t size);
+	void processRead(uint8_t* buffer, size_t size);
+
+	void progressCbk(uint64_t bytes);
+};
+
+}
+
+#endif /* SRC_PROCESSINGPCM_HPP_ */
@@ -20,13 +20,26 @@
 
 #include "PulsePcm.hpp"
 
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
 #include <pulse/error.h>
 
 #include <xen/io/sndif.h>
 
+#include "RealTime.hpp"
+#include "Trace.hpp"
+
+using std::bind;
 using std::lock_guard;
+using std::min;
+using std::mutex;
 using std::string;
 using std::to_string;
+using std::unique_lock;
+
+using std::chrono::microseconds;
 
 using SoundItf::PcmParams;
 using SoundItf::StreamType;
@@ -38,6 +51,155 @@ void contextError(const string& message, pa_context* context)
 	throw Exception(message, pa_context_errno(context));
 }
 
+void waitMainloop(pa_threaded_mainloop* mainloop)
+{
+	TRACE_SCOPE("pa_threaded_mainloop_wait");
+
+	pa_threaded_mainloop_wait(mainloop);
+}
+
+/*******************************************************************************
+ * PulseDeviceCache
+ ******************************************************************************/
+
+PulseDeviceCache::PulseDeviceCache(pa_threaded_mainloop* mainloop,
+								   pa_context* context) :
+	mMainloop(mainloop),
+	mContext(context),
+	mReceivedSpec(),
+	mReceived(false),
+	mLog("PulseDeviceCache")
+{
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void PulseDeviceCache::subscribe()
+{
+	pa_context_set_subscribe_callback(mContext, sSubscribeCbk, this);
+
+	auto op = pa_context_subscribe(mContext,
+			static_cast<pa_subscription_mask_t>(PA_SUBSCRIPTION_MASK_SINK |
+												PA_SUBSCRIPTION_MASK_SOURCE |
+												PA_SUBSCRIPTION_MASK_SERVER),
+			nullptr, nullptr);
+
+	if (!op)
+	{
+		contextError("Can't subscribe to server events", mContext);
+	}
+
+	pa_operation_unref(op);
+}
+
+const pa_sample_spec& PulseDeviceCache::getSampleSpec(StreamType type,
+													  const string& deviceName)
+{
+	auto it = mSpecs.find(Key(type, deviceName));
+
+	if (it != mSpecs.end())
+	{
+		return it->second;
+	}
+
+	mReceived = false;
+
+	pa_operation* op = nullptr;
+
+	if (type == StreamType::PLAYBACK)
+	{
+		op = pa_context_get_sink_info_by_name(mContext,
+				deviceName.empty() ? "@DEFAULT_SINK@" : deviceName.c_str(),
+				sSinkInfoCbk, this);
+	}
+	else
+	{
+		op = pa_context_get_source_info_by_name(mContext,
+				deviceName.empty() ? "@DEFAULT_SOURCE@" : deviceName.c_str(),
+				sSourceInfoCbk, this);
+	}
+
+	if (!op)
+	{
+		contextError("Can't get device info", mContext);
+	}
+
+	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING &&
+		   PA_CONTEXT_IS_GOOD(pa_context_get_state(mContext)))
+	{
+		waitMainloop(mMainloop);
+	}
+
+	pa_operation_unref(op);
+
+	if (!mReceived)
+	{
+		throw Exception("Can't get device info " + deviceName,
+						PA_ERR_NOENTITY);
+	}
+
+	LOG(mLog, DEBUG) << "Device: " << (deviceName.empty() ? "default" :
+															 deviceName)
+					 << ", format: "
+					 << pa_sample_format_to_string(mReceivedSpec.format)
+					 << ", rate: " << mReceivedSpec.rate
+					 << ", channels: "
+					 << static_cast<int>(mReceivedSpec.channels);
+
+	return mSpecs[Key(type, deviceName)] = mReceivedSpec;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void PulseDeviceCache::sSinkInfoCbk(pa_context* context,
+									const pa_sink_info* info,
+									int eol, void* data)
+{
+	static_cast<PulseDeviceCache*>(data)->infoCbk(
+			info ? &info->sample_spec : nullptr);
+}
+
+void PulseDeviceCache::sSourceInfoCbk(pa_context* context,
+									  const pa_source_info* info,
+									  int eol, void* data)
+{
+	static_cast<PulseDeviceCache*>(data)->infoCbk(
+			info ? &info->sample_spec : nullptr);
+}
+
+void PulseDeviceCache::sSubscribeCbk(pa_context* context,
+									 pa_subscription_event_type_t type,
+									 uint32_t index, void* data)
+{
+	static_cast<PulseDeviceCache*>(data)->subscribeCbk(type);
+}
+
+void PulseDeviceCache::infoCbk(const pa_sample_spec* spec)
+{
+	// called once with the info and once more at the end of the list
+	if (spec)
+	{
+		mReceivedSpec = *spec;
+		mReceived = true;
+	}
+
+	pa_threaded_mainloop_signal(mMainloop, 0);
+}
+
+void PulseDeviceCache::subscribeCbk(pa_subscription_event_type_t type)
+{
+	if (!mSpecs.empty())
+	{
+		DLOG(mLog, DEBUG) << "Server event: " << type << ", clear cache";
+
+		mSpecs.clear();
+	}
+}
+
 /*******************************************************************************
  * PulseMainloop
  ******************************************************************************/
@@ -74,10 +236,17 @@ PulsePcm* PulseMainloop::createStream(StreamType type, const string& name,
 									  const string& propValue,
 									  const string& deviceName)
 {
-	return new PulsePcm(mMainloop, mContext, type, name,
+	return new PulsePcm(mMainloop, mContext, *mDeviceCache, type, name,
 						propName, propValue, deviceName);
 }
 
+bool PulseMainloop::isConnected()
+{
+	lock_guard<PulseMutex> lock(mMutex);
+
+	return PA_CONTEXT_IS_GOOD(pa_context_get_state(mContext));
+}
+
 /*******************************************************************************
  * Private
  ******************************************************************************/
@@ -87,6 +256,11 @@ void PulseMainloop::sContextStateChanged(pa_context *context, void *data)
 	static_cast<PulseMainloop*>(data)->contextStateChanged();
 }
 
+void PulseMainloop::sSetupThread(pa_mainloop_api *api, void *data)
+{
+	RealTime::setupThread(RealTime::ThreadClass::MAINLOOP);
+}
+
 void PulseMainloop::contextStateChanged()
 {
 	switch (pa_context_get_state(mContext))
@@ -120,7 +294,7 @@ void PulseMainloop::waitContextReady()
 			contextError("Can't wait context ready", mContext);
 		}
 
-		pa_threaded_mainloop_wait(mMainloop);
+		waitMainloop(mMainloop);
 	}
 
 	LOG(mLog, DEBUG) << "Context is ready";
@@ -155,6 +329,8 @@ void PulseMainloop::init(const string& name)
 
 	pa_context_set_state_callback(mContext, sContextStateChanged, this);
 
+	mDeviceCache.reset(new PulseDeviceCache(mMainloop, mContext));
+
 	if (pa_context_connect(mContext, nullptr, PA_CONTEXT_NOFLAGS, nullptr) < 0)
 	{
 		contextError("Can't connect context", mContext);
@@ -167,7 +343,12 @@ void PulseMainloop::init(const string& name)
 		throw Exception("Can't start Pulse mainloop", PA_ERR_UNKNOWN);
 	}
 
+	// the mainloop thread is created by pulse: set it up from inside
+	pa_mainloop_api_once(api, sSetupThread, nullptr);
+
 	waitContextReady();
+
+	mDeviceCache->subscribe();
 }
 
 void PulseMainloop::release()
@@ -187,18 +368,122 @@ void PulseMainloop::release()
 	LOG(mLog, DEBUG) << "Release";
 }
 
+/*******************************************************************************
+ * PulseMainloopPool
+ ******************************************************************************/
+
+size_t PulseMainloopPool::sSize = 0;
+
+PulseMainloopPool::PulseMainloopPool() :
+	mPerNode(sSize == 0),
+	mNext(0),
+	mMainloops(mPerNode ? getNumNodes() : sSize),
+	mLog("PulseMainloopPool")
+{
+	LOG(mLog, DEBUG) << "Create pool, size: " << mMainloops.size()
+					 << (mPerNode ? ", one per NUMA node" : "");
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+PulseMainloopPool& PulseMainloopPool::getInstance()
+{
+	static PulseMainloopPool sPool;
+
+	return sPool;
+}
+
+PulseMainloopPtr PulseMainloopPool::get()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	auto index = selectIndex();
+	auto& mainloop = mMainloops[index];
+
+	if (mainloop && !mainloop->isConnected())
+	{
+		LOG(mLog, WARNING) << "Main loop " << index
+						   << " is disconnected, reconnect";
+
+		mRetired.push_back(mainloop);
+		mainloop.reset();
+	}
+
+	if (!mainloop)
+	{
+		mainloop.reset(new PulseMainloop("snd_be:" + to_string(index)));
+	}
+
+	return mainloop;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+size_t PulseMainloopPool::selectIndex()
+{
+	if (mPerNode)
+	{
+		return getCurrentNode() % mMainloops.size();
+	}
+
+	return mNext++ % mMainloops.size();
+}
+
+size_t PulseMainloopPool::getNumNodes()
+{
+	size_t numNodes = 0;
+
+	while (access(("/sys/devices/system/node/node" +
+				   to_string(numNodes)).c_str(), F_OK) == 0)
+	{
+		numNodes++;
+	}
+
+	return numNodes ? numNodes : 1;
+}
+
+size_t PulseMainloopPool::getCurrentNode()
+{
+	int cpu = sched_getcpu();
+
+	if (cpu < 0)
+	{
+		return 0;
+	}
+
+	auto cpuPath = "/sys/devices/system/cpu/cpu" + to_string(cpu) + "/node";
+
+	for (size_t node = 0; node < getNumNodes(); node++)
+	{
+		if (access((cpuPath + to_string(node)).c_str(), F_OK) == 0)
+		{
+			return node;
+		}
+	}
+
+	return 0;
+}
+
 /*******************************************************************************
  * PulsePcm
  ******************************************************************************/
 
+bool PulsePcm::sLatencyMode = false;
+bool PulsePcm::sPullMode = false;
+
 PulsePcm::PulsePcm(pa_threaded_mainloop* mainloop, pa_context* context,
+				   PulseDeviceCache& deviceCache,
 				   StreamType type, const string& name,
 				   const string& propName, const string& propValue,
 				   const string& deviceName) :
 	mMainloop(mainloop),
 	mContext(context),
+	mDeviceCache(deviceCache),
 	mStream(nullptr),
-	mTimeEvent(nullptr),
 	mSuccess(0),
 	mMutex(mainloop),
 	mType(type),
@@ -209,7 +494,14 @@ PulsePcm::PulsePcm(pa_threaded_mainloop* mainloop, pa_context* context,
 	mReadData(nullptr),
 	mReadIndex(0),
 	mReadLength(0),
-	mLog("PulsePcm")
+	mBufferLatency(std::make_shared<Metrics::Metric>()),
+	mNumReferences(0),
+	mStarved(false),
+	mRingClosed(false),
+	mKickFd(-1),
+	mKickEvent(nullptr),
+	mLog("PulsePcm"),
+	mTimer(bind(&PulsePcm::timerCbk, this))
 {
 	LOG(mLog, DEBUG) << "Create pcm device: " << mName;
 }
@@ -255,6 +547,11 @@ void PulsePcm::open(const PcmParams& params)
 
 	if (mType == StreamType::PLAYBACK)
 	{
+		if (sPullMode)
+		{
+			initPull();
+		}
+
 		connectPlaybackStream(deviceName);
 	}
 	else
@@ -263,6 +560,10 @@ void PulsePcm::open(const PcmParams& params)
 	}
 
 	waitStreamReady();
+
+	pa_stream_set_buffer_attr_callback(mStream, sBufferAttrChanged, this);
+
+	bufferAttrChanged();
 }
 
 void PulsePcm::close()
@@ -283,17 +584,29 @@ void PulsePcm::close()
 
 		pa_stream_disconnect(mStream);
 
-		pa_threaded_mainloop_wait(mMainloop);
+		waitMainloop(mMainloop);
 
 		pa_stream_set_state_callback(mStream, nullptr, nullptr);
 		pa_stream_set_write_callback(mStream, nullptr, nullptr);
 		pa_stream_set_latency_update_callback(mStream, nullptr, nullptr);
 		pa_stream_set_read_callback(mStream, nullptr, nullptr);
+		pa_stream_set_buffer_attr_callback(mStream, nullptr, nullptr);
+		pa_stream_set_underflow_callback(mStream, nullptr, nullptr);
+		pa_stream_set_overflow_callback(mStream, nullptr, nullptr);
 
 		pa_stream_unref(mStream);
 
 		mStream = nullptr;
+
+		// the shared buffer is unmapped after close
+		while (mNumReferences &&
+			   PA_CONTEXT_IS_GOOD(pa_context_get_state(mContext)))
+		{
+			waitMainloop(mMainloop);
+		}
 	}
+
+	releasePull();
 }
 
 void PulsePcm::read(uint8_t* buffer, size_t size)
@@ -326,7 +639,7 @@ void PulsePcm::read(uint8_t* buffer, size_t size)
 
 			if (mReadLength <= 0)
 			{
-				pa_threaded_mainloop_wait(mMainloop);
+				waitMainloop(mMainloop);
 
 				checkStatus();
 			}
@@ -348,6 +661,8 @@ void PulsePcm::read(uint8_t* buffer, size_t size)
 		memcpy(buffer, static_cast<const uint8_t*>(mReadData) + mReadIndex,
 			   readableSize);
 
+		mMetrics.capturedBytes->inc(readableSize);
+
 		buffer = buffer + readableSize;
 		size -= readableSize;
 
@@ -370,54 +685,30 @@ void PulsePcm::read(uint8_t* buffer, size_t size)
 
 void PulsePcm::write(uint8_t* buffer, size_t size)
 {
-	lock_guard<PulseMutex> lock(mMutex);
-
-	DLOG(mLog, DEBUG) << "Write to pcm device: " << mName
-					  << ", size: " << size;
-
-	if (mType != StreamType::PLAYBACK)
+	if (mRing)
 	{
-		throw Exception("Wrong stream type", PA_ERR_BADSTATE);
+		writeRing(buffer, size);
 	}
-
-	if (!buffer || !size)
+	else
 	{
-		throw Exception("Can't write stream", PA_ERR_INVALID);
+		writeData(buffer, size, false);
 	}
 
-	checkStatus();
+	mMetrics.writtenBytes->inc(size);
+}
 
-	while (size > 0)
+void PulsePcm::writeShared(uint8_t* buffer, size_t size)
+{
+	if (mRing)
 	{
-		size_t writableSize;
-
-		while ((writableSize = pa_stream_writable_size(mStream)) == 0)
-		{
-			pa_threaded_mainloop_wait(mMainloop);
-
-			checkStatus();
-		}
-
-		if (writableSize == static_cast<size_t>(-1))
-		{
-			contextError("Can't write stream", mContext);
-		}
-
-		if (writableSize > size)
-		{
-			writableSize = size;
-		}
-
-		if (pa_stream_write(mStream, buffer, writableSize, nullptr,
-							0LL, PA_SEEK_RELATIVE) < 0)
-		{
-			contextError("Can't write stream", mContext);
-		}
-
-		buffer = buffer + writableSize;
-
-		size -= writableSize;
+		writeRing(buffer, size);
 	}
+	else
+	{
+		writeData(buffer, size, true);
+	}
+
+	mMetrics.writtenBytes->inc(size);
 }
 
 void PulsePcm::start()
@@ -465,6 +756,14 @@ void PulsePcm::stop()
 
 	flush();
 
+	// the main loop is the consumer of the ring and it is locked
+	if (mRing)
+	{
+		mRing->clear();
+
+		notifyWriter();
+	}
+
 	stopTimer();
 }
 
@@ -510,10 +809,259 @@ void PulsePcm::resume()
 	pa_operation_unref(op);
 }
 
+void PulsePcm::setMetricLabels(const Metrics::Labels& labels)
+{
+	mMetrics.publish(labels);
+
+	Metrics::Registry::getInstance().add(
+			"snd_be_pulse_buffer_latency_us",
+			"Latency of the server buffer granted to the stream",
+			Metrics::Registry::Type::GAUGE, labels, mBufferLatency);
+}
+
 /*******************************************************************************
  * Private
  ******************************************************************************/
 
+void PulsePcm::writeData(uint8_t* buffer, size_t size, bool shared)
+{
+	lock_guard<PulseMutex> lock(mMutex);
+
+	DLOG(mLog, DEBUG) << "Write to pcm device: " << mName
+					  << ", size: " << size;
+
+	if (mType != StreamType::PLAYBACK)
+	{
+		throw Exception("Wrong stream type", PA_ERR_BADSTATE);
+	}
+
+	if (!buffer || !size)
+	{
+		throw Exception("Can't write stream", PA_ERR_INVALID);
+	}
+
+	checkStatus();
+
+	while (size > 0)
+	{
+		size_t writableSize;
+
+		while ((writableSize = pa_stream_writable_size(mStream)) == 0)
+		{
+			waitMainloop(mMainloop);
+
+			checkStatus();
+		}
+
+		if (writableSize == static_cast<size_t>(-1))
+		{
+			contextError("Can't write stream", mContext);
+		}
+
+		if (writableSize > size)
+		{
+			writableSize = size;
+		}
+
+		// libpulse calls the free callback at once if it copies the data
+		if (shared)
+		{
+			mNumReferences++;
+
+			if (pa_stream_write_ext_free(mStream, buffer, writableSize,
+										 sFreeCbk, this, 0LL,
+										 PA_SEEK_RELATIVE) < 0)
+			{
+				mNumReferences--;
+
+				contextError("Can't write stream", mContext);
+			}
+		}
+		else if (pa_stream_write(mStream, buffer, writableSize, nullptr,
+								 0LL, PA_SEEK_RELATIVE) < 0)
+		{
+			contextError("Can't write stream", mContext);
+		}
+
+		buffer = buffer + writableSize;
+
+		size -= writableSize;
+	}
+}
+
+void PulsePcm::initPull()
+{
+	mRing.reset(new Mix::SpscRing<uint8_t>(mParams.bufferSize));
+	mStarved = false;
+	mRingClosed = false;
+
+	// writes wake up the main loop through the eventfd without its lock
+	if ((mKickFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+	{
+		throw Exception("Can't create eventfd", PA_ERR_INTERNAL);
+	}
+
+	auto api = pa_threaded_mainloop_get_api(mMainloop);
+
+	mKickEvent = api->io_new(api, mKickFd, PA_IO_EVENT_INPUT, sKickCbk, this);
+
+	if (!mKickEvent)
+	{
+		throw Exception("Can't create io event", PA_ERR_INTERNAL);
+	}
+}
+
+void PulsePcm::releasePull()
+{
+	if (mKickEvent)
+	{
+		auto api = pa_threaded_mainloop_get_api(mMainloop);
+
+		api->io_free(mKickEvent);
+
+		mKickEvent = nullptr;
+	}
+
+	if (mKickFd >= 0)
+	{
+		::close(mKickFd);
+
+		mKickFd = -1;
+	}
+
+	if (mRing)
+	{
+		mRingClosed = true;
+
+		notifyWriter();
+
+		mRing.reset();
+	}
+}
+
+void PulsePcm::writeRing(uint8_t* buffer, size_t size)
+{
+	DLOG(mLog, DEBUG) << "Write to pcm ring: " << mName
+					  << ", size: " << size;
+
+	if (!buffer || !size)
+	{
+		throw Exception("Can't write stream", PA_ERR_INVALID);
+	}
+
+	while (size > 0)
+	{
+		auto written = mRing->write(buffer, size);
+
+		buffer += written;
+		size -= written;
+
+		// the main loop found the ring empty: it won't pull until kicked
+		if (written && mStarved.exchange(false))
+		{
+			kick();
+		}
+
+		if (size)
+		{
+			unique_lock<mutex> lock(mRingMutex);
+
+			mRingCondVar.wait(lock, [this] {
+				return mRing->getWriteAvailable() || mRingClosed; });
+
+			if (mRingClosed)
+			{
+				throw Exception("Stream error", PA_ERR_BADSTATE);
+			}
+		}
+	}
+}
+
+void PulsePcm::pullData()
+{
+	auto frameSize = pa_frame_size(&mSampleSpec);
+
+	while(true)
+	{
+		auto size = pa_stream_writable_size(mStream);
+
+		if (size == 0 || size == static_cast<size_t>(-1))
+		{
+			return;
+		}
+
+		size = min(size, mRing->getReadAvailable());
+		size -= size % frameSize;
+
+		if (!size)
+		{
+			mStarved = true;
+
+			// the writer may have put data before it saw the flag
+			if (mRing->getReadAvailable() < frameSize)
+			{
+				return;
+			}
+
+			mStarved = false;
+
+			continue;
+		}
+
+		void* data;
+
+		if (pa_stream_begin_write(mStream, &data, &size) < 0)
+		{
+			LOG(mLog, ERROR) << "Can't begin write: "
+							 << pa_strerror(pa_context_errno(mContext));
+
+			return;
+		}
+
+		size -= size % frameSize;
+
+		if (!size)
+		{
+			pa_stream_cancel_write(mStream);
+
+			return;
+		}
+
+		mRing->read(static_cast<uint8_t*>(data), size);
+
+		if (pa_stream_write(mStream, data, size, nullptr, 0LL,
+							PA_SEEK_RELATIVE) < 0)
+		{
+			LOG(mLog, ERROR) << "Can't write stream: "
+							 << pa_strerror(pa_context_errno(mContext));
+
+			return;
+		}
+
+		notifyWriter();
+	}
+}
+
+void PulsePcm::kick()
+{
+	uint64_t value = 1;
+
+	if (::write(mKickFd, &value, sizeof(value)) < 0)
+	{
+		LOG(mLog, ERROR) << "Can't kick main loop";
+	}
+}
+
+void PulsePcm::notifyWriter()
+{
+	// taking the mutex orders the notification after the writer's check
+	{
+		lock_guard<mutex> lock(mRingMutex);
+	}
+
+	mRingCondVar.notify_all();
+}
+
 void PulsePcm::sStreamStateChanged(pa_stream *stream, void *data)
 {
 	static_cast<PulsePcm*>(data)->streamStateChanged();
@@ -534,15 +1082,40 @@ void PulsePcm::sSuccessCbk(pa_stream* stream, int success, void *data)
 	static_cast<PulsePcm*>(data)->successCbk(success);
 }
 
-void PulsePcm::sTimeEventCbk(pa_mainloop_api *api, pa_time_event *timeEvent,
-							 const struct timeval *tv, void *data)
+void PulsePcm::sUpdateTimingCbk(pa_stream *stream, int success, void *data)
 {
-	static_cast<PulsePcm*>(data)->timeEventCbk(api, timeEvent, tv);
+	static_cast<PulsePcm*>(data)->updateTimingCbk(success);
 }
 
-void PulsePcm::sUpdateTimingCbk(pa_stream *stream, int success, void *data)
+void PulsePcm::sKickCbk(pa_mainloop_api *api, pa_io_event *event, int fd,
+						pa_io_event_flags_t flags, void *data)
 {
-	static_cast<PulsePcm*>(data)->updateTimingCbk(success);
+	uint64_t value;
+
+	if (::read(fd, &value, sizeof(value)) > 0)
+	{
+		auto pcm = static_cast<PulsePcm*>(data);
+
+		if (pcm->mStream)
+		{
+			pcm->pullData();
+		}
+	}
+}
+
+void PulsePcm::sFreeCbk(void *data)
+{
+	static_cast<PulsePcm*>(data)->freeCbk();
+}
+
+void PulsePcm::sBufferAttrChanged(pa_stream *stream, void *data)
+{
+	static_cast<PulsePcm*>(data)->bufferAttrChanged();
+}
+
+void PulsePcm::sXrun(pa_stream *stream, void *data)
+{
+	static_cast<PulsePcm*>(data)->mMetrics.xruns->inc();
 }
 
 void PulsePcm::streamStateChanged()
@@ -553,10 +1126,22 @@ void PulsePcm::streamStateChanged()
 
 	switch (state)
 	{
-		case PA_STREAM_READY:
 		case PA_STREAM_FAILED:
 		case PA_STREAM_TERMINATED:
 
+			if (mRing)
+			{
+				mRingClosed = true;
+
+				notifyWriter();
+			}
+
+			pa_threaded_mainloop_signal(mMainloop, 0);
+
+			break;
+
+		case PA_STREAM_READY:
+
 			pa_threaded_mainloop_signal(mMainloop, 0);
 
 			break;
@@ -568,6 +1153,11 @@ void PulsePcm::streamStateChanged()
 
 void PulsePcm::streamRequest(size_t nbytes)
 {
+	if (mRing)
+	{
+		pullData();
+	}
+
 	pa_threaded_mainloop_signal(mMainloop, 0);
 }
 
@@ -583,9 +1173,10 @@ void PulsePcm::successCbk(int success)
 	pa_threaded_mainloop_signal(mMainloop, 0);
 }
 
-void PulsePcm::timeEventCbk(pa_mainloop_api *api, pa_time_event *timeEvent,
-							const struct timeval *tv)
+void PulsePcm::timerCbk()
 {
+	lock_guard<PulseMutex> lock(mMutex);
+
 	if (mStream && pa_stream_get_state(mStream) == PA_STREAM_READY)
 	{
 		auto op = pa_stream_update_timing_info(mStream, sUpdateTimingCbk, this);
@@ -599,13 +1190,6 @@ void PulsePcm::timeEventCbk(pa_mainloop_api *api, pa_time_event *timeEvent,
 			pa_operation_unref(op);
 		}
 	}
-
-	timeval now;
-
-	gettimeofday(&now, nullptr);
-	pa_timeval_add(&now, pa_bytes_to_usec(mParams.periodSize, &mSampleSpec));
-
-	api->time_restart(timeEvent, &now);
 }
 
 void PulsePcm::updateTimingCbk(int success)
@@ -625,6 +1209,35 @@ void PulsePcm::updateTimingCbk(int success)
 	}
 }
 
+void PulsePcm::freeCbk()
+{
+	mNumReferences--;
+
+	pa_threaded_mainloop_signal(mMainloop, 0);
+}
+
+void PulsePcm::bufferAttrChanged()
+{
+	auto attr = pa_stream_get_buffer_attr(mStream);
+
+	if (!attr)
+	{
+		return;
+	}
+
+	auto size = mType == StreamType::PLAYBACK ? attr->tlength : attr->fragsize;
+
+	auto latency = pa_bytes_to_usec(size, &mSampleSpec);
+
+	mBufferLatency->set(latency);
+
+	LOG(mLog, INFO) << "Buffer attributes, maxlength: " << attr->maxlength
+					<< ", tlength: " << attr->tlength
+					<< ", minreq: " << attr->minreq
+					<< ", fragsize: " << attr->fragsize
+					<< ", latency: " << latency / 1000 << " ms";
+}
+
 void PulsePcm::waitStreamReady()
 {
 	for (;;)
@@ -641,7 +1254,7 @@ void PulsePcm::waitStreamReady()
 			contextError("Can't wait stream ready", mContext);
 		}
 
-		pa_threaded_mainloop_wait(mMainloop);
+		waitMainloop(mMainloop);
 	}
 }
 
@@ -664,7 +1277,7 @@ int PulsePcm::waitOperationFinished(pa_operation* op)
 	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING &&
 		   (states = getStatus()) == PA_OK)
 	{
-		pa_threaded_mainloop_wait(mMainloop);
+		waitMainloop(mMainloop);
 	}
 
 	if (states != PA_OK)
@@ -709,8 +1322,8 @@ PulsePcm::PcmFormat PulsePcm::sPcmFormat[] =
 	{XENSND_PCM_FORMAT_U8,                 PA_SAMPLE_U8 },
 	{XENSND_PCM_FORMAT_S16_LE,             PA_SAMPLE_S16LE },
 	{XENSND_PCM_FORMAT_S16_BE,             PA_SAMPLE_S16BE },
-	{XENSND_PCM_FORMAT_S24_LE,             PA_SAMPLE_S24LE },
-	{XENSND_PCM_FORMAT_S24_BE,             PA_SAMPLE_S24BE },
+	{XENSND_PCM_FORMAT_S24_LE,             PA_SAMPLE_S24_32LE },
+	{XENSND_PCM_FORMAT_S24_BE,             PA_SAMPLE_S24_32BE },
 	{XENSND_PCM_FORMAT_S32_LE,             PA_SAMPLE_S32LE },
 	{XENSND_PCM_FORMAT_S32_BE,             PA_SAMPLE_S32BE },
 	{XENSND_PCM_FORMAT_A_LAW,              PA_SAMPLE_ALAW },
@@ -734,29 +1347,14 @@ pa_sample_format_t PulsePcm::convertPcmFormat(uint8_t format)
 
 void PulsePcm::startTimer()
 {
-	timeval now;
-
-	gettimeofday(&now, nullptr);
-	pa_timeval_add(&now, pa_bytes_to_usec(mParams.periodSize, &mSampleSpec));
-
-	auto api = pa_threaded_mainloop_get_api(mMainloop);
-	mTimeEvent = api->time_new(api, &now, sTimeEventCbk, this);
-
-	if (!mTimeEvent)
-	{
-		throw Exception("Can't create time event " + mName, PA_ERR_UNKNOWN);
-	}
+	mTimer.start(microseconds(pa_bytes_to_usec(mParams.periodSize,
+											   &mSampleSpec)));
 }
 
 void PulsePcm::stopTimer()
 {
-	if (mTimeEvent)
-	{
-		auto api = pa_threaded_mainloop_get_api(mMainloop);
-		api->time_free(mTimeEvent);
-
-		mTimeEvent = nullptr;
-	}
+	// the callback takes the main loop lock which is held by the caller
+	mTimer.stop(false);
 }
 
 void PulsePcm::createStream()
@@ -783,18 +1381,43 @@ void PulsePcm::createStream()
 	pa_stream_set_state_callback(mStream, sStreamStateChanged, this);
 }
 
-void PulsePcm::connectPlaybackStream(const char* deviceName)
+pa_buffer_attr PulsePcm::getBufferAttr()
 {
 	pa_buffer_attr bufferAttr;
 
-	bufferAttr.maxlength = -1; //mParams.bufferSize ? mParams.bufferSize : -1;
+	bufferAttr.maxlength = -1;
 	bufferAttr.tlength = -1;
 	bufferAttr.prebuf = 0;
 	bufferAttr.minreq = -1;
 	bufferAttr.fragsize = -1;
 
+	if (sLatencyMode && mParams.bufferSize && mParams.periodSize)
+	{
+		// with PA_STREAM_ADJUST_LATENCY tlength and fragsize are the whole
+		// latency including the device buffer
+		bufferAttr.maxlength = mParams.bufferSize;
+
+		if (mType == StreamType::PLAYBACK)
+		{
+			bufferAttr.tlength = mParams.bufferSize;
+			bufferAttr.minreq = mParams.periodSize;
+		}
+		else
+		{
+			bufferAttr.fragsize = mParams.periodSize;
+		}
+	}
+
+	return bufferAttr;
+}
+
+void PulsePcm::connectPlaybackStream(const char* deviceName)
+{
+	auto bufferAttr = getBufferAttr();
+
 	pa_stream_set_write_callback(mStream, sStreamRequest, this);
 	pa_stream_set_latency_update_callback(mStream, sLatencyUpdate, this);
+	pa_stream_set_underflow_callback(mStream, sXrun, this);
 
 	if (pa_stream_connect_playback(mStream, deviceName, &bufferAttr,
 								   static_cast<pa_stream_flags_t>(
@@ -810,9 +1433,12 @@ void PulsePcm::connectPlaybackStream(const char* deviceName)
 
 void PulsePcm::connectCaptureStream(const char* deviceName)
 {
+	auto bufferAttr = getBufferAttr();
+
 	pa_stream_set_read_callback(mStream, sStreamRequest, this);
+	pa_stream_set_overflow_callback(mStream, sXrun, this);
 
-	if (pa_stream_connect_record(mStream, deviceName, nullptr,
+	if (pa_stream_connect_record(mStream, deviceName, &bufferAttr,
 								 static_cast<pa_stream_flags_t>(
 								 PA_STREAM_INTERPOLATE_TIMING |
 								 PA_STREAM_ADJUST_LATENCY |
@@ -824,7 +1450,53 @@ void PulsePcm::connectCaptureStream(const char* deviceName)
 
 void PulsePcm::queryHwRanges(SoundItf::PcmParamRanges& req, SoundItf::PcmParamRanges& resp)
 {
+	lock_guard<PulseMutex> lock(mMutex);
+
 	resp = req;
+
+	resp.formats = 0;
+
+	for (auto value : sPcmFormat)
+	{
+		if (1ull << value.sndif & req.formats)
+		{
+			resp.formats |= 1ull << value.sndif;
+		}
+	}
+
+	pa_sample_spec spec;
+
+	try
+	{
+		spec = mDeviceCache.getSampleSpec(mType, mDeviceName);
+	}
+	catch(const std::exception& e)
+	{
+		LOG(mLog, WARNING) << e.what() << ", don't refine HW parameters";
+
+		return;
+	}
+
+	// the server converts anything else: offer the native spec only if the
+	// request allows it, so the server doesn't convert
+
+	for (auto value : sPcmFormat)
+	{
+		if (value.pulse == spec.format && 1ull << value.sndif & resp.formats)
+		{
+			resp.formats = 1ull << value.sndif;
+		}
+	}
+
+	if (req.rates.min <= spec.rate && spec.rate <= req.rates.max)
+	{
+		resp.rates.min = resp.rates.max = spec.rate;
+	}
+
+	if (req.channels.min <= spec.channels && spec.channels <= req.channels.max)
+	{
+		resp.channels.min = resp.channels.max = spec.channels;
+	}
 }
 
 }
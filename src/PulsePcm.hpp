@@ -21,6 +21,13 @@
 #ifndef SRC_PULSEPCM_HPP_
 #define SRC_PULSEPCM_HPP_
 
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include <pulse/pulseaudio.h>
 #include <pulse/simple.h>
 
@@ -28,6 +35,8 @@
 #include <xen/be/Log.hpp>
 
 #include "SoundItf.hpp"
+#include "SpscRing.hpp"
+#include "TimerScheduler.hpp"
 
 namespace Pulse {
 
@@ -100,6 +109,62 @@ private:
 	pa_proplist* mProplist;
 };
 
+/***************************************************************************//**
+ * Caches sample specs of PulseAudio sinks and sources.
+ *
+ * The spec of a device is requested from the server once and shared by all
+ * streams of the main loop. The cache is cleared when the server reports a
+ * change of sinks, sources or defaults. Must be used with the main loop lock
+ * taken.
+ * @ingroup pulse
+ ******************************************************************************/
+class PulseDeviceCache
+{
+public:
+
+	PulseDeviceCache(pa_threaded_mainloop* mainloop, pa_context* context);
+
+	/**
+	 * Subscribes to server changes. Should be called when the context is
+	 * ready.
+	 */
+	void subscribe();
+
+	/**
+	 * Returns sample spec of the device. Requests it if it is not cached.
+	 * @param type       stream type
+	 * @param deviceName sink or source name, empty - default one
+	 */
+	const pa_sample_spec& getSampleSpec(SoundItf::StreamType type,
+										const std::string& deviceName);
+
+private:
+
+	typedef std::pair<SoundItf::StreamType, std::string> Key;
+
+	pa_threaded_mainloop* mMainloop;
+	pa_context* mContext;
+
+	std::map<Key, pa_sample_spec> mSpecs;
+
+	pa_sample_spec mReceivedSpec;
+	bool mReceived;
+
+	XenBackend::Log mLog;
+
+	static void sSinkInfoCbk(pa_context* context, const pa_sink_info* info,
+							 int eol, void* data);
+	static void sSourceInfoCbk(pa_context* context,
+							   const pa_source_info* info,
+							   int eol, void* data);
+	static void sSubscribeCbk(pa_context* context,
+							  pa_subscription_event_type_t type,
+							  uint32_t index, void* data);
+
+	void infoCbk(const pa_sample_spec* spec);
+	void subscribeCbk(pa_subscription_event_type_t type);
+};
+
 /***************************************************************************//**
  * PulseAudio main loop
  * @ingroup pulse
@@ -116,15 +181,22 @@ public:
 						   const std::string& propValue = "",
 						   const std::string& deviceValue = "");
 
+	/**
+	 * Returns true if the context is connected to the server.
+	 */
+	bool isConnected();
+
 private:
 
 	pa_threaded_mainloop* mMainloop;
 	pa_context* mContext;
 	PulseMutex mMutex;
+	std::unique_ptr<PulseDeviceCache> mDeviceCache;
 
 	XenBackend::Log mLog;
 
 	static void sContextStateChanged(pa_context *context, void *data);
+	static void sSetupThread(pa_mainloop_api *api, void *data);
 	void contextStateChanged();
 
 	void waitContextReady();
@@ -132,6 +204,60 @@ private:
 	void release();
 };
 
+typedef std::shared_ptr<PulseMainloop> PulseMainloopPtr;
+
+/***************************************************************************//**
+ * Process wide pool of PulseAudio main loops.
+ *
+ * Each main loop is a thread and a client connection to the server. Instead
+ * of one main loop per frontend, frontends share a fixed number of them.
+ * Main loops are created on first use, so frontends without pulse streams
+ * don't connect to the server. By default there is one main loop per NUMA
+ * node and the caller gets the one of the node it runs on, otherwise main
+ * loops are given out round robin. A main loop which lost the connection is
+ * replaced, the old one is kept until exit as its streams may still use it.
+ * @ingroup pulse
+ ******************************************************************************/
+class PulseMainloopPool
+{
+public:
+
+	/**
+	 * Returns the pool.
+	 */
+	static PulseMainloopPool& getInstance();
+
+	/**
+	 * Sets number of main loops. Should be called before the first get.
+	 * @param size number of main loops, 0 - one per NUMA node
+	 */
+	static void setSize(size_t size) { sSize = size; }
+
+	/**
+	 * Returns main loop to create streams on. Creates it if needed.
+	 */
+	PulseMainloopPtr get();
+
+private:
+
+	static size_t sSize;
+
+	bool mPerNode;
+	size_t mNext;
+	std::vector<PulseMainloopPtr> mMainloops;
+	std::vector<PulseMainloopPtr> mRetired;
+	std::mutex mMutex;
+
+	XenBackend::Log mLog;
+
+	PulseMainloopPool();
+
+	size_t selectIndex();
+
+	static size_t getNumNodes();
+	static size_t getCurrentNode();
+};
+
 /***************************************************************************//**
  * Provides PulseAudio pcm functionality.
  * @ingroup pulse
@@ -144,6 +270,7 @@ public:
 	 * @param name pcm device name
 	 */
 	PulsePcm(pa_threaded_mainloop* mainloop, pa_context* context,
+			 PulseDeviceCache& deviceCache,
 			 SoundItf::StreamType type,
 			 const std::string& name,
 			 const std::string& propName,
@@ -152,6 +279,20 @@ public:
 
 	~PulsePcm();
 
+	/**
+	 * Enables latency mode: server buffers are sized from the frontend
+	 * period and buffer sizes instead of server defaults.
+	 * @param enable enable latency mode
+	 */
+	static void setLatencyMode(bool enable) { sLatencyMode = enable; }
+
+	/**
+	 * Enables pull mode of playback streams: writes put data into a ring
+	 * which is read by the main loop when the server requests data.
+	 * @param enable enable pull mode
+	 */
+	static void setPullMode(bool enable) { sPullMode = enable; }
+
 	/**
 	 * Queries the device for HW intervals and masks.
 	 * @req HW parameters that the frontend wants to set
@@ -184,6 +325,14 @@ public:
 	 */
 	void write(uint8_t* buffer, size_t size) override;
 
+	/**
+	 * Writes data from the shared buffer: the data is passed to the server by
+	 * reference. Close waits until all references are released.
+	 * @param buffer buffer with data
+	 * @param size   number of bytes to write
+	 */
+	void writeShared(uint8_t* buffer, size_t size) override;
+
 	/**
 	 * Starts the pcm device.
 	 */
@@ -213,6 +362,12 @@ public:
 		mProgressCbk = cbk;
 	}
 
+	/**
+	 * Publishes the device metrics with the labels of the stream.
+	 * @param labels metric labels
+	 */
+	void setMetricLabels(const Metrics::Labels& labels) override;
+
 private:
 
 	struct PcmFormat
@@ -223,10 +378,13 @@ private:
 
 	static PcmFormat sPcmFormat[];
 
+	static bool sLatencyMode;
+	static bool sPullMode;
+
 	pa_threaded_mainloop* mMainloop;
 	pa_context*  mContext;
+	PulseDeviceCache& mDeviceCache;
 	pa_stream* mStream;
-	pa_time_event* mTimeEvent;
 	int mSuccess;
 	PulseMutex mMutex;
 	SoundItf::StreamType mType;
@@ -239,26 +397,56 @@ private:
 	size_t mReadLength;
 	pa_sample_spec mSampleSpec;
 	SoundItf::PcmParams mParams;
+	// latency of the granted server buffer in microseconds
+	Metrics::MetricPtr mBufferLatency;
+	size_t mNumReferences;
+
+	// pull mode: the ring is written by writes and read by the main loop
+	std::unique_ptr<Mix::SpscRing<uint8_t>> mRing;
+	std::atomic<bool> mStarved;
+	std::atomic<bool> mRingClosed;
+	std::mutex mRingMutex;
+	std::condition_variable mRingCondVar;
+	int mKickFd;
+	pa_io_event* mKickEvent;
 
 	XenBackend::Log mLog;
 
 	SoundItf::ProgressCbk mProgressCbk;
+	Metrics::PcmMetrics mMetrics;
+
+	// the last member: the callback in progress is waited before the other
+	// members are destroyed
+	ScheduledTimer mTimer;
 
 	static void sStreamStateChanged(pa_stream *stream, void *data);
 	static void sStreamRequest(pa_stream *stream, size_t nbytes, void *data);
 	static void sLatencyUpdate(pa_stream *stream, void *data);
 	static void sSuccessCbk(pa_stream* stream, int success, void *data);
-	static void sTimeEventCbk(pa_mainloop_api *api, pa_time_event *timeEvent,
-							  const struct timeval *tv, void *data);
 	static void sUpdateTimingCbk(pa_stream *stream, int success, void *data);
+	static void sBufferAttrChanged(pa_stream *stream, void *data);
+	static void sXrun(pa_stream *stream, void *data);
+	static void sFreeCbk(void *data);
+	static void sKickCbk(pa_mainloop_api *api, pa_io_event *event, int fd,
+						 pa_io_event_flags_t flags, void *data);
 
 	void streamStateChanged();
 	void streamRequest(size_t nbytes);
 	void latencyUpdate();
 	void successCbk(int success);
-	void timeEventCbk(pa_mainloop_api *api, pa_time_event *timeEvent,
-					  const struct timeval *tv);
+	void timerCbk();
 	void updateTimingCbk(int success);
+	void bufferAttrChanged();
+	void freeCbk();
+
+	void writeData(uint8_t* buffer, size_t size, bool shared);
+
+	void initPull();
+	void releasePull();
+	void writeRing(uint8_t* buffer, size_t size);
+	void pullData();
+	void kick();
+	void notifyWriter();
 
 	void waitStreamReady();
 	void flush();
@@ -270,6 +458,7 @@ private:
 	void stopTimer();
 
 	void createStream();
+	pa_buffer_attr getBufferAttr();
 	void connectPlaybackStream(const char* deviceName);
 	void connectCaptureStream(const char* deviceName);
 
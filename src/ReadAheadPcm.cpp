@@ -0,0 +1,269 @@
+/*
+ *  Capture read-ahead pcm device
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "ReadAheadPcm.hpp"
+
+#include <vector>
+
+#include <xen/be/Exception.hpp>
+#include <xen/io/sndif.h>
+
+#include "FormatConverter.hpp"
+#include "RealTime.hpp"
+
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+using std::vector;
+
+using SoundItf::PcmDevicePtr;
+using SoundItf::PcmParams;
+
+/*******************************************************************************
+ * ReadAheadPcm
+ ******************************************************************************/
+
+ReadAheadPcm::ReadAheadPcm(PcmDevicePtr pcmDevice) :
+	mPcmDevice(pcmDevice),
+	mChunkSize(0),
+	mFormat(0),
+	mPosition(0),
+	mState(State::STOPPED),
+	mReading(false),
+	mNumUnderflows(std::make_shared<Metrics::Metric>()),
+	mNumOverflows(std::make_shared<Metrics::Metric>()),
+	mLog("ReadAheadPcm")
+{
+	// the position is reported by the read ahead thread
+	mPcmDevice->setProgressCbk([] (uint64_t bytes) {});
+}
+
+ReadAheadPcm::~ReadAheadPcm()
+{
+	stopThread();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void ReadAheadPcm::open(const PcmParams& params)
+{
+	mPcmDevice->open(params);
+
+	mChunkSize = params.periodSize ? params.periodSize : params.bufferSize / 4;
+	mFormat = params.format;
+
+	mRing.reset(new Mix::SpscRing<uint8_t>(params.bufferSize));
+}
+
+void ReadAheadPcm::close()
+{
+	stopThread();
+
+	mPcmDevice->close();
+
+	if (mNumUnderflows->get() || mNumOverflows->get())
+	{
+		LOG(mLog, DEBUG) << "Underflows: " << mNumUnderflows->get()
+						 << ", overflows: " << mNumOverflows->get();
+	}
+}
+
+void ReadAheadPcm::read(uint8_t* buffer, size_t size)
+{
+	if (!mRing)
+	{
+		throw XenBackend::Exception("Device is not opened", EFAULT);
+	}
+
+	auto numRead = mRing->read(buffer, size);
+
+	if (numRead < size)
+	{
+		mNumUnderflows->inc();
+
+		DLOG(mLog, DEBUG) << "Underflow, requested: " << size
+						  << ", available: " << numRead;
+
+		Dsp::FormatConverter::fillSilence(mFormat, buffer + numRead,
+										  size - numRead);
+	}
+}
+
+void ReadAheadPcm::write(uint8_t* buffer, size_t size)
+{
+	throw XenBackend::Exception("Write to capture device", EINVAL);
+}
+
+void ReadAheadPcm::start()
+{
+	stopThread();
+
+	if (mRing)
+	{
+		mRing->clear();
+	}
+
+	mPosition = 0;
+
+	mPcmDevice->start();
+
+	mState = State::RUNNING;
+
+	mThread = thread(&ReadAheadPcm::run, this);
+}
+
+void ReadAheadPcm::stop()
+{
+	stopThread();
+
+	mPcmDevice->stop();
+}
+
+void ReadAheadPcm::pause()
+{
+	{
+		unique_lock<mutex> lock(mMutex);
+
+		mState = State::PAUSED;
+
+		// the period being read is received before the device is paused
+		mCondVar.wait(lock, [this] { return !mReading; });
+	}
+
+	mPcmDevice->pause();
+}
+
+void ReadAheadPcm::resume()
+{
+	mPcmDevice->resume();
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mState = State::RUNNING;
+	}
+
+	mCondVar.notify_all();
+}
+
+void ReadAheadPcm::setMetricLabels(const Metrics::Labels& labels)
+{
+	mPcmDevice->setMetricLabels(labels);
+
+	auto& registry = Metrics::Registry::getInstance();
+
+	registry.add("snd_be_readahead_underflows_total",
+				 "Number of capture reads which got less data than requested",
+				 Metrics::Registry::Type::COUNTER, labels, mNumUnderflows);
+	registry.add("snd_be_readahead_overflows_total",
+				 "Number of captured periods dropped because the ring was full",
+				 Metrics::Registry::Type::COUNTER, labels, mNumOverflows);
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void ReadAheadPcm::run()
+{
+	RealTime::setupThread(RealTime::ThreadClass::CAPTURE);
+
+	vector<uint8_t> buffer(mChunkSize);
+
+	while(true)
+	{
+		{
+			unique_lock<mutex> lock(mMutex);
+
+			mReading = false;
+
+			mCondVar.notify_all();
+
+			mCondVar.wait(lock, [this] { return mState != State::PAUSED; });
+
+			if (mState == State::TERMINATING)
+			{
+				break;
+			}
+
+			mReading = true;
+		}
+
+		try
+		{
+			mPcmDevice->read(buffer.data(), buffer.size());
+		}
+		catch(const std::exception& e)
+		{
+			LOG(mLog, ERROR) << e.what();
+
+			lock_guard<mutex> lock(mMutex);
+
+			mReading = false;
+
+			mCondVar.notify_all();
+
+			break;
+		}
+
+		// write whole periods only to keep frames aligned
+		if (mRing->getWriteAvailable() < buffer.size())
+		{
+			mNumOverflows->inc();
+
+			DLOG(mLog, DEBUG) << "Overflow, drop period";
+
+			continue;
+		}
+
+		mRing->write(buffer.data(), buffer.size());
+
+		mPosition += buffer.size();
+
+		if (mProgressCbk)
+		{
+			mProgressCbk(mPosition);
+		}
+	}
+}
+
+void ReadAheadPcm::stopThread()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		if (!mThread.joinable())
+		{
+			return;
+		}
+
+		mState = State::TERMINATING;
+	}
+
+	mCondVar.notify_all();
+
+	// waits until the period being read is received
+	mThread.join();
+
+	mState = State::STOPPED;
+}
@@ -0,0 +1,155 @@
+/*
+ *  Capture read-ahead pcm device
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_READAHEADPCM_HPP_
+#define SRC_READAHEADPCM_HPP_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <xen/be/Log.hpp>
+
+#include "SoundItf.hpp"
+#include "SpscRing.hpp"
+
+/***************************************************************************//**
+ * Capture pcm device which reads the underlying device ahead of requests.
+ *
+ * Once started, a thread reads the underlying device period by period into
+ * a lock-free ring and reports the number of bytes in the ring as the stream
+ * position. Read takes data from the ring and doesn't wait for the device:
+ * missing data is filled with silence and counted as underflow. A period
+ * which doesn't fit into the ring is dropped and counted as overflow. The
+ * counters are published with the metrics of the stream.
+ * @ingroup snd_be
+ ******************************************************************************/
+class ReadAheadPcm : public SoundItf::PcmDevice
+{
+public:
+
+	/**
+	 * @param pcmDevice underlying capture pcm device
+	 */
+	explicit ReadAheadPcm(SoundItf::PcmDevicePtr pcmDevice);
+	~ReadAheadPcm();
+
+	/**
+	 * Queries the device for HW intervals and masks.
+	 * @req HW parameters that the frontend wants to set
+	 * @resp refined HW parameters that backend can support
+	 */
+	void queryHwRanges(SoundItf::PcmParamRanges& req,
+					   SoundItf::PcmParamRanges& resp) override
+	{
+		mPcmDevice->queryHwRanges(req, resp);
+	}
+
+	/**
+	 * Opens the device.
+	 * @param params pcm parameters
+	 */
+	void open(const SoundItf::PcmParams& params) override;
+
+	/**
+	 * Closes the device.
+	 */
+	void close() override;
+
+	/**
+	 * Reads data from the ring.
+	 * @param buffer buffer where to put data
+	 * @param size   number of bytes to read
+	 */
+	void read(uint8_t* buffer, size_t size) override;
+
+	/**
+	 * Writes data to the device.
+	 * @param buffer buffer with data
+	 * @param size   number of bytes to write
+	 */
+	void write(uint8_t* buffer, size_t size) override;
+
+	/**
+	 * Starts the device and reading ahead.
+	 */
+	void start() override;
+
+	/**
+	 * Stops reading ahead and the device.
+	 */
+	void stop() override;
+
+	/**
+	 * Pauses the device.
+	 */
+	void pause() override;
+
+	/**
+	 * Resumes the device.
+	 */
+	void resume() override;
+
+	/**
+	 * Sets progress callback.
+	 * @param cbk callback
+	 */
+	void setProgressCbk(SoundItf::ProgressCbk cbk) override
+	{
+		mProgressCbk = cbk;
+	}
+
+	/**
+	 * Publishes the device metrics with the labels of the stream.
+	 * @param labels metric labels
+	 */
+	void setMetricLabels(const Metrics::Labels& labels) override;
+
+private:
+
+	enum class State {STOPPED, RUNNING, PAUSED, TERMINATING};
+
+	SoundItf::PcmDevicePtr mPcmDevice;
+	SoundItf::ProgressCbk mProgressCbk;
+
+	std::unique_ptr<Mix::SpscRing<uint8_t>> mRing;
+	size_t mChunkSize;
+	uint8_t mFormat;
+	uint64_t mPosition;
+
+	State mState;
+	bool mReading;
+	std::mutex mMutex;
+	std::condition_variable mCondVar;
+	std::thread mThread;
+
+	// reads which got less data than requested
+	Metrics::MetricPtr mNumUnderflows;
+	// periods dropped because the ring was full
+	Metrics::MetricPtr mNumOverflows;
+
+	XenBackend::Log mLog;
+
+	void run();
+	void stopThread();
+};
+
+#endif /* SRC_READAHEADPCM_HPP_ */
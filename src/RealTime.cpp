@@ -0,0 +1,290 @@
+/*
+ *  Real-time scheduling of audio threads
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "RealTime.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <xen/be/Exception.hpp>
+#include <xen/be/Log.hpp>
+
+using std::getline;
+using std::istringstream;
+using std::string;
+using std::thread;
+using std::vector;
+
+using XenBackend::Exception;
+
+namespace {
+
+const char* cClassNames[] = {"playback", "capture", "timer", "mainloop",
+							 "mixer"};
+
+const size_t cNumClasses = sizeof(cClassNames) / sizeof(cClassNames[0]);
+
+// each thread is set up once, even if its loop calls setupThread repeatedly
+thread_local bool gThreadSetUp = false;
+
+}
+
+/*******************************************************************************
+ * RealTime
+ ******************************************************************************/
+
+vector<int> RealTime::sPriorities(cNumClasses, 0);
+vector<int> RealTime::sCpus;
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void RealTime::setPriorities(const string& spec)
+{
+	if (spec.find(':') == string::npos)
+	{
+		std::fill(sPriorities.begin(), sPriorities.end(),
+				  parsePriority(spec));
+
+		return;
+	}
+
+	istringstream stream(spec);
+	string item;
+
+	while(getline(stream, item, ','))
+	{
+		auto pos = item.find(':');
+		auto name = item.substr(0, pos);
+		auto it = std::find(cClassNames, cClassNames + cNumClasses, name);
+
+		if (pos == string::npos || it == cClassNames + cNumClasses)
+		{
+			throw Exception("Invalid thread class: " + item, EINVAL);
+		}
+
+		sPriorities[it - cClassNames] = parsePriority(item.substr(pos + 1));
+	}
+}
+
+void RealTime::setCpus(const string& spec)
+{
+	istringstream stream(spec);
+	string item;
+
+	sCpus.clear();
+
+	while(getline(stream, item, ','))
+	{
+		try
+		{
+			auto pos = item.find('-');
+			int first = std::stoi(item.substr(0, pos));
+			int last = pos == string::npos ?
+					   first : std::stoi(item.substr(pos + 1));
+
+			if (first < 0 || last < first || last >= CPU_SETSIZE)
+			{
+				throw Exception("Invalid CPU range: " + item, EINVAL);
+			}
+
+			for (int cpu = first; cpu <= last; cpu++)
+			{
+				sCpus.push_back(cpu);
+			}
+		}
+		catch(const std::logic_error& e)
+		{
+			throw Exception("Invalid CPU: " + item, EINVAL);
+		}
+	}
+}
+
+void RealTime::init()
+{
+	if (!isEnabled())
+	{
+		LOG("RealTime", DEBUG) << "Real-time mode is disabled";
+
+		return;
+	}
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+	{
+		LOG("RealTime", WARNING) << "Can't lock memory: " << strerror(errno);
+	}
+	else
+	{
+		LOG("RealTime", INFO) << "Memory is locked";
+	}
+
+	// probe on a temporary thread to not change the main thread scheduling
+	int maxPriority = *std::max_element(sPriorities.begin(),
+										sPriorities.end());
+	int ret = 0;
+
+	thread([maxPriority, &ret] {
+		sched_param param {};
+
+		param.sched_priority = maxPriority;
+
+		ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	}).join();
+
+	if (ret)
+	{
+		LOG("RealTime", WARNING) << "SCHED_FIFO is not granted: "
+								 << strerror(ret)
+								 << ". Audio threads run at normal priority";
+	}
+	else
+	{
+		LOG("RealTime", INFO) << "SCHED_FIFO is granted, max priority: "
+							  << maxPriority;
+	}
+
+	for (size_t i = 0; i < cNumClasses; i++)
+	{
+		LOG("RealTime", INFO) << "Priority of " << cClassNames[i]
+							  << " threads: " << sPriorities[i];
+	}
+}
+
+void RealTime::setupThread(ThreadClass threadClass, int defaultPriority)
+{
+	if (gThreadSetUp)
+	{
+		return;
+	}
+
+	gThreadSetUp = true;
+
+	int priority = getPriority(threadClass, defaultPriority);
+
+	if (priority)
+	{
+		sched_param param {};
+
+		param.sched_priority = priority;
+
+		int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+		if (ret)
+		{
+			LOG("RealTime", WARNING) << "Can't set RT priority of "
+									 << getClassName(threadClass)
+									 << " thread: " << strerror(ret);
+		}
+	}
+
+	if (!sCpus.empty())
+	{
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+
+		for (auto cpu : sCpus)
+		{
+			CPU_SET(cpu, &cpus);
+		}
+
+		int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+		if (ret)
+		{
+			LOG("RealTime", WARNING) << "Can't pin "
+									 << getClassName(threadClass)
+									 << " thread: " << strerror(ret);
+		}
+	}
+
+	DLOG("RealTime", DEBUG) << "Setup " << getClassName(threadClass)
+							<< " thread, priority: " << priority;
+}
+
+void RealTime::prefault(const void* addr, size_t size)
+{
+	if (!isEnabled())
+	{
+		return;
+	}
+
+	static const size_t sPageSize = sysconf(_SC_PAGESIZE);
+
+	auto data = static_cast<const volatile uint8_t*>(addr);
+
+	for (size_t offset = 0; offset < size; offset += sPageSize)
+	{
+		data[offset];
+	}
+}
+
+bool RealTime::isEnabled()
+{
+	return std::any_of(sPriorities.begin(), sPriorities.end(),
+					   [](int priority) { return priority > 0; });
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+int RealTime::getPriority(ThreadClass threadClass, int defaultPriority)
+{
+	auto priority = sPriorities[static_cast<size_t>(threadClass)];
+
+	return priority ? priority : defaultPriority;
+}
+
+int RealTime::parsePriority(const string& value)
+{
+	int priority;
+
+	try
+	{
+		priority = std::stoi(value);
+	}
+	catch(const std::logic_error& e)
+	{
+		throw Exception("Invalid priority: " + value, EINVAL);
+	}
+
+	if (priority < 0 || priority > sched_get_priority_max(SCHED_FIFO))
+	{
+		throw Exception("Priority out of range: " + value, EINVAL);
+	}
+
+	return priority;
+}
+
+const char* RealTime::getClassName(ThreadClass threadClass)
+{
+	return cClassNames[static_cast<size_t>(threadClass)];
+}
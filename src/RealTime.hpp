@@ -0,0 +1,106 @@
+/*
+ *  Real-time scheduling of audio threads
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_REALTIME_HPP_
+#define SRC_REALTIME_HPP_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/***************************************************************************//**
+ * Promotes threads of the audio path to real-time scheduling.
+ *
+ * Each thread calls setupThread once it is started. If a priority is
+ * configured for the class of the thread, the thread is switched to
+ * SCHED_FIFO with this priority. If CPUs are configured, the thread is
+ * pinned to them. When any priority is configured, the process memory is
+ * locked on init and the mapped buffers are prefaulted, so the audio path
+ * doesn't take page faults.
+ * @ingroup snd_be
+ ******************************************************************************/
+class RealTime
+{
+public:
+
+	/**
+	 * Thread classes with separately configured priorities.
+	 */
+	enum class ThreadClass
+	{
+		PLAYBACK,
+		CAPTURE,
+		TIMER,
+		MAINLOOP,
+		MIXER
+	};
+
+	/**
+	 * Sets priorities of the thread classes. Should be called before init.
+	 * @param spec one priority for all classes or comma separated list of
+	 *             <class>:<priority> where class is playback, capture, timer,
+	 *             mainloop or mixer. 0 - don't promote the class.
+	 */
+	static void setPriorities(const std::string& spec);
+
+	/**
+	 * Sets CPUs to pin the audio threads to. Should be called before init.
+	 * @param spec comma separated list of CPUs and ranges, e.g. 0,2-3
+	 */
+	static void setCpus(const std::string& spec);
+
+	/**
+	 * Locks the process memory if the real-time mode is enabled and reports
+	 * whether the kernel grants real-time scheduling.
+	 */
+	static void init();
+
+	/**
+	 * Applies the configured scheduling to the calling thread. Does nothing
+	 * if the thread was already set up.
+	 * @param threadClass     class of the thread
+	 * @param defaultPriority priority if none is configured for the class,
+	 *                        0 - don't promote
+	 */
+	static void setupThread(ThreadClass threadClass, int defaultPriority = 0);
+
+	/**
+	 * Touches each page of the buffer if the real-time mode is enabled.
+	 * @param addr buffer address
+	 * @param size buffer size
+	 */
+	static void prefault(const void* addr, size_t size);
+
+	/**
+	 * Returns true if a priority is configured for any class.
+	 */
+	static bool isEnabled();
+
+private:
+
+	static std::vector<int> sPriorities;
+	static std::vector<int> sCpus;
+
+	static int getPriority(ThreadClass threadClass, int defaultPriority);
+	static int parsePriority(const std::string& value);
+	static const char* getClassName(ThreadClass threadClass);
+};
+
+#endif /* SRC_REALTIME_HPP_ */
@@ -0,0 +1,201 @@
+/*
+ *  Channel remixer
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "Remixer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include <xen/be/Exception.hpp>
+
+using std::find;
+using std::max;
+using std::string;
+using std::vector;
+
+using XenBackend::Exception;
+
+namespace Dsp {
+
+namespace {
+
+enum Position {FL, FR, FC, LFE, RL, RR, SL, SR, RC};
+
+const char* cPositionNames[] = {"FL", "FR", "FC", "LFE", "RL", "RR",
+								"SL", "SR", "RC"};
+
+const vector<vector<Position>> cLayouts =
+{
+	{},
+	{FC},
+	{FL, FR},
+	{FL, FR, LFE},
+	{FL, FR, RL, RR},
+	{FL, FR, RL, RR, FC},
+	{FL, FR, RL, RR, FC, LFE},
+	{FL, FR, RL, RR, FC, LFE, RC},
+	{FL, FR, RL, RR, FC, LFE, SL, SR},
+};
+
+struct Target
+{
+	Position position;
+	float gain;
+};
+
+const float c3dB = 0.70710678f;
+
+// where to put a channel which is missing in the output layout:
+// the first alternative which targets only existing channels is used
+const vector<vector<vector<Target>>> cFallbacks =
+{
+	/* FL  */ {{{FC, c3dB}}},
+	/* FR  */ {{{FC, c3dB}}},
+	/* FC  */ {{{FL, c3dB}, {FR, c3dB}}},
+	/* LFE */ {},
+	/* RL  */ {{{SL, 1.0f}}, {{FL, c3dB}}, {{FC, 0.5f}}},
+	/* RR  */ {{{SR, 1.0f}}, {{FR, c3dB}}, {{FC, 0.5f}}},
+	/* SL  */ {{{RL, 1.0f}}, {{FL, c3dB}}, {{FC, 0.5f}}},
+	/* SR  */ {{{RR, 1.0f}}, {{FR, c3dB}}, {{FC, 0.5f}}},
+	/* RC  */ {{{RL, c3dB}, {RR, c3dB}}, {{SL, c3dB}, {SR, c3dB}},
+			   {{FL, 0.5f}, {FR, 0.5f}}, {{FC, 0.5f}}},
+};
+
+int getIndex(const vector<Position>& layout, Position position)
+{
+	auto it = find(layout.begin(), layout.end(), position);
+
+	return it == layout.end() ? -1 : it - layout.begin();
+}
+
+}
+
+/*******************************************************************************
+ * Remixer
+ ******************************************************************************/
+
+Remixer::Remixer(uint8_t inChannels, uint8_t outChannels) :
+	mInChannels(inChannels),
+	mOutChannels(outChannels),
+	mMatrixKernel(getKernels().matrix),
+	mMatrix(inChannels * cMatrixStride, 0.0f)
+{
+	if (!inChannels || !outChannels ||
+		inChannels > cMaxChannels || outChannels > cMaxChannels)
+	{
+		throw Exception("Can't remix " + std::to_string(inChannels) +
+						" to " + std::to_string(outChannels) + " channels",
+						EINVAL);
+	}
+
+	auto& inLayout = cLayouts[inChannels];
+	auto& outLayout = cLayouts[outChannels];
+
+	for (size_t i = 0; i < inLayout.size(); i++)
+	{
+		auto row = &mMatrix[i * cMatrixStride];
+		auto index = getIndex(outLayout, inLayout[i]);
+
+		if (index >= 0)
+		{
+			row[index] = 1.0f;
+
+			continue;
+		}
+
+		for (auto& alternative : cFallbacks[inLayout[i]])
+		{
+			bool found = true;
+
+			for (auto& target : alternative)
+			{
+				found = found && getIndex(outLayout, target.position) >= 0;
+			}
+
+			if (found)
+			{
+				for (auto& target : alternative)
+				{
+					row[getIndex(outLayout, target.position)] += target.gain;
+				}
+
+				break;
+			}
+		}
+	}
+
+	if (outChannels < inChannels)
+	{
+		float maxGain = 0.0f;
+
+		for (size_t o = 0; o < outChannels; o++)
+		{
+			float gain = 0.0f;
+
+			for (size_t i = 0; i < inChannels; i++)
+			{
+				gain += fabs(mMatrix[i * cMatrixStride + o]);
+			}
+
+			maxGain = max(maxGain, gain);
+		}
+
+		if (maxGain > 1.0f)
+		{
+			for (auto& value : mMatrix)
+			{
+				value /= maxGain;
+			}
+		}
+	}
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+string Remixer::getDescription() const
+{
+	std::ostringstream description;
+
+	description.precision(3);
+
+	for (size_t o = 0; o < mOutChannels; o++)
+	{
+		description << (o ? "; " : "")
+					<< cPositionNames[cLayouts[mOutChannels][o]] << " =";
+
+		for (size_t i = 0; i < mInChannels; i++)
+		{
+			auto gain = mMatrix[i * cMatrixStride + o];
+
+			if (gain != 0.0f)
+			{
+				description << " " << gain << "*"
+							<< cPositionNames[cLayouts[mInChannels][i]];
+			}
+		}
+	}
+
+	return description.str();
+}
+
+}
@@ -0,0 +1,86 @@
+/*
+ *  Channel remixer
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_REMIXER_HPP_
+#define SRC_REMIXER_HPP_
+
+#include <string>
+#include <vector>
+
+#include "FormatKernels.hpp"
+
+namespace Dsp {
+
+/***************************************************************************//**
+ * Converts number of channels of interleaved float frames.
+ *
+ * Channels are expected in ALSA default order: FL FR RL RR FC LFE SL SR
+ * (mono is FC, 2.1 is FL FR LFE, 6.1 has RC instead of SL SR). The matrix is
+ * computed once on construction: channels present on both sides are copied,
+ * missing ones are folded into the nearest available positions with -3 dB
+ * gain, LFE is dropped on downmix. On downmix the matrix is normalized to
+ * avoid clipping.
+ * @ingroup dsp
+ ******************************************************************************/
+class Remixer
+{
+public:
+
+	/**
+	 * Max number of channels on each side.
+	 */
+	static const uint8_t cMaxChannels = cMatrixStride;
+
+	/**
+	 * @param inChannels  number of input channels
+	 * @param outChannels number of output channels
+	 */
+	Remixer(uint8_t inChannels, uint8_t outChannels);
+
+	/**
+	 * Remixes frames.
+	 * @param in        interleaved input frames
+	 * @param out       interleaved output frames
+	 * @param numFrames number of frames
+	 */
+	void process(const float* in, float* out, size_t numFrames)
+	{
+		mMatrixKernel(in, out, mMatrix.data(), mInChannels, mOutChannels,
+					  numFrames);
+	}
+
+	/**
+	 * Returns the matrix for logging.
+	 */
+	std::string getDescription() const;
+
+private:
+
+	uint8_t mInChannels;
+	uint8_t mOutChannels;
+
+	MatrixKernel mMatrixKernel;
+
+	std::vector<float> mMatrix;
+};
+
+}
+
+#endif /* SRC_REMIXER_HPP_ */
@@ -0,0 +1,267 @@
+/*
+ *  Polyphase resampler
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "Resampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <xen/be/Exception.hpp>
+
+using std::min;
+using std::string;
+using std::vector;
+
+using XenBackend::Exception;
+
+namespace Dsp {
+
+namespace {
+
+struct QualityParams
+{
+	const char* name;
+	size_t numTaps;
+	double beta;
+	double rolloff;
+};
+
+const QualityParams cQualityParams[] =
+{
+	{"fast",   16, 6.0,  0.85 },
+	{"medium", 32, 8.0,  0.91 },
+	{"best",   64, 10.0, 0.95 },
+};
+
+uint32_t gcd(uint32_t a, uint32_t b)
+{
+	while (b)
+	{
+		auto t = a % b;
+
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+// zero order modified Bessel function of the first kind
+double besselI0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+
+	for (int k = 1; k < 50; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+
+		if (term < sum * 1e-12)
+		{
+			break;
+		}
+	}
+
+	return sum;
+}
+
+}
+
+/*******************************************************************************
+ * Resampler
+ ******************************************************************************/
+
+Resampler::Resampler(uint32_t inRate, uint32_t outRate, uint8_t numChannels,
+					 Quality quality) :
+	mNumChannels(numChannels),
+	mL(0),
+	mM(0),
+	mNumTaps(0),
+	mDot(getKernels().dot),
+	mHistory(numChannels),
+	mPhase(0),
+	mIndex(0)
+{
+	if (!inRate || !outRate || !numChannels)
+	{
+		throw Exception("Invalid resampler parameters", EINVAL);
+	}
+
+	auto divisor = gcd(inRate, outRate);
+
+	mL = outRate / divisor;
+	mM = inRate / divisor;
+
+	if (mL > cMaxPhases)
+	{
+		throw Exception("Can't resample " + std::to_string(inRate) + " to " +
+						std::to_string(outRate), EINVAL);
+	}
+
+	initCoeffs(quality);
+
+	reset();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void Resampler::process(const float* in, size_t numFrames, vector<float>& out)
+{
+	for (uint8_t channel = 0; channel < mNumChannels; channel++)
+	{
+		auto& history = mHistory[channel];
+		auto size = history.size();
+
+		history.resize(size + numFrames);
+
+		for (size_t i = 0; i < numFrames; i++)
+		{
+			history[size + i] = in[i * mNumChannels + channel];
+		}
+	}
+
+	auto available = mHistory[0].size();
+
+	if (mIndex + mNumTaps > available)
+	{
+		return;
+	}
+
+	// number of output frames which have full history
+	auto numOut = ((available - mNumTaps - mIndex) * mL +
+				   (mL - mPhase) + mM - 1) / mM;
+	auto pos = out.size();
+
+	out.resize(pos + numOut * mNumChannels);
+
+	for (size_t i = 0; i < numOut; i++)
+	{
+		auto coeffs = &mCoeffs[mPhase * mNumTaps];
+
+		for (uint8_t channel = 0; channel < mNumChannels; channel++)
+		{
+			out[pos++] = mDot(&mHistory[channel][mIndex], coeffs, mNumTaps);
+		}
+
+		mPhase += mM;
+		mIndex += mPhase / mL;
+		mPhase %= mL;
+	}
+
+	// keep only the history which is needed for the next output frame
+
+	auto consumed = min(mIndex, available);
+
+	for (auto& history : mHistory)
+	{
+		history.erase(history.begin(), history.begin() + consumed);
+	}
+
+	mIndex -= consumed;
+}
+
+void Resampler::reset()
+{
+	// center the filter on the first input frame
+	for (auto& history : mHistory)
+	{
+		history.assign(mNumTaps / 2, 0.0f);
+	}
+
+	mPhase = 0;
+	mIndex = 0;
+}
+
+Resampler::Quality Resampler::getQuality(const string& name)
+{
+	for (size_t i = 0; i < sizeof(cQualityParams) / sizeof(cQualityParams[0]);
+		 i++)
+	{
+		if (name == cQualityParams[i].name)
+		{
+			return static_cast<Quality>(i);
+		}
+	}
+
+	throw Exception("Invalid resampler quality: " + name, EINVAL);
+}
+
+const char* Resampler::getQualityName(Quality quality)
+{
+	return cQualityParams[static_cast<int>(quality)].name;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void Resampler::initCoeffs(Quality quality)
+{
+	auto& params = cQualityParams[static_cast<int>(quality)];
+
+	// on downsampling the cut off is lowered, so the filter is made longer
+	// to keep the same transition band relative to the output rate
+	double ratio = min(1.0, static_cast<double>(mL) / mM);
+	double cutoff = ratio * params.rolloff;
+
+	mNumTaps = static_cast<size_t>(ceil(params.numTaps / ratio));
+	mNumTaps = (mNumTaps + 7) & ~static_cast<size_t>(7);
+
+	mCoeffs.resize(mL * mNumTaps);
+
+	double halfLength = mNumTaps / 2.0;
+	double i0Beta = besselI0(params.beta);
+
+	for (uint32_t phase = 0; phase < mL; phase++)
+	{
+		auto coeffs = &mCoeffs[phase * mNumTaps];
+		double sum = 0.0;
+
+		for (size_t k = 0; k < mNumTaps; k++)
+		{
+			double t = halfLength + static_cast<double>(phase) / mL - k;
+			double x = t / halfLength;
+			double value = 0.0;
+
+			if (fabs(x) < 1.0)
+			{
+				double arg = M_PI * cutoff * t;
+				double sinc = fabs(arg) < 1e-9 ? 1.0 : sin(arg) / arg;
+
+				value = cutoff * sinc *
+						besselI0(params.beta * sqrt(1.0 - x * x)) / i0Beta;
+			}
+
+			coeffs[k] = value;
+			sum += value;
+		}
+
+		// unity gain on DC for each phase
+		for (size_t k = 0; k < mNumTaps; k++)
+		{
+			coeffs[k] /= sum;
+		}
+	}
+}
+
+}
@@ -0,0 +1,120 @@
+/*
+ *  Polyphase resampler
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_RESAMPLER_HPP_
+#define SRC_RESAMPLER_HPP_
+
+#include <string>
+#include <vector>
+
+#include "FormatKernels.hpp"
+
+namespace Dsp {
+
+/***************************************************************************//**
+ * Converts sample rate of interleaved float frames.
+ *
+ * The rate ratio is reduced to L/M and a Kaiser windowed sinc prototype
+ * filter is split into L phases. Each output sample is one dot product of
+ * the phase coefficients and the input history, which is done by the
+ * vectorized dot kernel. The quality selects number of taps, stop band
+ * attenuation and pass band width.
+ * @ingroup dsp
+ ******************************************************************************/
+class Resampler
+{
+public:
+
+	/**
+	 * Resampler quality
+	 */
+	enum class Quality
+	{
+		FAST,	//!< 16 taps, ~60 dB stop band
+		MEDIUM,	//!< 32 taps, ~80 dB stop band
+		BEST	//!< 64 taps, ~100 dB stop band
+	};
+
+	/**
+	 * @param inRate      input rate in Hz
+	 * @param outRate     output rate in Hz
+	 * @param numChannels number of channels
+	 * @param quality     resampler quality
+	 */
+	Resampler(uint32_t inRate, uint32_t outRate, uint8_t numChannels,
+			  Quality quality = Quality::MEDIUM);
+
+	/**
+	 * Resamples frames.
+	 * @param in        interleaved input frames
+	 * @param numFrames number of input frames
+	 * @param out       vector to append interleaved output frames to
+	 */
+	void process(const float* in, size_t numFrames, std::vector<float>& out);
+
+	/**
+	 * Drops the history.
+	 */
+	void reset();
+
+	/**
+	 * Returns number of filter taps.
+	 */
+	size_t getNumTaps() const { return mNumTaps; }
+
+	/**
+	 * Returns number of filter phases.
+	 */
+	size_t getNumPhases() const { return mL; }
+
+	/**
+	 * Converts quality name to quality.
+	 * @param name quality name: fast, medium or best
+	 */
+	static Quality getQuality(const std::string& name);
+
+	/**
+	 * Returns quality name.
+	 */
+	static const char* getQualityName(Quality quality);
+
+private:
+
+	static const uint32_t cMaxPhases = 4096;
+
+	uint8_t mNumChannels;
+	uint32_t mL;
+	uint32_t mM;
+	size_t mNumTaps;
+
+	DotKernel mDot;
+
+	std::vector<float> mCoeffs;
+	std::vector<std::vector<float>> mHistory;
+
+	uint32_t mPhase;
+	size_t mIndex;
+
+	void initCoeffs(Quality quality);
+};
+
+}
+
+#endif /* SRC_RESAMPLER_HPP_ */
@@ -36,6 +36,12 @@
 #include "MockBackend.hpp"
 #endif
 
+#include "FilePcm.hpp"
+#include "NullPcm.hpp"
+#include "ProcessingPcm.hpp"
+#include "ReadAheadPcm.hpp"
+#include "RealTime.hpp"
+#include "Trace.hpp"
 #include "Version.hpp"
 
 /***************************************************************************//**
@@ -46,6 +52,7 @@
  *
  ******************************************************************************/
 
+using std::chrono::milliseconds;
 using std::cout;
 using std::endl;
 using std::exception;
@@ -62,7 +69,6 @@ using XenBackend::FrontendHandlerException;
 using XenBackend::FrontendHandlerPtr;
 using XenBackend::Log;
 using XenBackend::RingBufferPtr;
-using XenBackend::RingBufferInBase;
 using XenBackend::Utils;
 using XenBackend::XenStore;
 
@@ -70,42 +76,19 @@ using SoundItf::StreamType;
 using SoundItf::PcmDevicePtr;
 using SoundItf::PcmType;
 
+#ifdef WITH_ALSA
+using Alsa::CapsCache;
+#endif
+
 #ifdef WITH_PULSE
-using Pulse::PulseMainloop;
+using Pulse::PulseMainloopPool;
 #endif
 
 string gLogFileName;
-
-/*******************************************************************************
- * StreamRingBuffer
- ******************************************************************************/
-
-StreamRingBuffer::StreamRingBuffer(const string& id, PcmDevicePtr pcmDevice,
-								   EventRingBufferPtr eventRingBuffer,
-								   domid_t domId, evtchn_port_t port,
-								   grant_ref_t ref) :
-	RingBufferInBase<xen_sndif_back_ring, xen_sndif_sring,
-					 xensnd_req, xensnd_resp>(domId, port, ref),
-	mId(id),
-	mCommandHandler(pcmDevice, eventRingBuffer, domId),
-	mLog("StreamRing")
-{
-	LOG(mLog, DEBUG) << "Create stream ring buffer, id: " << id;
-}
-
-void StreamRingBuffer::processRequest(const xensnd_req& req)
-{
-	DLOG(mLog, DEBUG) << "Request received, id: " << mId
-					  << ", cmd:" << static_cast<int>(req.operation);
-
-	xensnd_resp rsp {};
-
-	rsp.id = req.id;
-	rsp.operation = req.operation;
-	rsp.status = mCommandHandler.processCommand(req, rsp);
-
-	sendResponse(rsp);
-}
+string gMetricsSocket;
+Dsp::Resampler::Quality gResamplerQuality = Dsp::Resampler::Quality::MEDIUM;
+milliseconds gPosEventInterval(0);
+size_t gBufferCacheSize = 0;
 
 /*******************************************************************************
  * SndFrontendHandler
@@ -113,11 +96,14 @@ void StreamRingBuffer::processRequest(const xensnd_req& req)
 SndFrontendHandler::SndFrontendHandler(const string devName,
 									   domid_t domId, uint16_t devId) :
 	FrontendHandlerBase("SndFrontend", devName, domId, devId),
-#ifdef WITH_PULSE
-	mPulseMainloop("Dom" + to_string(domId) + ":" + to_string(devId)),
-#endif
+	mBufferCache(new BufferCache(domId, gBufferCacheSize)),
+	mNumStreams(std::make_shared<Metrics::Metric>()),
 	mLog("SndFrontend")
 {
+	Metrics::Registry::getInstance().add(
+			"snd_be_frontend_streams", "Number of bound streams",
+			Metrics::Registry::Type::GAUGE,
+			{to_string(domId), to_string(devId), ""}, mNumStreams);
 }
 
 void SndFrontendHandler::onBind()
@@ -130,6 +116,10 @@ void SndFrontendHandler::onBind()
 void SndFrontendHandler::onClosing()
 {
 	LOG(mLog, DEBUG) << "onClosing";
+
+	mBufferCache->invalidate();
+
+	mNumStreams->set(0);
 }
 
 void SndFrontendHandler::processCard(const std::string& cardPath)
@@ -196,12 +186,20 @@ void SndFrontendHandler::createStream(const string& id, StreamType type,
 
 	addRingBuffer(evtRingBuffer);
 
+	Metrics::Labels labels {to_string(getDomId()), to_string(getDevId()), id};
+
+	auto pcmDevice = createPcmDevice(type, id);
+
+	pcmDevice->setMetricLabels(labels);
+
 	RingBufferPtr reqRingBuffer(
-			new StreamRingBuffer(id, createPcmDevice(type, id),
-								 evtRingBuffer, getDomId(),
-								 reqPort, reqRef));
+			new StreamRingBuffer(id, pcmDevice, evtRingBuffer, mBufferCache,
+								 type, labels, getDomId(), reqPort, reqRef,
+								 gPosEventInterval));
 
 	addRingBuffer(reqRingBuffer);
+
+	mNumStreams->inc();
 }
 
 PcmDevicePtr SndFrontendHandler::createPcmDevice(StreamType type,
@@ -224,22 +222,38 @@ PcmDevicePtr SndFrontendHandler::createPcmDevice(StreamType type,
 					 << ", propName: " << propName
 					 << ", propValue: " << propValue;
 
+	// decide the default type before any backend is touched: creating a
+	// pulse stream connects the shared main loop
+	if (pcmType.empty())
+	{
+#if defined(WITH_ALSA)
+		pcmType = "ALSA";
+#elif defined(WITH_PULSE)
+		pcmType = "PULSE";
+#endif
+	}
+
 #ifdef WITH_PULSE
-	if (pcmType == "PULSE" || pcmType.empty())
+	if (pcmType == "PULSE")
 	{
 		if (propName.empty())
 		{
 			propName = "media.role";
 		}
 
-		pcmDevice.reset(mPulseMainloop.createStream(type, id,
+		if (!mPulseMainloop)
+		{
+			mPulseMainloop = PulseMainloopPool::getInstance().get();
+		}
+
+		pcmDevice.reset(mPulseMainloop->createStream(type, id,
 													propName, propValue,
 													deviceName));
 	}
 #endif
 
 #ifdef WITH_ALSA
-	if (pcmType == "ALSA" || pcmType.empty())
+	if (pcmType == "ALSA")
 	{
 		if (deviceName.empty())
 		{
@@ -248,13 +262,71 @@ PcmDevicePtr SndFrontendHandler::createPcmDevice(StreamType type,
 
 		pcmDevice.reset(new Alsa::AlsaPcm(type, deviceName));
 	}
+
+	if (pcmType == "MIX")
+	{
+		if (deviceName.empty())
+		{
+			deviceName = "default";
+		}
+
+		// capture streams are not mixed: they use the device directly
+		if (type == StreamType::PLAYBACK)
+		{
+			pcmDevice.reset(new Mix::MixerPcm(deviceName));
+		}
+		else
+		{
+			pcmDevice.reset(new Alsa::AlsaPcm(type, deviceName));
+		}
+	}
 #endif
 
+	bool realTime = true;
+
+	if (pcmType == "NULL" || pcmType == "FILE")
+	{
+		if (propName == "clock" && propValue == "fast")
+		{
+			realTime = false;
+		}
+		else if (!propName.empty() &&
+				 !(propName == "clock" && propValue == "realtime"))
+		{
+			throw FrontendHandlerException("Invalid property: " + propName +
+										   ":" + propValue, EINVAL);
+		}
+	}
+
+	if (pcmType == "NULL")
+	{
+		pcmDevice.reset(new Null::NullPcm(type, realTime));
+	}
+
+	if (pcmType == "FILE")
+	{
+		if (deviceName.empty())
+		{
+			throw FrontendHandlerException("No file name: " + id, EINVAL);
+		}
+
+		pcmDevice.reset(new File::FilePcm(type, deviceName, realTime));
+	}
+
 	if (!pcmDevice)
 	{
 		throw FrontendHandlerException("Invalid PCM type: " + pcmType, EINVAL);
 	}
 
+	pcmDevice.reset(new Dsp::ProcessingPcm(pcmDevice, type,
+										   gResamplerQuality));
+
+	// don't block the ring on capture reads, fast devices never block
+	if (type == StreamType::CAPTURE && realTime)
+	{
+		pcmDevice.reset(new ReadAheadPcm(pcmDevice));
+	}
+
 	return pcmDevice;
 }
 
@@ -378,6 +450,16 @@ void registerSignals()
 	act.sa_flags = SA_RESETHAND;
 
 	sigaction(SIGSEGV, &act, nullptr);
+
+#ifdef WITH_TRACE
+	// block before any thread is started: the threads inherit the mask and
+	// the signal is taken by sigwait only
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &set, nullptr);
+#endif
 }
 
 void waitSignals()
@@ -388,16 +470,33 @@ void waitSignals()
 	sigemptyset(&set);
 	sigaddset(&set, SIGINT);
 	sigaddset(&set, SIGTERM);
+#ifdef WITH_TRACE
+	sigaddset(&set, SIGUSR1);
+#endif
 	sigprocmask(SIG_BLOCK, &set, nullptr);
 
-	sigwait(&set,&signal);
+	while(true)
+	{
+		sigwait(&set,&signal);
+
+#ifdef WITH_TRACE
+		if (signal == SIGUSR1)
+		{
+			Trace::Recorder::getInstance().dump();
+
+			continue;
+		}
+#endif
+
+		break;
+	}
 }
 
 bool commandLineOptions(int argc, char *argv[])
 {
 	int opt = -1;
 
-	while((opt = getopt(argc, argv, "c:v:l:fh?")) != -1)
+	while((opt = getopt(argc, argv, "c:v:l:r:e:g:t:a:m:T:p:buq:s:fh?")) != -1)
 	{
 		switch(opt)
 		{
@@ -416,6 +515,133 @@ bool commandLineOptions(int argc, char *argv[])
 
 			break;
 
+		case 'r':
+
+			try
+			{
+				gResamplerQuality = Dsp::Resampler::getQuality(optarg);
+			}
+			catch(const exception& e)
+			{
+				return false;
+			}
+
+			break;
+
+		case 'e':
+
+			try
+			{
+				gPosEventInterval = milliseconds(std::stoul(optarg));
+			}
+			catch(const exception& e)
+			{
+				return false;
+			}
+
+			break;
+
+		case 'g':
+
+			try
+			{
+				gBufferCacheSize = std::stoul(optarg);
+			}
+			catch(const exception& e)
+			{
+				return false;
+			}
+
+			break;
+
+		case 't':
+
+			try
+			{
+				RealTime::setPriorities(optarg);
+			}
+			catch(const exception& e)
+			{
+				return false;
+			}
+
+			break;
+
+		case 'a':
+
+			try
+			{
+				RealTime::setCpus(optarg);
+			}
+			catch(const exception& e)
+			{
+				return false;
+			}
+
+			break;
+
+		case 'm':
+
+			gMetricsSocket = optarg;
+
+			break;
+
+#ifdef WITH_TRACE
+		case 'T':
+
+			Trace::Recorder::setFileName(optarg);
+
+			break;
+#endif
+
+#ifdef WITH_PULSE
+		case 'p':
+
+			try
+			{
+				PulseMainloopPool::setSize(std::stoul(optarg));
+			}
+			catch(const exception& e)
+			{
+				return false;
+			}
+
+			break;
+
+		case 'b':
+
+			Pulse::PulsePcm::setLatencyMode(true);
+
+			break;
+
+		case 'u':
+
+			Pulse::PulsePcm::setPullMode(true);
+
+			break;
+#endif
+
+#ifdef WITH_ALSA
+		case 'q':
+
+			CapsCache::setFileName(optarg);
+
+			break;
+
+		case 's':
+
+			try
+			{
+				Alsa::AlsaPcm::setStandbyTime(milliseconds(std::stoul(optarg)));
+			}
+			catch(const exception& e)
+			{
+				return false;
+			}
+
+			break;
+#endif
+
 		case 'f':
 
 			Log::setShowFileAndLine(true);
@@ -450,6 +676,15 @@ int main(int argc, char *argv[])
 				Log::setStreamBuffer(logFile.rdbuf());
 			}
 
+			RealTime::init();
+
+			unique_ptr<Metrics::Server> metricsServer;
+
+			if (!gMetricsSocket.empty())
+			{
+				metricsServer.reset(new Metrics::Server(gMetricsSocket));
+			}
+
 #ifdef WITH_MOCKBELIB
 			MockBackend mockBackend(0, 1);
 #endif
@@ -467,9 +702,46 @@ int main(int argc, char *argv[])
 		else
 		{
 			cout << "Usage: " << argv[0]
-				 << " [-l <file>] [-v <level>]"
-				 << endl;
+				 << " [-l <file>] [-v <level>] [-r <quality>] [-e <ms>]"
+				 << " [-g <entries>]"
+				 << " [-t <priorities>] [-a <cpus>] [-m <socket>]"
+#ifdef WITH_TRACE
+				 << " [-T <file>]"
+#endif
+				 << " [-p <size>] [-b] [-u] [-q <file>] [-s <ms>]" << endl;
 			cout << "\t-l -- log file" << endl;
+			cout << "\t-r -- resampler quality: fast, medium (default), best"
+				 << endl;
+			cout << "\t-e -- min interval between position events within a "
+				 << "period in ms, 0 (default) - no limit" << endl;
+			cout << "\t-g -- number of shared buffers kept mapped after close "
+				 << "per frontend, 0 (default) - unmap on close" << endl;
+			cout << "\t-t -- SCHED_FIFO priority of audio threads: <prio> or "
+				 << "<class>:<prio>,..." << endl;
+			cout << "\t      classes: playback, capture, timer, mainloop, "
+				 << "mixer; 0 (default) - normal priority" << endl;
+			cout << "\t-a -- CPUs to pin audio threads to, e.g. 0,2-3"
+				 << endl;
+			cout << "\t-m -- UNIX socket to serve metrics in Prometheus "
+				 << "format" << endl;
+#ifdef WITH_TRACE
+			cout << "\t-T -- file to write trace to on SIGUSR1, "
+				 << "default /tmp/snd_be_trace.json" << endl;
+#endif
+#ifdef WITH_PULSE
+			cout << "\t-p -- number of shared pulse connections, "
+				 << "0 (default) - one per NUMA node" << endl;
+			cout << "\t-b -- size pulse buffers from frontend period and "
+				 << "buffer sizes" << endl;
+			cout << "\t-u -- pull pulse playback data from the main loop"
+				 << endl;
+#endif
+#ifdef WITH_ALSA
+			cout << "\t-q -- file to keep alsa device caps between runs"
+				 << endl;
+			cout << "\t-s -- time in ms to keep alsa device after close, "
+				 << "0 (default) - close immediately" << endl;
+#endif
 			cout << "\t-v -- verbose level in format: "
 				 << "<module>:<level>;<module:<level>" << endl;
 			cout << "\t      use * for mask selection:"
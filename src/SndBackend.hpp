@@ -26,10 +26,11 @@
 #include <xen/be/RingBufferBase.hpp>
 #include <xen/be/Log.hpp>
 
-#include "CommandHandler.hpp"
+#include "StreamRingBuffer.hpp"
 
 #ifdef WITH_ALSA
 #include "AlsaPcm.hpp"
+#include "MixerPcm.hpp"
 #endif
 
 #ifdef WITH_PULSE
@@ -41,37 +42,6 @@
  * Backend related classes.
  ******************************************************************************/
 
-/***************************************************************************//**
- * Ring buffer used for the audio stream.
- * @ingroup snd_be
- ******************************************************************************/
-class StreamRingBuffer : public XenBackend::RingBufferInBase<
-											xen_sndif_back_ring,
-											xen_sndif_sring,
-											xensnd_req,
-											xensnd_resp>
-{
-public:
-	/**
-	 * @param id    stream id
-	 * @param type  stream type
-	 * @param domId frontend domain id
-	 * @param port  event channel port number
-	 * @param ref   grant table reference
-	 */
-	StreamRingBuffer(const std::string& id,
-					 SoundItf::PcmDevicePtr pcmDevice,
-					 EventRingBufferPtr eventRingBuffer,
-					 domid_t domId, evtchn_port_t port, grant_ref_t ref);
-
-private:
-	std::string mId;
-	CommandHandler mCommandHandler;
-	XenBackend::Log mLog;
-
-	void processRequest(const xensnd_req& req);
-};
-
 /***************************************************************************//**
  * Sound frontend handler.
  * @ingroup snd_be
@@ -103,9 +73,14 @@ protected:
 private:
 
 #ifdef WITH_PULSE
-	Pulse::PulseMainloop mPulseMainloop;
+	// attached on the first pulse stream
+	Pulse::PulseMainloopPtr mPulseMainloop;
 #endif
 
+	BufferCachePtr mBufferCache;
+
+	Metrics::MetricPtr mNumStreams;
+
 	XenBackend::Log mLog;
 
 	SoundItf::PcmDevicePtr createPcmDevice(SoundItf::StreamType type,
@@ -27,6 +27,8 @@
 
 #include <xen/be/Log.hpp>
 
+#include "Metrics.hpp"
+
 namespace SoundItf {
 
 /***************************************************************************//**
@@ -136,6 +138,18 @@ public:
 	 */
 	virtual void write(uint8_t* buffer, size_t size) = 0;
 
+	/**
+	 * Writes data from the shared buffer. The buffer stays mapped until the
+	 * device is closed, so the device may keep references to the data
+	 * instead of copying it.
+	 * @param buffer buffer with data
+	 * @param size   number of bytes to write
+	 */
+	virtual void writeShared(uint8_t* buffer, size_t size)
+	{
+		write(buffer, size);
+	}
+
 	/**
 	 * Starts the pcm device.
 	 */
@@ -161,6 +175,12 @@ public:
 	 * @param cbk callback
 	 */
 	virtual void setProgressCbk(ProgressCbk cbk) = 0;
+
+	/**
+	 * Publishes the device metrics with the labels of the stream.
+	 * @param labels metric labels
+	 */
+	virtual void setMetricLabels(const Metrics::Labels& labels) {}
 };
 
 typedef std::shared_ptr<PcmDevice> PcmDevicePtr;
@@ -0,0 +1,166 @@
+/*
+ *  Single producer single consumer ring
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_SPSCRING_HPP_
+#define SRC_SPSCRING_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+namespace Mix {
+
+/***************************************************************************//**
+ * Lock-free ring of trivially copyable elements with one producer thread and
+ * one consumer thread.
+ *
+ * The capacity is rounded up to a power of two. Read and write positions are
+ * free running counters: each one is modified by its own side only, so no
+ * locks or read-modify-write atomics are needed.
+ * @ingroup mix
+ ******************************************************************************/
+template<typename T>
+class SpscRing
+{
+public:
+
+	/**
+	 * @param capacity min number of elements the ring can hold
+	 */
+	explicit SpscRing(size_t capacity) :
+		mReadPos(0),
+		mWritePos(0)
+	{
+		size_t size = 1;
+
+		while (size < capacity)
+		{
+			size <<= 1;
+		}
+
+		mBuffer.resize(size);
+		mMask = size - 1;
+	}
+
+	/**
+	 * Returns number of elements the ring can hold.
+	 */
+	size_t getCapacity() const { return mBuffer.size(); }
+
+	/**
+	 * Returns number of elements available for reading. Consumer side.
+	 */
+	size_t getReadAvailable() const
+	{
+		return mWritePos.load(std::memory_order_acquire) -
+			   mReadPos.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Returns number of elements which can be written. Producer side.
+	 */
+	size_t getWriteAvailable() const
+	{
+		return mBuffer.size() -
+			   (mWritePos.load(std::memory_order_relaxed) -
+				mReadPos.load(std::memory_order_acquire));
+	}
+
+	/**
+	 * Writes as many elements as fit. Producer side.
+	 * @param data  elements to write
+	 * @param count number of elements
+	 * @return number of elements written
+	 */
+	size_t write(const T* data, size_t count)
+	{
+		auto pos = mWritePos.load(std::memory_order_relaxed);
+
+		count = std::min(count, getWriteAvailable());
+
+		copy(data, &mBuffer[0], pos, count, true);
+
+		mWritePos.store(pos + count, std::memory_order_release);
+
+		return count;
+	}
+
+	/**
+	 * Reads as many elements as available. Consumer side.
+	 * @param data  buffer where to put elements
+	 * @param count max number of elements
+	 * @return number of elements read
+	 */
+	size_t read(T* data, size_t count)
+	{
+		auto pos = mReadPos.load(std::memory_order_relaxed);
+
+		count = std::min(count, getReadAvailable());
+
+		copy(&mBuffer[0], data, pos, count, false);
+
+		mReadPos.store(pos + count, std::memory_order_release);
+
+		return count;
+	}
+
+	/**
+	 * Drops all available elements. Consumer side: must be called by the
+	 * consumer thread or with the consumer excluded, e.g. under the lock it
+	 * consumes with.
+	 */
+	void clear()
+	{
+		mReadPos.store(mWritePos.load(std::memory_order_acquire),
+					   std::memory_order_release);
+	}
+
+private:
+
+	std::vector<T> mBuffer;
+	size_t mMask;
+
+	// keep the positions on separate cache lines to avoid false sharing
+	std::atomic<size_t> mReadPos;
+	char mPad[64];
+	std::atomic<size_t> mWritePos;
+
+	void copy(const T* src, T* dst, size_t pos, size_t count, bool toRing)
+	{
+		auto offset = pos & mMask;
+		auto first = std::min(count, mBuffer.size() - offset);
+
+		if (toRing)
+		{
+			memcpy(&dst[offset], src, first * sizeof(T));
+			memcpy(dst, &src[first], (count - first) * sizeof(T));
+		}
+		else
+		{
+			memcpy(dst, &src[offset], first * sizeof(T));
+			memcpy(&dst[first], src, (count - first) * sizeof(T));
+		}
+	}
+};
+
+}
+
+#endif /* SRC_SPSCRING_HPP_ */
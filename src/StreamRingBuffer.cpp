@@ -0,0 +1,89 @@
+/*
+ *  Stream ring buffer
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "StreamRingBuffer.hpp"
+
+#include "RealTime.hpp"
+#include "Trace.hpp"
+
+using std::chrono::milliseconds;
+using std::string;
+
+using XenBackend::RingBufferInBase;
+
+using SoundItf::PcmDevicePtr;
+using SoundItf::StreamType;
+
+/*******************************************************************************
+ * StreamRingBuffer
+ ******************************************************************************/
+
+StreamRingBuffer::StreamRingBuffer(const string& id, PcmDevicePtr pcmDevice,
+								   EventRingBufferPtr eventRingBuffer,
+								   BufferCachePtr bufferCache,
+								   StreamType type,
+								   const Metrics::Labels& labels,
+								   domid_t domId, evtchn_port_t port,
+								   grant_ref_t ref, milliseconds posInterval) :
+	RingBufferInBase<xen_sndif_back_ring, xen_sndif_sring,
+					 xensnd_req, xensnd_resp>(domId, port, ref),
+	mId(id),
+	mType(type),
+	mStats(id),
+	mCommandHandler(pcmDevice, eventRingBuffer, bufferCache, mStats, labels,
+					type, domId, posInterval),
+	mLog("StreamRing")
+{
+	LOG(mLog, DEBUG) << "Create stream ring buffer, id: " << id;
+}
+
+void StreamRingBuffer::processRequest(const xensnd_req& req)
+{
+	TRACE_SCOPE_ARG("StreamRingBuffer::processRequest", req.operation);
+
+	auto start = StreamStats::Clock::now();
+
+	DLOG(mLog, DEBUG) << "Request received, id: " << mId
+					  << ", cmd:" << static_cast<int>(req.operation);
+
+	// requests are processed on the ring thread which is started by libxenbe
+	RealTime::setupThread(mType == StreamType::PLAYBACK ?
+						  RealTime::ThreadClass::PLAYBACK :
+						  RealTime::ThreadClass::CAPTURE);
+
+	xensnd_resp rsp {};
+
+	rsp.id = req.id;
+	rsp.operation = req.operation;
+	rsp.status = mCommandHandler.processCommand(req, rsp);
+
+	{
+		TRACE_SCOPE("StreamRingBuffer::sendResponse");
+
+		sendResponse(rsp);
+	}
+
+	mStats.recordRequest(req.operation, start);
+
+	if (req.operation == XENSND_OP_CLOSE)
+	{
+		mStats.dump();
+	}
+}
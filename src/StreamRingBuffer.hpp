@@ -0,0 +1,76 @@
+/*
+ *  Stream ring buffer
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef SRC_STREAMRINGBUFFER_HPP_
+#define SRC_STREAMRINGBUFFER_HPP_
+
+#include <chrono>
+#include <string>
+
+#include <xen/be/RingBufferBase.hpp>
+#include <xen/be/Log.hpp>
+
+#include "CommandHandler.hpp"
+#include "StreamStats.hpp"
+
+/***************************************************************************//**
+ * Ring buffer used for the audio stream.
+ * @ingroup snd_be
+ ******************************************************************************/
+class StreamRingBuffer : public XenBackend::RingBufferInBase<
+											xen_sndif_back_ring,
+											xen_sndif_sring,
+											xensnd_req,
+											xensnd_resp>
+{
+public:
+	/**
+	 * @param id              stream id
+	 * @param pcmDevice       pcm device
+	 * @param eventRingBuffer event ring buffer
+	 * @param bufferCache     cache of mapped buffers
+	 * @param type            stream type
+	 * @param labels          metric labels of the stream
+	 * @param domId           frontend domain id
+	 * @param port            event channel port number
+	 * @param ref             grant table reference
+	 * @param posInterval     min interval between position events
+	 */
+	StreamRingBuffer(const std::string& id,
+					 SoundItf::PcmDevicePtr pcmDevice,
+					 EventRingBufferPtr eventRingBuffer,
+					 BufferCachePtr bufferCache,
+					 SoundItf::StreamType type,
+					 const Metrics::Labels& labels,
+					 domid_t domId, evtchn_port_t port, grant_ref_t ref,
+					 std::chrono::milliseconds posInterval =
+							 std::chrono::milliseconds(0));
+
+private:
+	std::string mId;
+	SoundItf::StreamType mType;
+	StreamStats mStats;
+	CommandHandler mCommandHandler;
+	XenBackend::Log mLog;
+
+	void processRequest(const xensnd_req& req);
+};
+
+#endif /* SRC_STREAMRINGBUFFER_HPP_ */
@@ -0,0 +1,304 @@
+/*
+ *  Stream latency statistics
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "StreamStats.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+#include <xen/io/sndif.h>
+
+using std::memory_order_relaxed;
+using std::min;
+using std::ostringstream;
+using std::string;
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+
+/*******************************************************************************
+ * LatencyHistogram
+ ******************************************************************************/
+
+LatencyHistogram::LatencyHistogram()
+{
+	reset();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void LatencyHistogram::record(nanoseconds value)
+{
+	uint64_t ns = value.count() > 0 ? value.count() : 0;
+
+	mBuckets[getIndex(ns)].fetch_add(1, memory_order_relaxed);
+
+	auto max = mMax.load(memory_order_relaxed);
+
+	while(ns > max &&
+		  !mMax.compare_exchange_weak(max, ns, memory_order_relaxed));
+}
+
+uint64_t LatencyHistogram::getCount() const
+{
+	uint64_t count = 0;
+
+	for (auto& bucket : mBuckets)
+	{
+		count += bucket.load(memory_order_relaxed);
+	}
+
+	return count;
+}
+
+nanoseconds LatencyHistogram::getPercentile(double percentile) const
+{
+	uint64_t count = getCount();
+
+	if (!count)
+	{
+		return nanoseconds(0);
+	}
+
+	uint64_t threshold = std::max<uint64_t>(1, count * percentile / 100.0);
+	uint64_t accumulated = 0;
+
+	for (size_t i = 0; i < cNumBuckets; i++)
+	{
+		accumulated += mBuckets[i].load(memory_order_relaxed);
+
+		if (accumulated >= threshold)
+		{
+			// report the top of the bucket but not above the max value
+			uint64_t value = i + 1 < cNumBuckets ?
+							 getLowerBound(i + 1) - 1 : UINT64_MAX;
+
+			return min(nanoseconds(value), getMax());
+		}
+	}
+
+	return getMax();
+}
+
+nanoseconds LatencyHistogram::getMean() const
+{
+	uint64_t count = 0;
+	double sum = 0.0;
+
+	for (size_t i = 0; i < cNumBuckets; i++)
+	{
+		uint64_t bucketCount = mBuckets[i].load(memory_order_relaxed);
+		double upper = i + 1 < cNumBuckets ? getLowerBound(i + 1) : UINT64_MAX;
+
+		count += bucketCount;
+		sum += bucketCount * (getLowerBound(i) + upper - 1) / 2.0;
+	}
+
+	return nanoseconds(count ? min<uint64_t>(sum / count,
+											 getMax().count()) : 0);
+}
+
+nanoseconds LatencyHistogram::getMax() const
+{
+	return nanoseconds(mMax.load(memory_order_relaxed));
+}
+
+string LatencyHistogram::getSummary() const
+{
+	auto us = [](nanoseconds value) { return value.count() / 1000.0; };
+
+	ostringstream stream;
+
+	stream.setf(std::ios::fixed);
+	stream.precision(1);
+
+	stream << "count: " << getCount()
+		   << ", mean: " << us(getMean())
+		   << " us, p50: " << us(getPercentile(50.0))
+		   << " us, p99: " << us(getPercentile(99.0))
+		   << " us, p99.9: " << us(getPercentile(99.9))
+		   << " us, max: " << us(getMax()) << " us";
+
+	return stream.str();
+}
+
+void LatencyHistogram::reset()
+{
+	for (auto& bucket : mBuckets)
+	{
+		bucket.store(0, memory_order_relaxed);
+	}
+
+	mMax.store(0, memory_order_relaxed);
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+size_t LatencyHistogram::getIndex(uint64_t value)
+{
+	if (value < (1u << cSubBits))
+	{
+		return value;
+	}
+
+	unsigned exponent = 63 - __builtin_clzll(value);
+	unsigned sub = (value >> (exponent - cSubBits)) & ((1u << cSubBits) - 1);
+
+	return ((exponent - cSubBits + 1) << cSubBits) + sub;
+}
+
+uint64_t LatencyHistogram::getLowerBound(size_t index)
+{
+	if (index < (1u << cSubBits))
+	{
+		return index;
+	}
+
+	unsigned exponent = (index >> cSubBits) + cSubBits - 1;
+	uint64_t sub = index & ((1u << cSubBits) - 1);
+
+	return ((1ull << cSubBits) + sub) << (exponent - cSubBits);
+}
+
+/*******************************************************************************
+ * StreamStats
+ ******************************************************************************/
+
+const char* StreamStats::cOperationNames[NUM_OPERATIONS] =
+{
+	"OPEN", "CLOSE", "READ", "WRITE", "TRIGGER", "QUERY_HW_PARAM"
+};
+
+StreamStats::StreamStats(const string& id) :
+	mId(id),
+	mLastProgress(0),
+	mLastInterval(0),
+	mLog("StreamStats")
+{
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void StreamStats::recordRequest(uint8_t operation, Clock::time_point start)
+{
+	int index = getOperation(operation);
+
+	if (index >= 0)
+	{
+		mRequests[index].record(Clock::now() - start);
+	}
+}
+
+void StreamStats::recordDeviceIo(Clock::time_point start)
+{
+	mDeviceIo.record(Clock::now() - start);
+}
+
+void StreamStats::recordProgress()
+{
+	int64_t now = duration_cast<nanoseconds>(
+			Clock::now().time_since_epoch()).count();
+
+	int64_t last = mLastProgress.exchange(now, memory_order_relaxed);
+
+	if (!last)
+	{
+		return;
+	}
+
+	int64_t interval = now - last;
+	int64_t lastInterval = mLastInterval.exchange(interval,
+												  memory_order_relaxed);
+
+	if (lastInterval)
+	{
+		mJitter.record(nanoseconds(std::abs(interval - lastInterval)));
+	}
+}
+
+void StreamStats::resetProgress()
+{
+	mLastProgress.store(0, memory_order_relaxed);
+	mLastInterval.store(0, memory_order_relaxed);
+}
+
+void StreamStats::dump()
+{
+	for (int i = 0; i < NUM_OPERATIONS; i++)
+	{
+		if (mRequests[i].getCount())
+		{
+			LOG(mLog, INFO) << "Stream " << mId << ", " << cOperationNames[i]
+							<< " requests, " << mRequests[i].getSummary();
+
+			mRequests[i].reset();
+		}
+	}
+
+	if (mDeviceIo.getCount())
+	{
+		LOG(mLog, INFO) << "Stream " << mId << ", device io, "
+						<< mDeviceIo.getSummary();
+
+		mDeviceIo.reset();
+	}
+
+	if (mJitter.getCount())
+	{
+		LOG(mLog, INFO) << "Stream " << mId << ", progress jitter, "
+						<< mJitter.getSummary();
+
+		mJitter.reset();
+	}
+
+	resetProgress();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+int StreamStats::getOperation(uint8_t operation)
+{
+	switch(operation)
+	{
+	case XENSND_OP_OPEN:
+		return OPEN;
+	case XENSND_OP_CLOSE:
+		return CLOSE;
+	case XENSND_OP_READ:
+		return READ;
+	case XENSND_OP_WRITE:
+		return WRITE;
+	case XENSND_OP_TRIGGER:
+		return TRIGGER;
+	case XENSND_OP_HW_PARAM_QUERY:
+		return QUERY;
+	default:
+		return -1;
+	}
+}
@@ -0,0 +1,176 @@
+/*
+ *  Stream latency statistics
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_STREAMSTATS_HPP_
+#define SRC_STREAMSTATS_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include <xen/be/Log.hpp>
+
+/***************************************************************************//**
+ * Lock-free log-linear latency histogram.
+ *
+ * Each power of two is split into 2^cSubBits linear buckets, so a recorded
+ * value is kept with at most 12.5% error over the whole 64-bit range.
+ * Recording is one relaxed atomic increment plus a max update which is rare
+ * after warm up, and may be done concurrently from any thread. The count
+ * and the mean are computed from the buckets on read, so reading concurrently
+ * with recording gives an approximate snapshot.
+ * @ingroup snd_be
+ ******************************************************************************/
+class LatencyHistogram
+{
+public:
+
+	LatencyHistogram();
+
+	/**
+	 * Records the value.
+	 * @param value value in nanoseconds
+	 */
+	void record(std::chrono::nanoseconds value);
+
+	/**
+	 * Returns number of recorded values.
+	 */
+	uint64_t getCount() const;
+
+	/**
+	 * Returns the value below which the given percent of values fall.
+	 * @param percentile percentile in range (0, 100]
+	 */
+	std::chrono::nanoseconds getPercentile(double percentile) const;
+
+	/**
+	 * Returns the mean value estimated from the bucket midpoints.
+	 */
+	std::chrono::nanoseconds getMean() const;
+
+	/**
+	 * Returns the max recorded value.
+	 */
+	std::chrono::nanoseconds getMax() const;
+
+	/**
+	 * Returns one line summary: count, mean, percentiles and max in us.
+	 */
+	std::string getSummary() const;
+
+	/**
+	 * Removes all recorded values.
+	 */
+	void reset();
+
+private:
+
+	static const unsigned cSubBits = 3;
+	static const size_t cNumBuckets = (64 - cSubBits + 1) << cSubBits;
+
+	std::atomic<uint64_t> mBuckets[cNumBuckets];
+	std::atomic<uint64_t> mMax;
+
+	static size_t getIndex(uint64_t value);
+	static uint64_t getLowerBound(size_t index);
+};
+
+/***************************************************************************//**
+ * Latency statistics of a stream.
+ *
+ * Collects histograms of the request processing time per operation, of the
+ * time blocked in the device read and write, and of the jitter between
+ * progress events. The jitter is the difference between two consecutive
+ * progress intervals. The statistics are logged and reset on dump.
+ * @ingroup snd_be
+ ******************************************************************************/
+class StreamStats
+{
+public:
+
+	typedef std::chrono::steady_clock Clock;
+
+	/**
+	 * @param id stream id
+	 */
+	explicit StreamStats(const std::string& id);
+
+	/**
+	 * Records the processing time of a request.
+	 * @param operation request operation
+	 * @param start     time the request was taken from the ring
+	 */
+	void recordRequest(uint8_t operation, Clock::time_point start);
+
+	/**
+	 * Records the time blocked in the device read or write.
+	 * @param start time the device call was started
+	 */
+	void recordDeviceIo(Clock::time_point start);
+
+	/**
+	 * Records a progress event.
+	 */
+	void recordProgress();
+
+	/**
+	 * Restarts the jitter measurement after a gap in progress events, e.g.
+	 * on stream start.
+	 */
+	void resetProgress();
+
+	/**
+	 * Logs the summary of non empty histograms and resets them.
+	 */
+	void dump();
+
+private:
+
+	enum Operation
+	{
+		OPEN,
+		CLOSE,
+		READ,
+		WRITE,
+		TRIGGER,
+		QUERY,
+		NUM_OPERATIONS
+	};
+
+	static const char* cOperationNames[NUM_OPERATIONS];
+
+	std::string mId;
+
+	LatencyHistogram mRequests[NUM_OPERATIONS];
+	LatencyHistogram mDeviceIo;
+	LatencyHistogram mJitter;
+
+	// time of the last progress event and the last interval in ns, 0 - none
+	std::atomic<int64_t> mLastProgress;
+	std::atomic<int64_t> mLastInterval;
+
+	XenBackend::Log mLog;
+
+	static int getOperation(uint8_t operation);
+};
+
+#endif /* SRC_STREAMSTATS_HPP_ */
@@ -0,0 +1,354 @@
+/*
+ *  Shared timer scheduler
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "TimerScheduler.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <xen/be/Exception.hpp>
+
+#include "RealTime.hpp"
+#include "Trace.hpp"
+
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::nanoseconds;
+
+/*******************************************************************************
+ * TimerScheduler
+ ******************************************************************************/
+
+const microseconds TimerScheduler::cDefaultSlack(2000);
+const microseconds TimerScheduler::cMinPeriod(1000);
+
+TimerScheduler::TimerScheduler(microseconds slack) :
+	mSlack(slack),
+	mRunning(nullptr),
+	mTimerFd(-1),
+	mEventFd(-1),
+	mEpollFd(-1),
+	mTerminate(false),
+	mNumWakeups(0),
+	mNumCallbacks(0),
+	mLog("TimerScheduler")
+{
+	try
+	{
+		if ((mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0)
+		{
+			throw XenBackend::Exception("Can't create timerfd", errno);
+		}
+
+		if ((mEventFd = eventfd(0, EFD_CLOEXEC)) < 0)
+		{
+			throw XenBackend::Exception("Can't create eventfd", errno);
+		}
+
+		if ((mEpollFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		{
+			throw XenBackend::Exception("Can't create epoll", errno);
+		}
+
+		for (auto fd : {mTimerFd, mEventFd})
+		{
+			epoll_event event {};
+
+			event.events = EPOLLIN;
+			event.data.fd = fd;
+
+			if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+			{
+				throw XenBackend::Exception("Can't add fd to epoll", errno);
+			}
+		}
+	}
+	catch(const std::exception& e)
+	{
+		release();
+
+		throw;
+	}
+
+	mThread = thread(&TimerScheduler::run, this);
+
+	LOG(mLog, DEBUG) << "Create timer scheduler, slack: "
+					 << mSlack.count() << " us";
+}
+
+TimerScheduler::~TimerScheduler()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mTerminate = true;
+	}
+
+	uint64_t value = 1;
+
+	if (::write(mEventFd, &value, sizeof(value)) < 0)
+	{
+		LOG(mLog, ERROR) << "Can't wake up scheduler thread";
+	}
+
+	mThread.join();
+
+	release();
+
+	LOG(mLog, DEBUG) << "Delete timer scheduler, wakeups: " << mNumWakeups
+					 << ", callbacks: " << mNumCallbacks;
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+TimerScheduler& TimerScheduler::getInstance()
+{
+	static TimerScheduler sScheduler;
+
+	return sScheduler;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void TimerScheduler::add(ScheduledTimer* timer, microseconds period)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (timer->mActive)
+	{
+		mTimers.erase(timer->mPos);
+	}
+
+	timer->mActive = true;
+	timer->mPeriod = std::max(period, cMinPeriod);
+	timer->mPos = mTimers.emplace(Clock::now() + timer->mPeriod, timer);
+
+	if (timer->mPos == mTimers.begin())
+	{
+		arm();
+	}
+}
+
+void TimerScheduler::remove(ScheduledTimer* timer, bool wait)
+{
+	unique_lock<mutex> lock(mMutex);
+
+	if (timer->mActive)
+	{
+		mTimers.erase(timer->mPos);
+
+		timer->mActive = false;
+	}
+
+	mBatch.erase(std::remove(mBatch.begin(), mBatch.end(), timer),
+				 mBatch.end());
+
+	if (wait && std::this_thread::get_id() != mThread.get_id())
+	{
+		mCondVar.wait(lock, [this, timer] { return mRunning != timer; });
+	}
+}
+
+void TimerScheduler::run()
+{
+	RealTime::setupThread(RealTime::ThreadClass::TIMER);
+
+	while(true)
+	{
+		epoll_event events[2];
+
+		int numEvents = epoll_wait(mEpollFd, events, 2, -1);
+
+		if (numEvents < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			LOG(mLog, ERROR) << "Wait for timers failed: " << strerror(errno);
+
+			break;
+		}
+
+		for (int i = 0; i < numEvents; i++)
+		{
+			uint64_t value;
+
+			if (::read(events[i].data.fd, &value, sizeof(value)) < 0)
+			{
+				DLOG(mLog, DEBUG) << "Spurious wakeup";
+			}
+		}
+
+		{
+			lock_guard<mutex> lock(mMutex);
+
+			if (mTerminate)
+			{
+				break;
+			}
+		}
+
+		dispatch();
+	}
+}
+
+void TimerScheduler::dispatch()
+{
+	unique_lock<mutex> lock(mMutex);
+
+	auto now = Clock::now();
+	auto limit = now + mSlack;
+
+	mNumWakeups++;
+
+	// take all timers which expire within the slack and reschedule them
+	while(!mTimers.empty() && mTimers.begin()->first <= limit)
+	{
+		auto deadline = mTimers.begin()->first;
+		auto timer = mTimers.begin()->second;
+
+		mTimers.erase(mTimers.begin());
+
+		deadline += timer->mPeriod;
+
+		// don't try to catch up missed periods
+		if (deadline <= now)
+		{
+			deadline = now + timer->mPeriod;
+		}
+
+		timer->mPos = mTimers.emplace(deadline, timer);
+
+		mBatch.push_back(timer);
+	}
+
+	arm();
+
+	while(!mBatch.empty())
+	{
+		auto timer = mBatch.front();
+
+		mBatch.pop_front();
+
+		mRunning = timer;
+
+		lock.unlock();
+
+		try
+		{
+			TRACE_SCOPE("ScheduledTimer::callback");
+
+			timer->mCbk();
+		}
+		catch(const std::exception& e)
+		{
+			LOG(mLog, ERROR) << e.what();
+		}
+
+		lock.lock();
+
+		mRunning = nullptr;
+		mNumCallbacks++;
+
+		mCondVar.notify_all();
+	}
+}
+
+void TimerScheduler::arm()
+{
+	itimerspec spec {};
+
+	if (!mTimers.empty())
+	{
+		auto time = duration_cast<nanoseconds>(
+				mTimers.begin()->first.time_since_epoch()).count();
+
+		// zero value disarms the timer
+		if (time <= 0)
+		{
+			time = 1;
+		}
+
+		spec.it_value.tv_sec = time / 1000000000;
+		spec.it_value.tv_nsec = time % 1000000000;
+	}
+
+	if (timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+	{
+		LOG(mLog, ERROR) << "Can't arm timerfd: " << strerror(errno);
+	}
+}
+
+void TimerScheduler::release()
+{
+	for (auto fd : {mEpollFd, mEventFd, mTimerFd})
+	{
+		if (fd >= 0)
+		{
+			::close(fd);
+		}
+	}
+
+	mEpollFd = mEventFd = mTimerFd = -1;
+}
+
+/*******************************************************************************
+ * ScheduledTimer
+ ******************************************************************************/
+
+ScheduledTimer::ScheduledTimer(Callback cbk, TimerScheduler& scheduler) :
+	mCbk(cbk),
+	mScheduler(scheduler),
+	mActive(false),
+	mPeriod(0)
+{
+}
+
+ScheduledTimer::~ScheduledTimer()
+{
+	stop();
+}
+
+void ScheduledTimer::start(microseconds period)
+{
+	mScheduler.add(this, period);
+}
+
+void ScheduledTimer::stop(bool wait)
+{
+	mScheduler.remove(this, wait);
+}
@@ -0,0 +1,157 @@
+/*
+ *  Shared timer scheduler
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_TIMERSCHEDULER_HPP_
+#define SRC_TIMERSCHEDULER_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <xen/be/Log.hpp>
+
+class ScheduledTimer;
+
+/***************************************************************************//**
+ * Runs periodic timers of all streams on one thread.
+ *
+ * The thread waits on a timerfd armed to the earliest deadline. On wakeup it
+ * takes all timers which expire within the slack and runs their callbacks
+ * in one batch, so close deadlines of different streams cost one wakeup.
+ * @ingroup snd_be
+ ******************************************************************************/
+class TimerScheduler
+{
+public:
+
+	typedef std::chrono::steady_clock Clock;
+
+	/**
+	 * Returns the scheduler shared by all streams of the process.
+	 */
+	static TimerScheduler& getInstance();
+
+	/**
+	 * @param slack max delay of a deadline to merge it with an earlier one
+	 */
+	explicit TimerScheduler(std::chrono::microseconds slack = cDefaultSlack);
+	~TimerScheduler();
+
+	/**
+	 * Returns number of wakeups since creation.
+	 */
+	uint64_t getNumWakeups() const { return mNumWakeups; }
+
+	/**
+	 * Returns number of dispatched callbacks since creation.
+	 */
+	uint64_t getNumCallbacks() const { return mNumCallbacks; }
+
+	static const std::chrono::microseconds cDefaultSlack;
+
+private:
+
+	friend class ScheduledTimer;
+
+	static const std::chrono::microseconds cMinPeriod;
+
+	std::chrono::microseconds mSlack;
+
+	std::multimap<Clock::time_point, ScheduledTimer*> mTimers;
+	std::deque<ScheduledTimer*> mBatch;
+	ScheduledTimer* mRunning;
+
+	int mTimerFd;
+	int mEventFd;
+	int mEpollFd;
+
+	bool mTerminate;
+	std::atomic<uint64_t> mNumWakeups;
+	std::atomic<uint64_t> mNumCallbacks;
+
+	std::mutex mMutex;
+	std::condition_variable mCondVar;
+	std::thread mThread;
+
+	XenBackend::Log mLog;
+
+	void add(ScheduledTimer* timer, std::chrono::microseconds period);
+	void remove(ScheduledTimer* timer, bool wait);
+
+	void run();
+	void dispatch();
+	void arm();
+	void release();
+};
+
+/***************************************************************************//**
+ * Periodic timer run by the timer scheduler.
+ *
+ * Drop-in replacement of XenBackend::Timer for periodic timers: the callback
+ * is called from the scheduler thread.
+ * @ingroup snd_be
+ ******************************************************************************/
+class ScheduledTimer
+{
+public:
+
+	typedef std::function<void()> Callback;
+
+	/**
+	 * @param cbk       callback
+	 * @param scheduler scheduler to run the timer on
+	 */
+	explicit ScheduledTimer(Callback cbk, TimerScheduler& scheduler =
+											  TimerScheduler::getInstance());
+	~ScheduledTimer();
+
+	/**
+	 * Starts the timer. Restarts it if it is already started.
+	 * @param period timer period
+	 */
+	void start(std::chrono::microseconds period);
+
+	/**
+	 * Stops the timer.
+	 * @param wait wait for the callback in progress. Must be false if the
+	 *             caller holds a lock taken by the callback.
+	 */
+	void stop(bool wait = true);
+
+private:
+
+	friend class TimerScheduler;
+
+	Callback mCbk;
+	TimerScheduler& mScheduler;
+
+	// accessed by the scheduler under its mutex
+	bool mActive;
+	std::chrono::microseconds mPeriod;
+	std::multimap<TimerScheduler::Clock::time_point,
+				  ScheduledTimer*>::iterator mPos;
+};
+
+#endif /* SRC_TIMERSCHEDULER_HPP_ */
@@ -0,0 +1,217 @@
+/*
+ *  Span tracing
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#include "Trace.hpp"
+
+#include <fstream>
+
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using std::lock_guard;
+using std::mutex;
+using std::ofstream;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+using std::chrono::duration;
+using std::chrono::duration_cast;
+
+namespace Trace {
+
+namespace {
+
+// keeps the buffer of the thread, the recorder keeps it after thread exit
+thread_local shared_ptr<void> gThreadBuffer;
+
+double toUs(Clock::duration value)
+{
+	return duration_cast<duration<double, std::micro>>(value).count();
+}
+
+}
+
+/*******************************************************************************
+ * Recorder
+ ******************************************************************************/
+
+string Recorder::sFileName = "/tmp/snd_be_trace.json";
+
+Recorder::Recorder() :
+	mLog("Trace")
+{
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+Recorder& Recorder::getInstance()
+{
+	static Recorder sRecorder;
+
+	return sRecorder;
+}
+
+void Recorder::record(const Event& event)
+{
+	if (!gThreadBuffer)
+	{
+		gThreadBuffer = createBuffer();
+	}
+
+	auto buffer = static_cast<Buffer*>(gThreadBuffer.get());
+	auto head = buffer->head.load(std::memory_order_relaxed);
+
+	buffer->events[head % cNumEvents] = event;
+
+	// publishes the event to dump
+	buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void Recorder::dump()
+{
+	vector<shared_ptr<Buffer>> buffers;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		buffers = mBuffers;
+	}
+
+	ofstream file(sFileName, std::ios::trunc);
+
+	file.setf(std::ios::fixed);
+	file.precision(3);
+
+	file << "{\"traceEvents\":[\n";
+
+	auto pid = getpid();
+	auto origin = Clock::time_point::max();
+	vector<vector<Event>> events;
+	size_t numEvents = 0;
+	bool first = true;
+
+	for (auto& buffer : buffers)
+	{
+		events.push_back(copyEvents(*buffer));
+
+		numEvents += events.back().size();
+
+		for (auto& event : events.back())
+		{
+			origin = std::min(origin, event.start);
+		}
+	}
+
+	for (size_t i = 0; i < buffers.size(); i++)
+	{
+		file << (first ? "" : ",\n")
+			 << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+			 << ",\"tid\":" << buffers[i]->tid
+			 << ",\"args\":{\"name\":\"" << buffers[i]->threadName << "\"}}";
+
+		first = false;
+
+		for (auto& event : events[i])
+		{
+			file << ",\n{\"name\":\"" << event.name
+				 << "\",\"ph\":\"X\",\"pid\":" << pid
+				 << ",\"tid\":" << buffers[i]->tid
+				 << ",\"ts\":" << toUs(event.start - origin)
+				 << ",\"dur\":" << toUs(event.duration);
+
+			if (event.arg != cNoArg)
+			{
+				file << ",\"args\":{\"arg\":" << event.arg << "}";
+			}
+
+			file << "}";
+		}
+	}
+
+	file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+	file.close();
+
+	if (!file)
+	{
+		LOG(mLog, ERROR) << "Can't write trace file: " << sFileName;
+
+		return;
+	}
+
+	LOG(mLog, INFO) << "Trace is written to: " << sFileName
+					<< ", threads: " << buffers.size()
+					<< ", spans: " << numEvents;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+shared_ptr<Recorder::Buffer> Recorder::createBuffer()
+{
+	shared_ptr<Buffer> buffer(new Buffer());
+	char name[16] = {};
+
+	pthread_getname_np(pthread_self(), name, sizeof(name));
+
+	buffer->tid = syscall(SYS_gettid);
+	buffer->threadName = name;
+	buffer->events.resize(cNumEvents);
+	buffer->head = 0;
+
+	lock_guard<mutex> lock(mMutex);
+
+	mBuffers.push_back(buffer);
+
+	return buffer;
+}
+
+vector<Event> Recorder::copyEvents(const Buffer& buffer)
+{
+	auto head = buffer.head.load(std::memory_order_acquire);
+	auto begin = head > cNumEvents ? head - cNumEvents : 0;
+
+	vector<Event> events;
+
+	for (auto i = begin; i < head; i++)
+	{
+		events.push_back(buffer.events[i % cNumEvents]);
+	}
+
+	// the writer may have overwritten the oldest events while copying
+	auto newHead = buffer.head.load(std::memory_order_acquire);
+
+	if (newHead >= cNumEvents && newHead - cNumEvents + 1 > begin)
+	{
+		auto numDropped = std::min<uint64_t>(newHead - cNumEvents + 1 - begin,
+											 events.size());
+
+		events.erase(events.begin(), events.begin() + numDropped);
+	}
+
+	return events;
+}
+
+}
@@ -0,0 +1,174 @@
+/*
+ *  Span tracing
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2017 EPAM Systems Inc.
+ */
+
+#ifndef SRC_TRACE_HPP_
+#define SRC_TRACE_HPP_
+
+#ifdef WITH_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <xen/be/Log.hpp>
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+/**
+ * Records a span from this point to the end of the enclosing scope.
+ * @param name span name, must be a string literal
+ */
+#define TRACE_SCOPE(name) \
+	Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+/**
+ * Records a span with an integer argument shown in the trace viewer.
+ * @param name span name, must be a string literal
+ * @param arg  argument value
+ */
+#define TRACE_SCOPE_ARG(name, arg) \
+	Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name, arg)
+
+namespace Trace {
+
+typedef std::chrono::steady_clock Clock;
+
+// the span has no argument
+const int64_t cNoArg = INT64_MIN;
+
+/***************************************************************************//**
+ * Recorded span.
+ * @ingroup snd_be
+ ******************************************************************************/
+struct Event
+{
+	const char* name;
+	int64_t arg;
+	Clock::time_point start;
+	Clock::duration duration;
+};
+
+/***************************************************************************//**
+ * Collects spans of all threads and writes them to a Chrome trace file.
+ *
+ * Each thread records into its own ring buffer which keeps the latest
+ * cNumEvents spans. The ring has one writer, so recording takes no lock:
+ * the mutex is taken only when a thread records its first span. Dump copies
+ * the rings and drops the spans which were overwritten while copying. The
+ * file is in Chrome trace event JSON format, which is opened by both
+ * chrome://tracing and Perfetto UI.
+ * @ingroup snd_be
+ ******************************************************************************/
+class Recorder
+{
+public:
+
+	/**
+	 * Returns the recorder shared by all threads of the process.
+	 */
+	static Recorder& getInstance();
+
+	/**
+	 * Sets the file to write the trace to.
+	 * @param fileName file name
+	 */
+	static void setFileName(const std::string& fileName) { sFileName = fileName; }
+
+	/**
+	 * Records the span on the calling thread.
+	 * @param event span
+	 */
+	void record(const Event& event);
+
+	/**
+	 * Writes the recorded spans of all threads to the file.
+	 */
+	void dump();
+
+private:
+
+	static const size_t cNumEvents = 16384;
+
+	static std::string sFileName;
+
+	struct Buffer
+	{
+		pid_t tid;
+		std::string threadName;
+		std::vector<Event> events;
+		std::atomic<uint64_t> head;
+	};
+
+	std::vector<std::shared_ptr<Buffer>> mBuffers;
+	std::mutex mMutex;
+
+	XenBackend::Log mLog;
+
+	Recorder();
+
+	std::shared_ptr<Buffer> createBuffer();
+	std::vector<Event> copyEvents(const Buffer& buffer);
+};
+
+/***************************************************************************//**
+ * Records the span of its lifetime.
+ * @ingroup snd_be
+ ******************************************************************************/
+class Scope
+{
+public:
+
+	/**
+	 * @param name span name, must outlive the process: a string literal
+	 * @param arg  argument shown in the trace viewer
+	 */
+	explicit Scope(const char* name, int64_t arg = cNoArg) :
+		mName(name), mArg(arg), mStart(Clock::now()) {}
+
+	~Scope()
+	{
+		Recorder::getInstance().record({mName, mArg, mStart,
+										Clock::now() - mStart});
+	}
+
+private:
+
+	const char* mName;
+	int64_t mArg;
+	Clock::time_point mStart;
+};
+
+}
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARG(name, arg)
+
+#endif
+
+#endif /* SRC_TRACE_HPP_ */